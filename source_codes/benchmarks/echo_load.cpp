@@ -0,0 +1,336 @@
+#include <arpa/inet.h>
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <fstream>
+#include <getopt.h>
+#include <iostream>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+#include "../common/latency_histogram.h"
+#include "../my_ping_protocol_independent/frame.h"
+
+using namespace std;
+using namespace std::chrono;
+
+/**
+ * Load generator for the echo servers, to compare their engines.
+ *
+ * Opens a number of UDP sockets or TCP connections to a running server
+ * and keeps a window of requests in flight on each: every echo that comes
+ * back is timed and replaced by a new request. UDP requests are bare
+ * datagrams with the send time in their first 8 bytes; TCP requests are
+ * frames of my_ping_protocol_independent/frame.h. A UDP window that saw no
+ * reply for LOSS_MS is refilled and the missing datagrams counted lost;
+ * if they arrive after all, they are ignored.
+ *
+ * Prints echoes/s, the median and 99th percentile RTT and, given the
+ * server's pid, the CPU time the server used per echo.
+ */
+
+#define MAX_EVENTS 256
+#define LOSS_MS 200 // Silence after which outstanding datagrams are lost
+
+/**
+ * @brief One client socket and its requests in flight.
+ */
+struct LoadSocket
+{
+  int fd;                              // UDP or TCP socket
+  int outstanding;                     // Requests without a reply
+  string inbox;                        // TCP bytes of incomplete frames
+  steady_clock::time_point last_reply; // For UDP loss detection
+  uint64_t lost_before;                // UDP sent earlier, in ns: lost
+};
+
+static bool udp = false; // UDP datagrams instead of TCP frames
+static int payload = 64; // Payload bytes of a request
+static uint32_t seq = 0; // Sequence number of the next TCP frame
+
+/**
+ * @brief Usage function
+ * @param name Program name
+ */
+void usage(const char *name)
+{
+  printf("Usage: %s [-u] [-h HOST] [-p PORT] [-l BYTES] [-c SOCKETS] "
+         "[-w WINDOW] [-d SECONDS] [-P SERVER_PID]\n"
+         "  -u     UDP datagrams instead of TCP frames\n"
+         "  -h     Server host (default 127.0.0.1)\n"
+         "  -p     Server port (default 8000)\n"
+         "  -l     Payload bytes per request (default 64)\n"
+         "  -c     Sockets (default 4)\n"
+         "  -w     Requests in flight per socket (default 8)\n"
+         "  -d     Seconds to run (default 5)\n"
+         "  -P     pid of the server, to report its CPU time per echo\n",
+         name);
+  exit(1);
+}
+
+uint64_t now_ns()
+{
+  return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch())
+      .count();
+}
+
+/**
+ * @brief CPU time a process used so far
+ * @param pid Process
+ * @return Seconds of user and system time, 0 if it cannot be read
+ */
+double cpu_seconds(int pid)
+{
+  ifstream stat("/proc/" + to_string(pid) + "/stat");
+  string line;
+  if (!getline(stat, line))
+    return 0;
+  // Fields after the command name, which may contain spaces
+  istringstream fields(line.substr(line.rfind(')') + 2));
+  string field;
+  unsigned long utime = 0, stime = 0;
+  for (int i = 3; fields >> field; i++)
+  {
+    if (i == 14)
+      utime = stoul(field);
+    if (i == 15)
+    {
+      stime = stoul(field);
+      break;
+    }
+  }
+  return (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+/**
+ * @brief Send requests on a socket
+ * @param sock Client socket
+ * @param n Number of requests
+ */
+void send_requests(LoadSocket &sock, int n)
+{
+  if (n <= 0)
+    return;
+  if (udp)
+  {
+    vector<char> datagram(payload, 0);
+    for (int i = 0; i < n; i++)
+    {
+      uint64_t sent = now_ns();
+      memcpy(datagram.data(), &sent, sizeof(sent));
+      if (send(sock.fd, datagram.data(), payload, 0) == payload)
+        sock.outstanding++;
+    }
+    return;
+  }
+
+  // All frames in one write, as a pipelining client does
+  string frames((FRAME_HEADER_LEN + payload) * n, '\0');
+  for (int i = 0; i < n; i++)
+  {
+    FrameHeader header = {(uint32_t)payload, seq++, now_ns()};
+    encode_header(&frames[i * (FRAME_HEADER_LEN + payload)], header);
+  }
+  size_t done = 0;
+  while (done < frames.size())
+  {
+    ssize_t sent = send(sock.fd, frames.data() + done, frames.size() - done,
+                        MSG_NOSIGNAL);
+    assert((sent > 0 || errno == EINTR) && "send() failed");
+    if (sent > 0)
+      done += sent;
+  }
+  sock.outstanding += n;
+}
+
+/**
+ * @brief Read every echo a socket has, recording RTTs
+ * @param sock Client socket
+ * @param rtts RTTs in ns
+ * @return Number of echoes of outstanding requests read
+ */
+int read_echoes(LoadSocket &sock, LatencyHistogram &rtts)
+{
+  char buffer[65536];
+  int echoes = 0;
+  while (1)
+  {
+    ssize_t n = recv(sock.fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+    if (n < 0)
+    {
+      assert((errno == EAGAIN || errno == EINTR) && "recv() failed");
+      break;
+    }
+    assert((n > 0 || udp) && "server closed the connection");
+
+    uint64_t received = now_ns();
+    if (udp)
+    {
+      uint64_t sent;
+      if (n < (ssize_t)sizeof(sent))
+        continue;
+      memcpy(&sent, buffer, sizeof(sent));
+      if (sent < sock.lost_before)
+        continue; // Already counted lost and replaced
+      rtts.add(received - sent);
+      echoes++;
+      continue;
+    }
+
+    sock.inbox.append(buffer, n);
+    size_t offset = 0;
+    while (sock.inbox.size() - offset >= FRAME_HEADER_LEN)
+    {
+      FrameHeader header = decode_header(sock.inbox.data() + offset);
+      size_t frame_len = FRAME_HEADER_LEN + header.length;
+      if (sock.inbox.size() - offset < frame_len)
+        break;
+      rtts.add(received - header.timestamp);
+      offset += frame_len;
+      echoes++;
+    }
+    sock.inbox.erase(0, offset);
+  }
+  sock.outstanding -= echoes;
+  if (echoes > 0)
+    sock.last_reply = steady_clock::now();
+  return echoes;
+}
+
+int main(int argc, char *argv[])
+{
+  string host = "127.0.0.1";
+  int port = 8000, sockets = 4, window = 8, seconds = 5, server_pid = 0;
+  int ch;
+
+  while ((ch = getopt(argc, argv, "uh:p:l:c:w:d:P:")) != -1)
+  {
+    switch (ch)
+    {
+    case 'u':
+      udp = true;
+      break;
+    case 'h':
+      host = optarg;
+      break;
+    case 'p':
+      port = atoi(optarg);
+      break;
+    case 'l':
+      payload = atoi(optarg);
+      break;
+    case 'c':
+      sockets = atoi(optarg);
+      break;
+    case 'w':
+      window = atoi(optarg);
+      break;
+    case 'd':
+      seconds = atoi(optarg);
+      break;
+    case 'P':
+      server_pid = atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (payload < 8 || sockets < 1 || window < 1 || seconds < 1)
+    usage(argv[0]);
+
+  struct hostent *server = gethostbyname(host.c_str());
+  assert((server != NULL) && "gethostbyname() failed");
+  struct sockaddr_in server_addr;
+  memset(&server_addr, 0, sizeof(server_addr));
+  server_addr.sin_family = AF_INET;
+  server_addr.sin_port = htons(port);
+  memcpy(&server_addr.sin_addr, server->h_addr, server->h_length);
+
+  int epfd = epoll_create1(0);
+  assert((epfd >= 0) && "epoll_create1() failed");
+  vector<LoadSocket> socks(sockets);
+  for (int i = 0; i < sockets; i++)
+  {
+    int fd = socket(AF_INET, udp ? SOCK_DGRAM : SOCK_STREAM, 0);
+    assert((fd >= 0) && "socket() failed");
+    int n = connect(fd, (struct sockaddr *)&server_addr, sizeof(server_addr));
+    assert((n >= 0) && "connect() failed");
+    int one = 1;
+    if (!udp)
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    socks[i].fd = fd;
+    socks[i].outstanding = 0;
+    socks[i].lost_before = 0;
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u32 = i;
+    n = epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+    assert((n >= 0) && "epoll_ctl() failed");
+  }
+
+  LatencyHistogram rtts;
+  uint64_t echoes = 0, lost = 0;
+  double cpu_start = server_pid ? cpu_seconds(server_pid) : 0;
+  auto start = steady_clock::now(), end = start + chrono::seconds(seconds);
+  for (auto &sock : socks)
+  {
+    sock.last_reply = start;
+    send_requests(sock, window);
+  }
+
+  struct epoll_event events[MAX_EVENTS];
+  while (steady_clock::now() < end)
+  {
+    int nready = epoll_wait(epfd, events, MAX_EVENTS, 10);
+    for (int i = 0; i < nready; i++)
+    {
+      LoadSocket &sock = socks[events[i].data.u32];
+      int n = read_echoes(sock, rtts);
+      echoes += n;
+      send_requests(sock, n);
+    }
+
+    // Datagrams the server dropped never come back
+    if (udp)
+    {
+      auto now = steady_clock::now();
+      for (auto &sock : socks)
+        if (now - sock.last_reply > milliseconds(LOSS_MS))
+        {
+          lost += sock.outstanding;
+          sock.outstanding = 0;
+          sock.lost_before = now_ns();
+          sock.last_reply = now;
+          send_requests(sock, window);
+        }
+    }
+  }
+  double elapsed = duration<double>(steady_clock::now() - start).count();
+  double cpu = server_pid ? cpu_seconds(server_pid) - cpu_start : 0;
+
+  printf("%s %d B, %d sockets x %d in flight: %.0f echoes/s, RTT p50 "
+         "%.1f us, p99 %.1f us",
+         udp ? "UDP" : "TCP", payload, sockets, window, echoes / elapsed,
+         rtts.percentile(0.5) / 1e3, rtts.percentile(0.99) / 1e3);
+  if (udp)
+    printf(", %lu lost", (unsigned long)lost);
+  if (server_pid)
+    printf(", server CPU %.2f us/echo", echoes ? cpu * 1e6 / echoes : 0.0);
+  printf("\n");
+
+  for (auto &sock : socks)
+    close(sock.fd);
+  close(epfd);
+  return 0;
+}
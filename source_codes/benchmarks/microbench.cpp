@@ -0,0 +1,523 @@
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cassert>
+#include <chrono>
+#include <fcntl.h>
+#include <fstream>
+#include <getopt.h>
+#include <iomanip>
+#include <iostream>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "../my_ping/udp_echo.h"
+#include "../my_ping_protocol_independent/echo_server.h"
+#include "../my_ping_protocol_independent/frame.h"
+#include "../tic_tac_toe/alloc_count.h"
+#include "../tic_tac_toe/batch_eval.h"
+#include "../tic_tac_toe/engine.h"
+#include "../tic_tac_toe/legacy.h"
+#include "../tic_tac_toe/mnk.h"
+#include "../tic_tac_toe/play_table.h"
+
+using namespace std;
+using namespace std::chrono;
+
+/**
+ * Microbenchmarks of the hot paths of the projects.
+ *
+ * Every benchmark times samples of a fixed number of operations and
+ * reports the mean ns/op, the median and 99th percentile of the per-sample
+ * ns/op, and the heap allocations per operation. The results can be saved
+ * as a JSON baseline, and a later run compared against it: any benchmark
+ * that allocates more, or whose median ns/op grew by more than the
+ * threshold and past the baseline's own 99th percentile, is reported and
+ * the run exits with status 1. The second bound keeps a benchmark that is
+ * noisy on this machine from failing on noise alone. Timings only compare
+ * on one machine, so a baseline is recorded where it is compared.
+ *
+ * The echo benchmarks run the servers' own loops, udp_echo() of my_ping
+ * and epoll_echo() of my_ping_protocol_independent, on a thread of this
+ * process, and time one round trip through them over loopback per
+ * operation.
+ */
+
+#define ECHO_PAYLOAD 64 // Bytes echoed per round trip
+
+/**
+ * @brief Keep a value alive so the compiler cannot drop the work behind it
+ * @param value Result of the operation
+ */
+template <class T> inline void keep(const T &value)
+{
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+/**
+ * @brief Result of one benchmark.
+ */
+struct BenchResult
+{
+  string name;          // group/variant
+  double ns_per_op;     // Mean over all samples
+  double p50_ns;        // Median of the per-sample ns/op
+  double p99_ns;        // 99th percentile of the per-sample ns/op
+  double allocs_per_op; // operator new calls per operation
+};
+
+/**
+ * @brief Settings of a run, set once from the command line.
+ */
+struct BenchConfig
+{
+  int samples;       // Timed samples per benchmark
+  string filter;     // Only run benchmarks whose name contains this
+  double threshold;  // Allowed slowdown against the baseline, in percent
+  string baseline;   // Baseline to compare with, or empty
+  string output;     // File to write the results to as JSON, or empty
+};
+
+static BenchConfig config = {200, "", 15, "", ""};
+static vector<BenchResult> results;
+
+/**
+ * @brief Time an operation and record the result
+ * @param name Name of the benchmark
+ * @param batch Operations per sample, enough to make a sample last well
+ * over the clock resolution
+ * @param op Operation, called with the index of the call
+ */
+template <class Op> void run_bench(const string &name, int batch, Op op)
+{
+  if (name.find(config.filter) == string::npos)
+    return;
+
+  for (int i = 0; i < batch; i++) // Warm up caches and lazy setup
+    op(i);
+
+  vector<double> samples(config.samples);
+  uint64_t before = heap_allocations;
+  double total = 0;
+  for (int s = 0; s < config.samples; s++)
+  {
+    auto start = steady_clock::now();
+    for (int i = 0; i < batch; i++)
+      op(i);
+    double ns = duration<double, nano>(steady_clock::now() - start).count();
+    samples[s] = ns / batch;
+    total += ns;
+  }
+  uint64_t allocated = heap_allocations - before;
+  uint64_t ops = (uint64_t)config.samples * batch;
+
+  sort(samples.begin(), samples.end());
+  BenchResult result;
+  result.name = name;
+  result.ns_per_op = total / ops;
+  result.p50_ns = samples[samples.size() / 2];
+  result.p99_ns = samples[min(samples.size() - 1, samples.size() * 99 / 100)];
+  result.allocs_per_op = (double)allocated / ops;
+  results.push_back(result);
+
+  cout << left << setw(28) << name << right << fixed << setprecision(1)
+       << setw(14) << result.ns_per_op << setw(14) << result.p50_ns
+       << setw(14) << result.p99_ns << setw(10) << setprecision(2)
+       << result.allocs_per_op << endl;
+}
+
+/**
+ * @brief Function to build a board from its cells
+ * @param cells 9 characters: 'O' client, 'X' server, anything else empty
+ * @return The board
+ */
+Board parse_board(const char *cells)
+{
+  Board board;
+  for (int cell = 0; cell < 9; cell++)
+  {
+    if (cells[cell] == 'O')
+      make_move(board, cell, CLIENT);
+    else if (cells[cell] == 'X')
+      make_move(board, cell, SERVER);
+  }
+  return board;
+}
+
+/**
+ * @brief Function to convert a board to the original representation
+ * @param board The board
+ * @return The same board as vector<vector<int>>
+ */
+vector<vector<int>> to_vector(const Board &board)
+{
+  vector<vector<int>> game_board(3, vector<int>(3));
+  for (int cell = 0; cell < 9; cell++)
+    game_board[cell / 3][cell % 3] = cell_owner(board, cell);
+  return game_board;
+}
+
+// Openings, middle games, both wins and a draw
+static const char *positions[] = {
+    ".........", "O........", "....O...X", "O...X...O", "OX..O...X",
+    "OOX.X....", "OOO.XX...", "OOXX.XO..", "XOXOXOOXO", "OXOXXOXOX"};
+#define NUM_BENCH_POSITIONS (int)(sizeof(positions) / sizeof(positions[0]))
+
+/**
+ * @brief Benchmarks of the 3x3 engine: evaluation, search and move choice
+ */
+void bench_engine()
+{
+  vector<Board> boards;
+  vector<vector<vector<int>>> vectors;
+  for (const char *cells : positions)
+  {
+    boards.push_back(parse_board(cells));
+    vectors.push_back(to_vector(boards.back()));
+  }
+
+  run_bench("evaluate_board/vector", 1000, [&](int i) {
+    keep(legacy::evaluate_board(vectors[i % NUM_BENCH_POSITIONS]));
+  });
+  run_bench("evaluate_board/bitboard", 1000, [&](int i) {
+    keep(evaluate_board(boards[i % NUM_BENCH_POSITIONS]));
+  });
+
+  // The batch API, per board, on 1024 boards at a time
+  vector<uint16_t> client(1024), server(1024);
+  vector<uint8_t> status(1024);
+  for (int i = 0; i < 1024; i++)
+  {
+    client[i] = boards[i % NUM_BENCH_POSITIONS].cells[CLIENT];
+    server[i] = boards[i % NUM_BENCH_POSITIONS].cells[SERVER];
+  }
+  run_bench("evaluate_board/batch1024", 1, [&](int) {
+    evaluate_batch(client.data(), server.data(), status.data(), 1024);
+    keep(status[0]);
+  });
+
+  // Server to move after the client's corner and the server's center
+  Board middle = parse_board("O...X...O");
+  vector<vector<int>> middle_vector = to_vector(middle);
+  run_bench("minimax/vector", 1, [&](int) {
+    uint64_t nodes = 0;
+    keep(legacy::minimax(middle_vector, 0, true, nodes));
+  });
+  run_bench("minimax/bitboard", 1, [&](int) {
+    uint64_t nodes = 0;
+    keep(minimax_full(middle, true, nodes));
+  });
+
+  // The search the server ran for every move before the play table, on a
+  // fresh transposition table
+  Board opening = parse_board("O........");
+  run_bench("minimax/alpha-beta", 1, [&](int) {
+    Search *search = new Search();
+    Board board = opening;
+    keep(search_best_move(board, *search));
+    delete search;
+  });
+
+  build_play_table();
+  vector<Board> server_turn;
+  for (Board &board : boards)
+    if (__builtin_popcount(board.cells[CLIENT]) >
+            __builtin_popcount(board.cells[SERVER]) &&
+        evaluate_board(board) == 0)
+      server_turn.push_back(board);
+  run_bench("find_best_move/table", 1000, [&](int i) {
+    keep(find_best_move(server_turn[i % server_turn.size()]));
+  });
+
+  // Same 15,15,5 middle game as tic_tac_toe/bench.cpp, to depth 3
+  MnkGame game(15, 15, 5);
+  MnkBoard board(&game);
+  for (int cell : {112, 113, 128})
+    board.make_move(cell, CLIENT);
+  for (int cell : {96, 98})
+    board.make_move(cell, SERVER);
+  run_bench("find_best_move/mnk15", 1, [&](int) {
+    keep(mnk_best_move(board, SERVER, 1000000, NULL, NULL, 3));
+  });
+}
+
+/**
+ * @brief Function to get a loopback socket bound to a free port
+ * @param type SOCK_DGRAM or SOCK_STREAM
+ * @param address Filled with the bound address
+ * @return The socket
+ */
+int bind_loopback(int type, struct sockaddr_in &address)
+{
+  int sockfd = socket(AF_INET, type, 0);
+  assert((sockfd >= 0) && "socket() failed");
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = 0;
+  int n = bind(sockfd, (struct sockaddr *)&address, sizeof(address));
+  assert((n >= 0) && "bind() failed");
+  socklen_t len = sizeof(address);
+  n = getsockname(sockfd, (struct sockaddr *)&address, &len);
+  assert((n >= 0) && "getsockname() failed");
+  return sockfd;
+}
+
+/**
+ * @brief Function to read exactly len bytes
+ * @param sockfd Stream socket
+ * @param buffer Destination
+ * @param len Bytes to read
+ * @return false if the peer closed the connection first
+ */
+bool read_full(int sockfd, char *buffer, size_t len)
+{
+  size_t done = 0;
+  while (done < len)
+  {
+    ssize_t n = read(sockfd, buffer + done, len - done);
+    if (n <= 0)
+      return false;
+    done += n;
+  }
+  return true;
+}
+
+/**
+ * @brief Round trips through udp_echo(), the loop of my_ping/server.cpp
+ */
+void bench_udp_echo()
+{
+  struct sockaddr_in address;
+  int server_fd = bind_loopback(SOCK_DGRAM, address);
+
+  // As the server runs by default: no rate limit, no busy polling
+  static volatile sig_atomic_t stop = 0, report = 0;
+  thread server([server_fd] {
+    BusyPoll busy(0);
+    RateLimiter limiter(4096, 0, 32);
+    udp_echo(server_fd, busy, limiter, true, stop, report);
+  });
+
+  int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+  assert((sockfd >= 0) && "socket() failed");
+  int n = connect(sockfd, (struct sockaddr *)&address, sizeof(address));
+  assert((n >= 0) && "connect() failed");
+  char message[ECHO_PAYLOAD] = {0}, reply[ECHO_PAYLOAD];
+  run_bench("echo/udp64", 1, [&](int) {
+    send(sockfd, message, sizeof(message), 0);
+    keep(recv(sockfd, reply, sizeof(reply), 0));
+  });
+
+  // The loop checks stop once per datagram
+  stop = 1;
+  send(sockfd, message, sizeof(message), 0);
+  server.join();
+  close(sockfd);
+  close(server_fd);
+}
+
+/**
+ * @brief Round trips of framed pings through epoll_echo(), the loop of
+ * my_ping_protocol_independent/server.cpp
+ */
+void bench_tcp_echo()
+{
+  struct sockaddr_in address;
+  int listen_fd = bind_loopback(SOCK_STREAM, address);
+  int n = listen(listen_fd, 1);
+  assert((n >= 0) && "listen() failed");
+  int flags = fcntl(listen_fd, F_GETFL, 0);
+  fcntl(listen_fd, F_SETFL, flags | O_NONBLOCK);
+
+  // With the server's default timeouts, so every event re-arms a deadline
+  static volatile sig_atomic_t stop = 0;
+  thread server([listen_fd] {
+    BusyPoll busy(0);
+    TimerWheel wheel(milliseconds(10));
+    ServerStats stats = {0, 0, 0};
+    epoll_echo(listen_fd, busy, wheel, stats, 60, 10, true, stop);
+  });
+
+  int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+  assert((sockfd >= 0) && "socket() failed");
+  n = connect(sockfd, (struct sockaddr *)&address, sizeof(address));
+  assert((n >= 0) && "connect() failed");
+  int one = 1;
+  setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+  char frame[FRAME_HEADER_LEN + ECHO_PAYLOAD] = {0};
+  char reply[FRAME_HEADER_LEN + ECHO_PAYLOAD];
+  uint32_t seq = 0;
+  run_bench("echo/tcp64", 1, [&](int) {
+    FrameHeader header = {ECHO_PAYLOAD, seq++, 0};
+    encode_header(frame, header);
+    send(sockfd, frame, sizeof(frame), 0);
+    keep(read_full(sockfd, reply, sizeof(reply)));
+  });
+
+  // Closing the connection wakes the loop to see stop
+  stop = 1;
+  close(sockfd);
+  server.join();
+  close(listen_fd);
+}
+
+/**
+ * @brief Function to write the results as JSON
+ * @param path File to write
+ */
+void write_results(const string &path)
+{
+  ofstream file(path);
+  assert(file && "cannot write the results");
+  file << "{" << endl;
+  for (size_t i = 0; i < results.size(); i++)
+  {
+    const BenchResult &r = results[i];
+    file << "  \"" << r.name << "\": {\"ns_per_op\": " << fixed
+         << setprecision(2) << r.ns_per_op << ", \"p50_ns\": " << r.p50_ns
+         << ", \"p99_ns\": " << r.p99_ns
+         << ", \"allocs_per_op\": " << r.allocs_per_op << "}"
+         << (i + 1 < results.size() ? "," : "") << endl;
+  }
+  file << "}" << endl;
+}
+
+/**
+ * @brief Function to read one number of a benchmark from a JSON baseline
+ * @param json Contents of the baseline
+ * @param name Name of the benchmark
+ * @param key Field to read
+ * @param value Filled with the number
+ * @return false if the benchmark or the field is missing
+ */
+bool baseline_value(const string &json, const string &name, const string &key,
+                    double &value)
+{
+  size_t at = json.find("\"" + name + "\"");
+  if (at == string::npos)
+    return false;
+  size_t end = json.find('}', at);
+  at = json.find("\"" + key + "\"", at);
+  if (at == string::npos || at > end)
+    return false;
+  at = json.find(':', at);
+  value = strtod(json.c_str() + at + 1, NULL);
+  return true;
+}
+
+/**
+ * @brief Compare the results with a baseline
+ * @param path Baseline written by an earlier run with -o
+ * @return Number of regressions
+ */
+int compare_baseline(const string &path)
+{
+  ifstream file(path);
+  assert(file && "cannot read the baseline");
+  stringstream contents;
+  contents << file.rdbuf();
+  string json = contents.str();
+
+  cout << endl
+       << left << setw(28) << "Against " + path << right << setw(14)
+       << "p50 ns" << setw(14) << "Change" << endl;
+  int regressions = 0;
+  for (const BenchResult &r : results)
+  {
+    double base_p50, base_p99, base_allocs;
+    if (!baseline_value(json, r.name, "p50_ns", base_p50) ||
+        !baseline_value(json, r.name, "p99_ns", base_p99) ||
+        !baseline_value(json, r.name, "allocs_per_op", base_allocs))
+    {
+      cout << left << setw(28) << r.name << right << setw(14) << "-"
+           << setw(14) << "new" << endl;
+      continue;
+    }
+    double change = (r.p50_ns / base_p50 - 1) * 100;
+    bool slower = change > config.threshold && r.p50_ns > base_p99;
+    bool allocates = r.allocs_per_op > base_allocs + 0.01;
+    cout << left << setw(28) << r.name << right << fixed << setprecision(1)
+         << setw(14) << base_p50 << setw(13) << showpos << change << "%"
+         << noshowpos;
+    if (slower)
+      cout << "  REGRESSION";
+    if (allocates)
+      cout << "  MORE ALLOCATIONS";
+    cout << endl;
+    regressions += slower || allocates;
+  }
+  return regressions;
+}
+
+/**
+ * @brief Print usage of the benchmarks
+ * @param name Name of the program
+ */
+void usage(const char *name)
+{
+  fprintf(stderr,
+          "usage %s [-n SAMPLES] [-f FILTER] [-b BASELINE] [-t PERCENT] "
+          "[-o OUTPUT]\n"
+          "  -n N  timed samples per benchmark (200)\n"
+          "  -f S  only run benchmarks whose name contains S\n"
+          "  -b F  compare with a baseline, exit 1 on a regression\n"
+          "  -t N  slowdown of the median against the baseline that "
+          "counts as a\n"
+          "        regression, in percent (15)\n"
+          "  -o F  write the results to F as JSON, e.g. a new baseline\n",
+          name);
+  exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+  int opt;
+  while ((opt = getopt(argc, argv, "n:f:b:t:o:")) != -1)
+  {
+    switch (opt)
+    {
+    case 'n':
+      config.samples = atoi(optarg);
+      break;
+    case 'f':
+      config.filter = optarg;
+      break;
+    case 'b':
+      config.baseline = optarg;
+      break;
+    case 't':
+      config.threshold = atof(optarg);
+      break;
+    case 'o':
+      config.output = optarg;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (config.samples < 1 || optind < argc)
+    usage(argv[0]);
+
+  cout << left << setw(28) << "Benchmark" << right << setw(14) << "ns/op"
+       << setw(14) << "p50 ns" << setw(14) << "p99 ns" << setw(10)
+       << "allocs" << endl;
+  bench_engine();
+  bench_udp_echo();
+  bench_tcp_echo();
+
+  if (!config.output.empty())
+    write_results(config.output);
+  if (!config.baseline.empty() && compare_baseline(config.baseline) > 0)
+    return 1;
+  return 0;
+}
@@ -0,0 +1,221 @@
+#ifndef BUSY_POLL_H
+#define BUSY_POLL_H
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <vector>
+
+/**
+ * Busy polling for the ping clients and servers (--busy-poll).
+ *
+ * A blocking receive puts the thread to sleep, and the datagram or frame
+ * it waits for then has to wake it up again; on loopback that wake-up
+ * costs about as much as the echo itself. With busy polling a receive
+ * first spins on non-blocking calls for a budget of microseconds and only
+ * blocks once the budget is spent, trading CPU time for latency.
+ *
+ * Where the kernel allows it the socket also gets SO_BUSY_POLL and
+ * SO_PREFER_BUSY_POLL, so that each of those calls polls the device queue
+ * of a NIC-backed socket rather than only looking at the socket itself.
+ * Loopback has no device queue to poll: there only the spinning helps.
+ */
+
+#define BUSY_POLL_US 100  // Default spin budget of a receive
+#define BUSY_POLL_YIELD 16 // Empty polls between two sched_yield()
+
+class BusyPoll
+{
+public:
+  typedef std::chrono::steady_clock clock;
+
+  /**
+   * @param budget_us Spin time of a receive before it blocks, 0 for none
+   */
+  BusyPoll(long budget_us = 0)
+      : budget_us(budget_us), kernel(false), spun(0), blocked(0)
+  {
+  }
+
+  bool enabled() const
+  {
+    return budget_us > 0;
+  }
+
+  /**
+   * @brief Ask the kernel to busy poll a socket too, where it can
+   * @param fd Socket
+   */
+  void setup(int fd)
+  {
+    if (!enabled())
+      return;
+#ifdef SO_BUSY_POLL
+    int usecs = budget_us;
+    // Raising it over net.core.busy_read takes CAP_NET_ADMIN
+    kernel = setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usecs,
+                        sizeof(usecs)) == 0;
+#endif
+#ifdef SO_PREFER_BUSY_POLL
+    int on = 1;
+    if (kernel)
+      setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &on, sizeof(on));
+#endif
+  }
+
+  /**
+   * @brief recvfrom() that spins for the budget before blocking
+   * @param stop Checked while spinning, the receive fails with EINTR once
+   * it is set; NULL if nothing can stop it
+   * @return As recvfrom()
+   */
+  ssize_t recvfrom(int fd, void *buffer, size_t len, int flags,
+                   struct sockaddr *addr, socklen_t *addrlen,
+                   const volatile sig_atomic_t *stop = NULL)
+  {
+    if (enabled())
+    {
+      clock::time_point deadline =
+          clock::now() + std::chrono::microseconds(budget_us);
+      socklen_t addr_capacity = addrlen ? *addrlen : 0;
+      unsigned polls = 0;
+      do
+      {
+        if (stop && *stop)
+        {
+          errno = EINTR;
+          return -1;
+        }
+        ssize_t n =
+            ::recvfrom(fd, buffer, len, flags | MSG_DONTWAIT, addr, addrlen);
+        if (n >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+        {
+          spun++;
+          return n;
+        }
+        if (addrlen)
+          *addrlen = addr_capacity;
+        maybe_yield(++polls);
+      } while (clock::now() < deadline);
+    }
+    blocked++;
+    return ::recvfrom(fd, buffer, len, flags, addr, addrlen);
+  }
+
+  /**
+   * @brief epoll_wait() that spins for the budget before blocking
+   * @param stop As for recvfrom()
+   * @return As epoll_wait()
+   */
+  int epoll_wait(int epfd, struct epoll_event *events, int max_events,
+                 int timeout_ms, const volatile sig_atomic_t *stop = NULL)
+  {
+    if (enabled())
+    {
+      clock::time_point deadline =
+          clock::now() + std::chrono::microseconds(budget_us);
+      unsigned polls = 0;
+      do
+      {
+        if (stop && *stop)
+        {
+          errno = EINTR;
+          return -1;
+        }
+        int n = ::epoll_wait(epfd, events, max_events, 0);
+        if (n != 0)
+        {
+          spun++;
+          return n;
+        }
+        maybe_yield(++polls);
+      } while (clock::now() < deadline);
+    }
+    blocked++;
+    return ::epoll_wait(epfd, events, max_events, timeout_ms);
+  }
+
+  /**
+   * @brief Print how the receives were served and the CPU time used
+   * @param cpu_seconds CPU time of the measured part of the run
+   * @param wall_seconds Wall clock time of the same part
+   * @param operations Echoes or probes, to give the CPU time of one
+   */
+  void report(double cpu_seconds, double wall_seconds,
+              uint64_t operations) const
+  {
+    printf("CPU time: %.1f ms, %.0f%% of one core, %.1f us per echo\n",
+           cpu_seconds * 1e3,
+           wall_seconds > 0 ? cpu_seconds * 100 / wall_seconds : 0.0,
+           operations ? cpu_seconds * 1e6 / operations : 0.0);
+    if (!enabled())
+      return;
+    printf("Busy poll: %ld us budget%s, %lu receives served while spinning, "
+           "%lu blocked\n",
+           budget_us, kernel ? " (SO_BUSY_POLL set)" : "",
+           (unsigned long)spun, (unsigned long)blocked);
+  }
+
+private:
+  long budget_us;   // Spin time of a receive before it blocks
+  bool kernel;      // The kernel accepted SO_BUSY_POLL
+  uint64_t spun;    // Receives served while spinning
+  uint64_t blocked; // Receives that had to block
+
+  /**
+   * @brief Let the peer run if it shares the core, which it has to for
+   * the awaited message to ever come
+   * @param polls Empty polls so far
+   */
+  static void maybe_yield(unsigned polls)
+  {
+    if (polls % BUSY_POLL_YIELD == 0)
+      sched_yield();
+  }
+};
+
+/**
+ * @brief CPU time this process used so far
+ * @return Seconds of user and system time
+ */
+inline double process_cpu_seconds()
+{
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+         (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+/**
+ * @brief Print the percentiles of a series of RTTs on one line
+ *
+ * Nearest rank: the p percentile is the smallest RTT that at least p of
+ * the RTTs do not exceed, so the upper percentiles of a short series are
+ * its largest values rather than values from the middle.
+ *
+ * @param rtts RTTs in microseconds, sorted in place
+ */
+inline void print_rtt_percentiles(std::vector<long> &rtts)
+{
+  if (rtts.empty())
+    return;
+  std::sort(rtts.begin(), rtts.end());
+  auto at = [&](double p)
+  {
+    // The epsilon keeps p * n that should be whole from rounding up
+    size_t rank = (size_t)std::ceil(p * rtts.size() - 1e-9);
+    return rtts[rank > 0 ? rank - 1 : 0];
+  };
+  printf("\tp50 = %ldus, p90 = %ldus, p99 = %ldus, p99.9 = %ldus\n", at(0.5),
+         at(0.9), at(0.99), at(0.999));
+}
+
+#endif
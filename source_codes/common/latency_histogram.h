@@ -0,0 +1,88 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Histogram of microsecond values in bounded memory, for the latency
+ * percentiles of a run of any length: the trace replay of my_iperf, the
+ * release times of the my_ping impairment emulator and the move latency of
+ * the tic_tac_toe bots.
+ *
+ * Values below 1024 have a bucket each; larger ones share 64 buckets per
+ * power of two, so a percentile is off by less than 2%. Adding a value is
+ * O(1) and never allocates.
+ */
+
+class LatencyHistogram
+{
+public:
+  LatencyHistogram() : counts(1024 + 54 * 64, 0), total(0), largest(0)
+  {
+  }
+
+  void add(uint64_t value)
+  {
+    counts[index(value)]++;
+    total++;
+    if (value > largest)
+      largest = value;
+  }
+
+  uint64_t count() const
+  {
+    return total;
+  }
+
+  uint64_t max() const
+  {
+    return largest;
+  }
+
+  /**
+   * @brief Smallest value that at least p of the values do not exceed,
+   * the nearest rank
+   * @param p Fraction between 0 and 1
+   * @return Lower bound of its bucket, 0 if there are no values
+   */
+  uint64_t percentile(double p) const
+  {
+    // The epsilon keeps p * total that should be whole from rounding up
+    uint64_t rank = (uint64_t)std::ceil(p * total - 1e-9), seen = 0;
+    if (rank == 0)
+      rank = 1;
+    for (size_t i = 0; i < counts.size() && total > 0; i++)
+    {
+      seen += counts[i];
+      if (seen >= rank)
+        return lower_bound(i);
+    }
+    return 0;
+  }
+
+private:
+  std::vector<uint64_t> counts; // Values per bucket
+  uint64_t total;               // Values added
+  uint64_t largest;             // Largest value added
+
+  static size_t index(uint64_t value)
+  {
+    if (value < 1024)
+      return value;
+    int msb = 63 - __builtin_clzll(value); // 10 or more
+    return 1024 + (msb - 10) * 64 + ((value >> (msb - 6)) & 63);
+  }
+
+  static uint64_t lower_bound(size_t i)
+  {
+    if (i < 1024)
+      return i;
+    int msb = (i - 1024) / 64 + 10;
+    return (1ULL << msb) + ((uint64_t)((i - 1024) % 64) << (msb - 6));
+  }
+};
+
+#endif
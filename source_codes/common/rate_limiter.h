@@ -0,0 +1,267 @@
+#ifndef RATE_LIMITER_H
+#define RATE_LIMITER_H
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <netinet/in.h>
+#include <vector>
+
+/**
+ * Per-source admission control for the UDP echo servers.
+ *
+ * Every source IPv4 address gets a token bucket that refills at rate
+ * packets per second up to burst packets; a datagram is admitted if its
+ * source has a whole token left and dropped otherwise, so one flooding
+ * client cannot take the whole recvfrom loop from the others. The port is
+ * not part of the key: a client that sends from many ports still shares
+ * one bucket.
+ *
+ * Buckets live in a fixed-size table allocated up front: a chained hash
+ * over an array of entries, with the entries also on an LRU list. When the
+ * table is full the least recently seen source is evicted and its counters
+ * are folded into the totals, so memory stays bounded whatever the number
+ * of sources. Lookup, insert and eviction never allocate.
+ *
+ * Not thread-safe: a limiter belongs to the receive loop that calls
+ * admit().
+ */
+
+/**
+ * @brief Token bucket and counters of one source.
+ */
+struct SourceBucket
+{
+  uint32_t addr;     // IPv4 address, network byte order
+  double tokens;     // Packets that may be admitted now
+  std::chrono::steady_clock::time_point refilled; // Time tokens was set
+  uint64_t admitted; // Datagrams echoed
+  uint64_t dropped;  // Datagrams dropped over the rate
+  int hash_next;     // Next entry of the hash chain, -1 for none
+  int lru_prev;      // More recently seen entry, -1 for none
+  int lru_next;      // Less recently seen entry, -1 for none
+};
+
+class RateLimiter
+{
+public:
+  typedef std::chrono::steady_clock clock;
+
+  /**
+   * @param capacity Sources tracked at once
+   * @param rate Packets per second admitted per source, 0 for no limit
+   * @param burst Packets a source may send at once after being quiet
+   */
+  RateLimiter(size_t capacity, double rate, double burst)
+      : rate(rate), burst(burst < 1 ? 1 : burst), entries(capacity),
+        used(0), lru_head(-1), lru_tail(-1), evicted(0), evicted_admitted(0),
+        evicted_dropped(0)
+  {
+    size_t buckets = 1;
+    while (buckets < capacity * 2)
+      buckets <<= 1;
+    heads.assign(buckets, -1);
+  }
+
+  /**
+   * @brief Charge one datagram to its source
+   * @param source Address the datagram came from
+   * @param now Time it was received
+   * @return true to echo it, false to drop it
+   */
+  bool admit(const struct sockaddr_in &source, clock::time_point now)
+  {
+    SourceBucket &bucket = entries[find_or_insert(source, now)];
+    if (rate > 0)
+    {
+      double elapsed =
+          std::chrono::duration<double>(now - bucket.refilled).count();
+      bucket.tokens += elapsed * rate;
+      if (bucket.tokens > burst)
+        bucket.tokens = burst;
+      bucket.refilled = now;
+      if (bucket.tokens < 1)
+      {
+        bucket.dropped++;
+        return false;
+      }
+      bucket.tokens -= 1;
+    }
+    bucket.admitted++;
+    return true;
+  }
+
+  /**
+   * @brief Call f on every tracked source, most recently seen first
+   * @param f Callable taking a const SourceBucket &
+   */
+  template <typename F> void for_each(F f) const
+  {
+    for (int i = lru_head; i != -1; i = entries[i].lru_next)
+      f(entries[i]);
+  }
+
+  size_t size() const
+  {
+    return used;
+  }
+
+  uint64_t evictions() const
+  {
+    return evicted;
+  }
+
+  /**
+   * @brief Datagrams admitted and dropped, including evicted sources
+   * @param admitted Set to the total admitted
+   * @param dropped Set to the total dropped
+   */
+  void totals(uint64_t &admitted, uint64_t &dropped) const
+  {
+    admitted = evicted_admitted;
+    dropped = evicted_dropped;
+    for_each([&](const SourceBucket &bucket) {
+      admitted += bucket.admitted;
+      dropped += bucket.dropped;
+    });
+  }
+
+private:
+  double rate;                       // Tokens added per second
+  double burst;                      // Tokens a bucket holds at most
+  std::vector<SourceBucket> entries; // All buckets, capacity of them
+  std::vector<int> heads;            // First entry of every hash chain
+  size_t used;                       // Entries handed out so far
+  int lru_head;                      // Most recently seen entry
+  int lru_tail;                      // Least recently seen entry
+  uint64_t evicted;                  // Sources evicted
+  uint64_t evicted_admitted;         // Admitted by evicted sources
+  uint64_t evicted_dropped;          // Dropped from evicted sources
+
+  size_t hash(uint32_t addr) const
+  {
+    uint64_t key = addr * 0x9E3779B97F4A7C15ULL; // Fibonacci hashing
+    return (key >> 32) & (heads.size() - 1);
+  }
+
+  void lru_unlink(int i)
+  {
+    SourceBucket &bucket = entries[i];
+    if (bucket.lru_prev != -1)
+      entries[bucket.lru_prev].lru_next = bucket.lru_next;
+    else
+      lru_head = bucket.lru_next;
+    if (bucket.lru_next != -1)
+      entries[bucket.lru_next].lru_prev = bucket.lru_prev;
+    else
+      lru_tail = bucket.lru_prev;
+  }
+
+  void lru_push_front(int i)
+  {
+    entries[i].lru_prev = -1;
+    entries[i].lru_next = lru_head;
+    if (lru_head != -1)
+      entries[lru_head].lru_prev = i;
+    lru_head = i;
+    if (lru_tail == -1)
+      lru_tail = i;
+  }
+
+  /**
+   * @brief Take the least recently seen entry out of the table
+   * @return Index of the freed entry
+   */
+  int evict()
+  {
+    int i = lru_tail;
+    SourceBucket &bucket = entries[i];
+    int *link = &heads[hash(bucket.addr)];
+    while (*link != i)
+      link = &entries[*link].hash_next;
+    *link = bucket.hash_next;
+    lru_unlink(i);
+
+    evicted++;
+    evicted_admitted += bucket.admitted;
+    evicted_dropped += bucket.dropped;
+    return i;
+  }
+
+  /**
+   * @brief Find the bucket of a source, creating it if it is new
+   * @param source Source address
+   * @param now Time of the datagram, when a new bucket starts full
+   * @return Index of the bucket, now the most recently seen
+   */
+  int find_or_insert(const struct sockaddr_in &source, clock::time_point now)
+  {
+    uint32_t addr = source.sin_addr.s_addr;
+    size_t h = hash(addr);
+    for (int i = heads[h]; i != -1; i = entries[i].hash_next)
+    {
+      if (entries[i].addr == addr)
+      {
+        if (i != lru_head)
+        {
+          lru_unlink(i);
+          lru_push_front(i);
+        }
+        return i;
+      }
+    }
+
+    int i = used < entries.size() ? (int)used++ : evict();
+    SourceBucket &bucket = entries[i];
+    bucket.addr = addr;
+    bucket.tokens = burst;
+    bucket.refilled = now;
+    bucket.admitted = 0;
+    bucket.dropped = 0;
+    bucket.hash_next = heads[h];
+    heads[h] = i;
+    lru_push_front(i);
+    return i;
+  }
+};
+
+/**
+ * @brief Print the totals of a limiter and its busiest sources
+ * @param limiter Limiter to report on
+ * @param top Sources to list at most, by datagrams received
+ */
+inline void report_sources(const RateLimiter &limiter, size_t top = 10)
+{
+  uint64_t admitted, dropped;
+  limiter.totals(admitted, dropped);
+  printf("\n%lu datagrams admitted, %lu dropped, %zu sources tracked, "
+         "%lu evicted\n",
+         (unsigned long)admitted, (unsigned long)dropped, limiter.size(),
+         (unsigned long)limiter.evictions());
+
+  std::vector<const SourceBucket *> sources;
+  limiter.for_each(
+      [&](const SourceBucket &bucket) { sources.push_back(&bucket); });
+  size_t shown = std::min(top, sources.size());
+  std::partial_sort(sources.begin(), sources.begin() + shown, sources.end(),
+                    [](const SourceBucket *a, const SourceBucket *b) {
+                      return a->admitted + a->dropped >
+                             b->admitted + b->dropped;
+                    });
+  if (shown > 0)
+    printf("%15s %12s %12s\n", "Source", "Admitted", "Dropped");
+  for (size_t i = 0; i < shown; i++)
+  {
+    char name[INET_ADDRSTRLEN];
+    struct in_addr addr;
+    addr.s_addr = sources[i]->addr;
+    inet_ntop(AF_INET, &addr, name, INET_ADDRSTRLEN);
+    printf("%15s %12lu %12lu\n", name, (unsigned long)sources[i]->admitted,
+           (unsigned long)sources[i]->dropped);
+  }
+}
+
+#endif
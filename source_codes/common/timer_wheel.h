@@ -0,0 +1,292 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Hierarchical timer wheel for connection deadlines.
+ *
+ * Time is counted in ticks of a fixed length. Level 0 has one slot per
+ * tick for the next 256 ticks, level 1 one slot per 256 ticks, and so on
+ * for 4 levels, so a timer lands in the slot of the highest tick digit in
+ * which its expiry differs from the current tick. When level 0 wraps, the
+ * next slot of level 1 is cascaded down, and so on up the levels.
+ *
+ * Timers are intrusive doubly-linked nodes owned by the caller, so
+ * schedule(), cancel() and expiring a timer are O(1) and never allocate,
+ * however many connections are open. Re-arming a deadline on every read
+ * costs an unlink and a link. A bitmap of occupied slots lets advance()
+ * and timeout_ms() skip empty stretches of the wheel.
+ *
+ * Not thread-safe: a wheel belongs to the event loop that advances it.
+ */
+
+#define WHEEL_LEVELS 4
+#define WHEEL_BITS 8                  // Bits of the tick per level
+#define WHEEL_SLOTS (1 << WHEEL_BITS) // Slots per level
+
+/**
+ * @brief One deadline, embedded in the object it belongs to.
+ */
+struct Timer
+{
+  Timer *next = NULL;             // Next timer of the slot
+  Timer *prev = NULL;             // Previous timer of the slot
+  uint64_t expires = 0;           // Tick the timer fires at
+  int8_t level = -1;              // Level of its slot, -1 if not armed
+  uint8_t slot = 0;               // Slot within the level
+  void (*expire)(Timer *) = NULL; // Called when the timer fires
+  void *data = NULL;              // For the owner, e.g. its connection
+
+  bool armed() const
+  {
+    return level >= 0;
+  }
+};
+
+class TimerWheel
+{
+public:
+  typedef std::chrono::steady_clock clock;
+
+  /**
+   * @param tick Length of a tick, the resolution of the wheel
+   */
+  explicit TimerWheel(clock::duration tick)
+      : tick(tick), start(clock::now()), current(0), count(0)
+  {
+    for (int l = 0; l < WHEEL_LEVELS; l++)
+      for (int s = 0; s < WHEEL_SLOTS; s++)
+        slots[l][s] = NULL;
+    for (int l = 0; l < WHEEL_LEVELS; l++)
+      for (int w = 0; w < WHEEL_SLOTS / 64; w++)
+        occupied[l][w] = 0;
+  }
+
+  TimerWheel(const TimerWheel &) = delete;
+  TimerWheel &operator=(const TimerWheel &) = delete;
+
+  /**
+   * @brief Arm a timer, or move it if it is already armed
+   * @param timer Timer with its expire callback set
+   * @param delay Time from now until it fires, rounded up to a tick
+   */
+  void schedule(Timer &timer, clock::duration delay)
+  {
+    if (timer.armed())
+      unlink(timer);
+    else
+      count++;
+    // First tick that starts at or after the deadline, never a past one
+    clock::duration at = clock::now() + delay - start;
+    int64_t expires = (at + tick - clock::duration(1)) / tick;
+    timer.expires = expires > (int64_t)current ? expires : current + 1;
+    link(timer);
+  }
+
+  /**
+   * @brief Disarm a timer; does nothing if it is not armed
+   * @param timer Timer to cancel
+   */
+  void cancel(Timer &timer)
+  {
+    if (!timer.armed())
+      return;
+    unlink(timer);
+    count--;
+  }
+
+  /**
+   * @brief Fire every timer that expired up to now
+   *
+   * Callbacks run one at a time and may schedule or cancel any timer,
+   * including the one that fired.
+   *
+   * @param now Current time
+   * @return Number of timers that fired
+   */
+  size_t advance(clock::time_point now)
+  {
+    uint64_t target = to_tick(now);
+    size_t fired = 0;
+    while (current < target)
+    {
+      if (count == 0)
+      {
+        current = target; // Nothing to cascade or fire on the way
+        break;
+      }
+      // Jump over ticks with an empty slot and no cascade
+      uint64_t next = current + ticks_to_next();
+      if (next > target)
+      {
+        current = target;
+        break;
+      }
+      current = next;
+      cascade();
+      fired += fire(current & (WHEEL_SLOTS - 1));
+    }
+    return fired;
+  }
+
+  /**
+   * @brief Time until advance() may have work, as an epoll_wait timeout
+   * @return Milliseconds, rounded up, or -1 if no timer is armed
+   */
+  int timeout_ms() const
+  {
+    if (count == 0)
+      return -1;
+    auto left = std::chrono::ceil<std::chrono::milliseconds>(next_due() -
+                                                             clock::now());
+    return left.count() > 0 ? (int)left.count() : 0;
+  }
+
+  /**
+   * @brief Time until which advance() has no work, for finer waits than
+   * timeout_ms()
+   * @return Start of the next tick with a timer or a cascade, or
+   * clock::time_point::max() if no timer is armed
+   */
+  clock::time_point next_due() const
+  {
+    if (count == 0)
+      return clock::time_point::max();
+    return start + tick * (int64_t)(current + ticks_to_next());
+  }
+
+  size_t size() const
+  {
+    return count;
+  }
+
+private:
+  clock::duration tick;                              // Length of a tick
+  clock::time_point start;                           // Time of tick 0
+  uint64_t current;                                  // Last tick advanced
+  size_t count;                                      // Armed timers
+  Timer *slots[WHEEL_LEVELS][WHEEL_SLOTS];           // Heads of the lists
+  uint64_t occupied[WHEEL_LEVELS][WHEEL_SLOTS / 64]; // Non-empty slots
+
+  uint64_t to_tick(clock::time_point time) const
+  {
+    return (uint64_t)((time - start) / tick);
+  }
+
+  /**
+   * @brief Put an unlinked timer into the slot its expiry belongs to
+   *
+   * A timer cascaded at the very tick it expires on, a multiple of
+   * WHEEL_SLOTS, goes into the level 0 slot of the current tick, which
+   * fire() empties right after the cascade.
+   *
+   * @param timer Timer with expires set
+   */
+  void link(Timer &timer)
+  {
+    uint64_t expires = timer.expires > current ? timer.expires : current;
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 &&
+           (expires >> (WHEEL_BITS * (level + 1))) !=
+               (current >> (WHEEL_BITS * (level + 1))))
+      level++;
+    int slot = (expires >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1);
+    // Beyond the span of the wheel: parked in the first slot of the top
+    // level, which is cascaded, and the timer placed again, whenever the
+    // whole wheel wraps
+    if ((expires >> (WHEEL_BITS * WHEEL_LEVELS)) !=
+        (current >> (WHEEL_BITS * WHEEL_LEVELS)))
+      slot = 0;
+
+    timer.level = level;
+    timer.slot = slot;
+    timer.prev = NULL;
+    timer.next = slots[level][slot];
+    if (timer.next != NULL)
+      timer.next->prev = &timer;
+    slots[level][slot] = &timer;
+    occupied[level][slot / 64] |= (uint64_t)1 << (slot % 64);
+  }
+
+  /**
+   * @brief Take a timer out of its slot and mark it not armed
+   * @param timer Armed timer
+   */
+  void unlink(Timer &timer)
+  {
+    int level = timer.level, slot = timer.slot;
+    if (timer.prev != NULL)
+      timer.prev->next = timer.next;
+    else
+      slots[level][slot] = timer.next;
+    if (timer.next != NULL)
+      timer.next->prev = timer.prev;
+    if (slots[level][slot] == NULL)
+      occupied[level][slot / 64] &= ~((uint64_t)1 << (slot % 64));
+    timer.next = timer.prev = NULL;
+    timer.level = -1;
+  }
+
+  /**
+   * @brief Ticks from current to the next tick with a timer in level 0 or
+   * a cascade, at least 1
+   */
+  uint64_t ticks_to_next() const
+  {
+    int from = (current & (WHEEL_SLOTS - 1)) + 1;
+    for (int s = from; s < WHEEL_SLOTS;)
+    {
+      uint64_t bits = occupied[0][s / 64] >> (s % 64);
+      if (bits != 0)
+        return s + __builtin_ctzll(bits) - (from - 1);
+      s = (s / 64 + 1) * 64;
+    }
+    return WHEEL_SLOTS - (from - 1); // Next wrap of level 0
+  }
+
+  /**
+   * @brief Move the timers of the higher levels that are now due within
+   * the lower levels down, after current crossed a slot boundary
+   */
+  void cascade()
+  {
+    for (int level = 1; level < WHEEL_LEVELS; level++)
+    {
+      if ((current >> (WHEEL_BITS * (level - 1))) & (WHEEL_SLOTS - 1))
+        break; // The lower level did not wrap
+      int slot = (current >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1);
+      Timer *timer = slots[level][slot];
+      slots[level][slot] = NULL;
+      occupied[level][slot / 64] &= ~((uint64_t)1 << (slot % 64));
+      while (timer != NULL)
+      {
+        Timer *next = timer->next;
+        link(*timer);
+        timer = next;
+      }
+    }
+  }
+
+  /**
+   * @brief Fire the timers of a level 0 slot that are due
+   * @param slot Slot of the current tick
+   * @return Number of timers that fired
+   */
+  size_t fire(int slot)
+  {
+    size_t fired = 0;
+    while (Timer *timer = slots[0][slot])
+    {
+      unlink(*timer);
+      count--;
+      fired++;
+      timer->expire(timer);
+    }
+    return fired;
+  }
+};
+
+#endif
@@ -0,0 +1,472 @@
+#ifndef URING_H
+#define URING_H
+
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/**
+ * Minimal io_uring ring for the echo servers, on the raw system calls
+ * (no liburing).
+ *
+ * The submission and completion queues are mapped into the process, so
+ * queueing a request is a few stores and reading a completion a few
+ * loads; io_uring_enter() is only called to submit a batch and wait for
+ * the next completions in the same call. With SQPOLL a kernel thread
+ * picks up submissions on its own and the process only enters the kernel
+ * to sleep, or to wake that thread after it went idle.
+ *
+ * Not thread-safe: a ring belongs to the event loop that submits to it.
+ */
+
+#define URING_CQ_FACTOR 4 // CQ entries per SQ entry, multishot ops post many
+#define URING_INTERNAL (~0ULL) // user_data of requests callers never see
+
+class Uring
+{
+public:
+  uint64_t enters; // io_uring_enter() calls made, for the statistics
+
+  /**
+   * @param entries Submission queue entries, a power of 2
+   * @param sqpoll Let a kernel thread poll the submission queue
+   */
+  Uring(unsigned entries, bool sqpoll) : enters(0), sqpoll(sqpoll)
+  {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = entries * URING_CQ_FACTOR;
+    if (sqpoll)
+    {
+      params.flags |= IORING_SETUP_SQPOLL;
+      params.sq_thread_idle = 1000; // ms of no work before it sleeps
+    }
+    fd = syscall(__NR_io_uring_setup, entries, &params);
+    assert((fd >= 0) && "io_uring_setup() failed");
+    assert((params.features & IORING_FEAT_SINGLE_MMAP) &&
+           (params.features & IORING_FEAT_EXT_ARG) &&
+           "io_uring of this kernel is too old");
+
+    // One mapping holds both rings, another the submission entries
+    ring_size = params.cq_off.cqes +
+                params.cq_entries * sizeof(io_uring_cqe);
+    size_t sq_size = params.sq_off.array +
+                     params.sq_entries * sizeof(unsigned);
+    if (sq_size > ring_size)
+      ring_size = sq_size;
+    ring = (char *)mmap(NULL, ring_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    assert((ring != MAP_FAILED) && "mmap() of the rings failed");
+    sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    sqes = (io_uring_sqe *)mmap(NULL, sqes_size, PROT_READ | PROT_WRITE,
+                                MAP_SHARED | MAP_POPULATE, fd,
+                                IORING_OFF_SQES);
+    assert((sqes != MAP_FAILED) && "mmap() of the SQEs failed");
+
+    sq_head = (unsigned *)(ring + params.sq_off.head);
+    sq_tail = (unsigned *)(ring + params.sq_off.tail);
+    sq_flags = (unsigned *)(ring + params.sq_off.flags);
+    sq_mask = *(unsigned *)(ring + params.sq_off.ring_mask);
+    sq_entries = params.sq_entries;
+    cq_head = (unsigned *)(ring + params.cq_off.head);
+    cq_tail = (unsigned *)(ring + params.cq_off.tail);
+    cq_mask = *(unsigned *)(ring + params.cq_off.ring_mask);
+    cqes = (io_uring_cqe *)(ring + params.cq_off.cqes);
+
+    // Slot i of the index array always points at SQE i
+    unsigned *array = (unsigned *)(ring + params.sq_off.array);
+    for (unsigned i = 0; i < sq_entries; i++)
+      array[i] = i;
+    tail = *sq_tail;
+    submitted = tail;
+  }
+
+  Uring(const Uring &) = delete;
+  Uring &operator=(const Uring &) = delete;
+
+  ~Uring()
+  {
+    munmap(sqes, sqes_size);
+    munmap(ring, ring_size);
+    close(fd);
+  }
+
+  /**
+   * @brief Take a cleared submission entry, submitting if the queue is full
+   * @return Entry to fill in, queued by the next submit() or wait()
+   */
+  io_uring_sqe *get_sqe()
+  {
+    while (tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries)
+      submit();
+    io_uring_sqe *sqe = &sqes[tail & sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    tail++;
+    return sqe;
+  }
+
+  /**
+   * @brief Hand the queued entries to the kernel without waiting
+   */
+  void submit()
+  {
+    enter(0, -1);
+  }
+
+  /**
+   * @brief Submit the queued entries and wait for a completion
+   * @param timeout_ms Longest wait, -1 for no limit
+   */
+  void wait(int timeout_ms)
+  {
+    enter(1, timeout_ms);
+  }
+
+  /**
+   * @brief Consume every completion posted so far
+   * @param f Callable taking a const io_uring_cqe &; may queue entries
+   * @return Number of completions consumed
+   */
+  template <typename F> unsigned for_each_cqe(F f)
+  {
+    unsigned head = *cq_head, seen = 0;
+    unsigned ready = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != ready; head++, seen++)
+      if (cqes[head & cq_mask].user_data != URING_INTERNAL)
+        f(cqes[head & cq_mask]);
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    return seen;
+  }
+
+  /**
+   * @brief Register a table of files, referenced by index with
+   * IOSQE_FIXED_FILE; -1 marks a free slot
+   * @param fds Descriptors of the table
+   * @param n Size of the table
+   * @param first_free First slot that direct accepts may allocate
+   */
+  void register_files(const int *fds, unsigned n, unsigned first_free)
+  {
+    int ret = syscall(__NR_io_uring_register, fd, IORING_REGISTER_FILES, fds,
+                      n);
+    assert((ret >= 0) && "IORING_REGISTER_FILES failed");
+    if (first_free >= n)
+      return;
+    struct io_uring_file_index_range range;
+    memset(&range, 0, sizeof(range));
+    range.off = first_free;
+    range.len = n - first_free;
+    ret = syscall(__NR_io_uring_register, fd,
+                  IORING_REGISTER_FILE_ALLOC_RANGE, &range, 0);
+    assert((ret >= 0) && "IORING_REGISTER_FILE_ALLOC_RANGE failed");
+  }
+
+  /**
+   * @brief Register or unregister a provided buffer ring
+   * @param ring_addr Page-aligned ring of entries, NULL to unregister
+   * @param entries Entries of the ring, a power of 2
+   * @param group Buffer group ID
+   * @return true on success
+   */
+  bool register_buffer_ring(void *ring_addr, unsigned entries, uint16_t group)
+  {
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)ring_addr;
+    reg.ring_entries = entries;
+    reg.bgid = group;
+    unsigned op = ring_addr != NULL ? IORING_REGISTER_PBUF_RING
+                                    : IORING_UNREGISTER_PBUF_RING;
+    return syscall(__NR_io_uring_register, fd, op, &reg, 1) >= 0;
+  }
+
+private:
+  int fd;                // Ring
+  bool sqpoll;           // A kernel thread polls the submission queue
+  char *ring;            // Mapping of both rings
+  size_t ring_size;      // Length of that mapping
+  io_uring_sqe *sqes;    // Submission entries
+  size_t sqes_size;      // Length of their mapping
+  unsigned *sq_head;     // Advanced by the kernel
+  unsigned *sq_tail;     // Advanced by us
+  unsigned *sq_flags;    // IORING_SQ_NEED_WAKEUP
+  unsigned sq_mask;      // Entries - 1
+  unsigned sq_entries;   // Entries of the submission queue
+  unsigned *cq_head;     // Advanced by us
+  unsigned *cq_tail;     // Advanced by the kernel
+  unsigned cq_mask;      // Entries - 1
+  io_uring_cqe *cqes;    // Completion entries
+  unsigned tail;         // Entries queued, published on submit
+  unsigned submitted;    // Entries handed to the kernel
+
+  /**
+   * @brief Publish the queued entries and enter the kernel if needed
+   * @param wait_nr Completions to wait for, 0 to only submit
+   * @param timeout_ms Longest wait, -1 for no limit
+   */
+  void enter(unsigned wait_nr, int timeout_ms)
+  {
+    __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+    unsigned to_submit = tail - submitted;
+    submitted = tail;
+
+    unsigned flags = 0;
+    if (sqpoll)
+    {
+      // The kernel thread takes the entries; only wake it if it sleeps
+      __atomic_thread_fence(__ATOMIC_SEQ_CST);
+      if (__atomic_load_n(sq_flags, __ATOMIC_RELAXED) & IORING_SQ_NEED_WAKEUP)
+        flags |= IORING_ENTER_SQ_WAKEUP;
+      to_submit = 0;
+    }
+    if (wait_nr > 0)
+    {
+      // Completions already posted need no system call
+      if (*cq_head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+        wait_nr = 0;
+      else
+        flags |= IORING_ENTER_GETEVENTS;
+    }
+    if (to_submit == 0 && !(flags & (IORING_ENTER_SQ_WAKEUP |
+                                     IORING_ENTER_GETEVENTS)))
+      return;
+
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    if ((flags & IORING_ENTER_GETEVENTS) && timeout_ms >= 0)
+    {
+      ts.tv_sec = timeout_ms / 1000;
+      ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+      arg.ts = (uint64_t)&ts;
+    }
+    flags |= IORING_ENTER_EXT_ARG;
+    enters++;
+    int ret = syscall(__NR_io_uring_enter, fd, to_submit, wait_nr, flags,
+                      &arg, sizeof(arg));
+    // Signals, timeouts and a full completion queue end the wait early
+    assert((ret >= 0 || errno == EINTR || errno == ETIME ||
+            errno == EBUSY || errno == EAGAIN) &&
+           "io_uring_enter() failed");
+  }
+};
+
+/**
+ * @brief Provided buffers the kernel picks from for recv with
+ * IOSQE_BUFFER_SELECT; the completion names the buffer it filled, and the
+ * owner hands it back with recycle() once done with the data.
+ *
+ * The buffers are a ring shared with the kernel, so recycling one is two
+ * stores. Kernels that refuse to register the ring, or on which a recv
+ * cannot take a buffer from it (checked once over a socketpair), get the
+ * buffers with IORING_OP_PROVIDE_BUFFERS instead, queued with the next
+ * submission. If a recv cannot take those either, the process exits with
+ * an error rather than have every multishot recv fail with ENOBUFS.
+ */
+class BufferRing
+{
+public:
+  /**
+   * @param ring Ring to register with
+   * @param group Buffer group ID
+   * @param count Number of buffers, a power of 2
+   * @param size Bytes per buffer
+   */
+  BufferRing(Uring &ring, uint16_t group, unsigned count, unsigned size)
+      : group(group), count(count), size(size), uring(ring), pending(0)
+  {
+    assert(((count & (count - 1)) == 0) && "count must be a power of 2");
+    entries_size = count * sizeof(io_uring_buf);
+    entries = (io_uring_buf_ring *)mmap(NULL, entries_size,
+                                        PROT_READ | PROT_WRITE,
+                                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    assert((entries != MAP_FAILED) && "mmap() of the buffer ring failed");
+    data = (char *)aligned_alloc(64, (size_t)count * size);
+    assert((data != NULL) && "aligned_alloc() failed");
+    tail = 0;
+
+    shared = ring.register_buffer_ring(entries, count, group);
+    if (shared)
+    {
+      for (unsigned id = 0; id < count; id++)
+        add(id);
+      publish();
+      if (!ring_works())
+      {
+        ring.register_buffer_ring(NULL, count, group);
+        shared = false;
+      }
+    }
+    if (!shared)
+    {
+      provide(0, count);
+      if (!ring_works())
+      {
+        fprintf(stderr, "ERROR, io_uring recv takes no provided buffers on "
+                        "this kernel, run without -u or -U\n");
+        exit(1);
+      }
+    }
+  }
+
+  BufferRing(const BufferRing &) = delete;
+  BufferRing &operator=(const BufferRing &) = delete;
+
+  ~BufferRing()
+  {
+    free(data);
+    munmap(entries, entries_size);
+  }
+
+  const uint16_t group; // Buffer group ID for buf_group
+  const unsigned count; // Number of buffers
+  const unsigned size;  // Bytes per buffer
+
+  char *buffer(unsigned id) const
+  {
+    return data + (size_t)id * size;
+  }
+
+  /**
+   * @brief Give a buffer back to the kernel
+   * @param id Buffer ID from the completion
+   */
+  void recycle(unsigned id)
+  {
+    if (!shared)
+    {
+      provide(id, 1);
+      return;
+    }
+    add(id);
+    publish();
+  }
+
+  /**
+   * @return true if the buffers are a ring shared with the kernel
+   */
+  bool is_shared() const
+  {
+    return shared;
+  }
+
+private:
+  Uring &uring;               // Ring the buffers are provided to
+  io_uring_buf_ring *entries; // Ring shared with the kernel
+  size_t entries_size;        // Length of its mapping
+  char *data;                 // The buffers, back to back
+  uint16_t tail;              // Entries published so far
+  unsigned pending;           // Entries added but not published
+  bool shared;                // Buffers go through entries
+
+  void add(unsigned id)
+  {
+    io_uring_buf *buf = &entries->bufs[(tail + pending) & (count - 1)];
+    buf->addr = (uint64_t)buffer(id);
+    buf->len = size;
+    buf->bid = id;
+    pending++;
+  }
+
+  void publish()
+  {
+    tail += pending;
+    pending = 0;
+    __atomic_store_n(&entries->tail, tail, __ATOMIC_RELEASE);
+  }
+
+  /**
+   * @brief Queue an IORING_OP_PROVIDE_BUFFERS of consecutive buffers
+   * @param id First buffer
+   * @param n Number of buffers
+   */
+  void provide(unsigned id, unsigned n)
+  {
+    io_uring_sqe *sqe = uring.get_sqe();
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = n;
+    sqe->addr = (uint64_t)buffer(id);
+    sqe->len = size;
+    sqe->off = id;
+    sqe->buf_group = group;
+    sqe->user_data = URING_INTERNAL;
+  }
+
+  /**
+   * @brief Receive one byte over a socketpair into a buffer of the group
+   * @return true if the kernel took one of the buffers
+   */
+  bool ring_works()
+  {
+    int pair[2];
+    int n = socketpair(AF_UNIX, SOCK_DGRAM, 0, pair);
+    assert((n == 0) && "socketpair() failed");
+    n = write(pair[1], "", 1);
+    assert((n == 1) && "write() failed");
+
+    io_uring_sqe *sqe = uring.get_sqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = pair[0];
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = group;
+    int res = 0, id = -1;
+    bool done = false;
+    while (!done)
+    {
+      uring.wait(-1);
+      uring.for_each_cqe([&](const io_uring_cqe &cqe) {
+        done = true;
+        res = cqe.res;
+        if (cqe.flags & IORING_CQE_F_BUFFER)
+          id = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+      });
+    }
+    close(pair[0]);
+    close(pair[1]);
+    if (id >= 0)
+      recycle(id);
+    return res == 1;
+  }
+};
+
+/**
+ * @brief Fill the fields every request shares
+ * @param sqe Entry from get_sqe()
+ * @param op IORING_OP_* code
+ * @param fd File, or index in the registered table with IOSQE_FIXED_FILE
+ * @param addr Buffer or structure of the request
+ * @param len Its length
+ * @param user_data Returned in the completion
+ */
+inline void uring_prep(io_uring_sqe *sqe, uint8_t op, int fd, const void *addr,
+                       unsigned len, uint64_t user_data)
+{
+  sqe->opcode = op;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)addr;
+  sqe->len = len;
+  sqe->user_data = user_data;
+}
+
+/**
+ * @brief Buffer ID a completion of a buffer-select request consumed
+ * @return The ID, or -1 if it carries no buffer
+ */
+inline int uring_buffer_id(const io_uring_cqe &cqe)
+{
+  if (!(cqe.flags & IORING_CQE_F_BUFFER))
+    return -1;
+  return cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+}
+
+#endif
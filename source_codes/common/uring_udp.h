@@ -0,0 +1,156 @@
+#ifndef URING_UDP_H
+#define URING_UDP_H
+
+#include <arpa/inet.h>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <netinet/in.h>
+#include <string>
+#include <sys/socket.h>
+#include <vector>
+
+#include "rate_limiter.h"
+#include "uring.h"
+
+/**
+ * io_uring engine of the UDP echo servers (my_ping and the my_iperf
+ * server).
+ *
+ * One multishot recvmsg on the registered socket keeps posting a
+ * completion per datagram, each in a buffer the kernel took from a
+ * provided buffer ring. The datagram is charged to its source as in the
+ * blocking loop and echoed with a sendmsg straight from that buffer, which
+ * is only recycled when the send completes. A whole batch of completions
+ * is handled between two io_uring_enter() calls, so under load there is
+ * far less than one system call per datagram, and none with SQPOLL.
+ */
+
+#define UDP_URING_ENTRIES 256     // Submission queue entries
+#define UDP_URING_BUFFERS 1024    // Provided buffers, a power of 2
+#define UDP_URING_BUFFER_LEN 2048 // Bytes per buffer, header included
+
+#define UDP_URING_RECV 0 // user_data of the multishot recvmsg
+#define UDP_URING_SEND 1 // user_data of a sendmsg, with the buffer ID
+
+/**
+ * @brief Message header of one echo, kept until its sendmsg completes.
+ */
+struct UdpEcho
+{
+  struct msghdr msg; // Destination and payload
+  struct iovec iov;  // Payload, inside the provided buffer
+};
+
+/**
+ * @brief Echo datagrams with io_uring until stop is set
+ * @param sockfd Bound UDP socket
+ * @param limiter Per-source admission control
+ * @param quiet Do not print every message
+ * @param sqpoll Let a kernel thread poll the submission queue
+ * @param stop Set by SIGINT and SIGTERM
+ * @param report Set by SIGUSR1 to print the per-source counters
+ */
+inline void uring_udp_echo(int sockfd, RateLimiter &limiter, bool quiet,
+                           bool sqpoll, volatile sig_atomic_t &stop,
+                           volatile sig_atomic_t &report)
+{
+  Uring ring(UDP_URING_ENTRIES, sqpoll);
+  BufferRing buffers(ring, 0, UDP_URING_BUFFERS, UDP_URING_BUFFER_LEN);
+  ring.register_files(&sockfd, 1, 1); // The socket is fixed file 0
+  std::vector<UdpEcho> echoes(UDP_URING_BUFFERS);
+  uint64_t echoed = 0;
+
+  // Template of the multishot recvmsg: only the lengths are used, the
+  // kernel lays out each buffer as io_uring_recvmsg_out, name, payload
+  struct msghdr recv_msg;
+  memset(&recv_msg, 0, sizeof(recv_msg));
+  recv_msg.msg_namelen = sizeof(struct sockaddr_in);
+  bool recv_armed = false;
+  unsigned buffers_out = 0; // Buffers held by sends in flight
+
+  while (!stop)
+  {
+    if (report)
+    {
+      report = 0;
+      report_sources(limiter);
+    }
+    // Re-arm after the kernel ended it, e.g. when it ran out of buffers
+    if (!recv_armed && buffers_out < buffers.count)
+    {
+      io_uring_sqe *sqe = ring.get_sqe();
+      uring_prep(sqe, IORING_OP_RECVMSG, 0, &recv_msg, 0, UDP_URING_RECV);
+      sqe->flags = IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+      sqe->ioprio = IORING_RECV_MULTISHOT;
+      sqe->buf_group = buffers.group;
+      recv_armed = true;
+    }
+    ring.wait(-1);
+
+    RateLimiter::clock::time_point now = RateLimiter::clock::now();
+    ring.for_each_cqe([&](const io_uring_cqe &cqe) {
+      int id = uring_buffer_id(cqe);
+      if ((cqe.user_data >> 32) == UDP_URING_SEND)
+      {
+        buffers.recycle(cqe.user_data & 0xFFFFFFFF);
+        buffers_out--;
+        return;
+      }
+
+      if (!(cqe.flags & IORING_CQE_F_MORE))
+        recv_armed = false;
+      if (cqe.res < 0 || id < 0)
+      {
+        if (cqe.res != -ENOBUFS && cqe.res != -ECANCELED)
+          fprintf(stderr, "recvmsg(): %s\n", strerror(-cqe.res));
+        return;
+      }
+
+      char *buffer = buffers.buffer(id);
+      io_uring_recvmsg_out *out = (io_uring_recvmsg_out *)buffer;
+      struct sockaddr_in *source = (struct sockaddr_in *)(out + 1);
+      char *payload = (char *)(out + 1) + recv_msg.msg_namelen +
+                      recv_msg.msg_controllen;
+      size_t len = cqe.res - (payload - buffer); // Cut if it was truncated
+      if (out->payloadlen < len)
+        len = out->payloadlen;
+
+      if (!limiter.admit(*source, now))
+      {
+        buffers.recycle(id);
+        return;
+      }
+      if (!quiet)
+      {
+        std::cout << "\nConnection from client "
+                  << inet_ntoa(source->sin_addr) << ":"
+                  << ntohs(source->sin_port) << std::endl;
+        std::string message(payload, strnlen(payload, len));
+        std::cout << "Client's Message: " << message << std::endl;
+      }
+
+      // Echo from the same buffer, to the address the kernel wrote in it
+      UdpEcho &echo = echoes[id];
+      echo.iov.iov_base = payload;
+      echo.iov.iov_len = len;
+      memset(&echo.msg, 0, sizeof(echo.msg));
+      echo.msg.msg_name = source;
+      echo.msg.msg_namelen = out->namelen;
+      echo.msg.msg_iov = &echo.iov;
+      echo.msg.msg_iovlen = 1;
+      io_uring_sqe *sqe = ring.get_sqe();
+      uring_prep(sqe, IORING_OP_SENDMSG, 0, &echo.msg, 1,
+                 ((uint64_t)UDP_URING_SEND << 32) | id);
+      sqe->flags = IOSQE_FIXED_FILE;
+      buffers_out++;
+      echoed++;
+    });
+  }
+
+  printf("\n%lu datagrams echoed with %lu io_uring_enter() calls\n",
+         (unsigned long)echoed, (unsigned long)ring.enters);
+}
+
+#endif
@@ -0,0 +1,318 @@
+#ifndef MULTICAST_H
+#define MULTICAST_H
+
+#include <arpa/inet.h>
+#include <bitset>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <endian.h>
+#include <netinet/in.h>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/**
+ * Multicast fan-out mode of my_iperf (--mcast-send, --mcast-recv).
+ *
+ * One sender streams numbered datagrams to an IPv4 group at a fixed rate;
+ * any number of receivers join the group and count what reaches them.
+ * Nothing is echoed, so every receiver measures its own leg: sequence
+ * gaps, throughput and one-way jitter. Jitter is the RFC 3550 estimate,
+ * built from differences of transit times, so the offset between the
+ * sender's and the receiver's clocks cancels out.
+ *
+ * On the wire every datagram starts with a 32 byte header in network
+ * byte order, padded to the -l size:
+ *
+ *   | magic (4) | session (4) | seq (8) | sent_ns (8) | total (8) |
+ *
+ * The session is random per sender run, so a receiver notices a restarted
+ * sender. When done, the sender sends a few end datagrams, marked by their
+ * own magic, whose total is the number of data datagrams sent, so that
+ * receivers also count losses at the tail of the stream. A run that sent
+ * no data ends with a total of 0.
+ */
+
+#define MCAST_HEADER_LEN 32    // Size of the encoded header
+#define MCAST_MAGIC 0x4d435354     // "MCST", data datagram
+#define MCAST_END_MAGIC 0x4d43454e // "MCEN", end datagram
+#define MCAST_END_COPIES 3     // End datagrams sent, in case some are lost
+#define MCAST_WINDOW 1024      // Sequence numbers remembered for reordering
+
+/**
+ * @brief Header of a multicast datagram.
+ */
+struct McastHeader
+{
+  uint32_t session; // Random per sender run
+  uint64_t seq;     // Sequence number, from 0
+  uint64_t sent_ns; // Sender clock at send time
+  uint64_t total;   // 0 on data, datagrams sent on an end datagram
+  bool end;         // End datagram, sent with MCAST_END_MAGIC
+};
+
+/**
+ * @brief Encode a header into a buffer
+ * @param buffer Destination, at least MCAST_HEADER_LEN bytes
+ * @param header Header to encode
+ */
+inline void encode_mcast_header(char *buffer, const McastHeader &header)
+{
+  uint32_t magic = htobe32(header.end ? MCAST_END_MAGIC : MCAST_MAGIC);
+  uint32_t session = htobe32(header.session);
+  uint64_t seq = htobe64(header.seq);
+  uint64_t sent_ns = htobe64(header.sent_ns);
+  uint64_t total = htobe64(header.total);
+
+  memcpy(buffer, &magic, 4);
+  memcpy(buffer + 4, &session, 4);
+  memcpy(buffer + 8, &seq, 8);
+  memcpy(buffer + 16, &sent_ns, 8);
+  memcpy(buffer + 24, &total, 8);
+}
+
+/**
+ * @brief Decode a header from a datagram
+ * @param buffer Datagram
+ * @param len Its length
+ * @param header Filled with the header in host byte order
+ * @return false if the datagram is not one of ours
+ */
+inline bool decode_mcast_header(const char *buffer, size_t len,
+                                McastHeader &header)
+{
+  uint32_t magic, session;
+  uint64_t seq, sent_ns, total;
+  if (len < MCAST_HEADER_LEN)
+    return false;
+  memcpy(&magic, buffer, 4);
+  magic = be32toh(magic);
+  if (magic != MCAST_MAGIC && magic != MCAST_END_MAGIC)
+    return false;
+  memcpy(&session, buffer + 4, 4);
+  memcpy(&seq, buffer + 8, 8);
+  memcpy(&sent_ns, buffer + 16, 8);
+  memcpy(&total, buffer + 24, 8);
+
+  header.session = be32toh(session);
+  header.seq = be64toh(seq);
+  header.sent_ns = be64toh(sent_ns);
+  header.total = be64toh(total);
+  header.end = magic == MCAST_END_MAGIC;
+  return true;
+}
+
+/**
+ * @brief Sequence and timing state of the stream seen by one receiver.
+ *
+ * A datagram above the next expected number opens a gap; the missing
+ * numbers count as lost until they turn up late. Only the last
+ * MCAST_WINDOW numbers are remembered, so an older datagram cannot be
+ * told from a duplicate and is counted as too late.
+ *
+ * Counting starts at the first datagram received, so that a receiver
+ * joining a running session does not count what was sent before it
+ * joined as lost; a datagram numbered below that one counts as too late.
+ */
+class McastStream
+{
+public:
+  uint64_t received;   // Distinct datagrams received
+  uint64_t lost;       // Missing so far
+  uint64_t gaps;       // Times the sequence jumped ahead
+  uint64_t reordered;  // Arrived after a higher number
+  uint64_t duplicates; // Seen before
+  uint64_t too_late;   // Older than the window
+  double jitter_ns;    // RFC 3550 interarrival jitter
+
+  McastStream()
+  {
+    reset(0);
+  }
+
+  /**
+   * @brief Forget everything, for a new sender session
+   * @param session Session of the new sender
+   */
+  void reset(uint32_t session)
+  {
+    this->session = session;
+    received = lost = gaps = reordered = duplicates = too_late = 0;
+    jitter_ns = 0;
+    first = next = 0;
+    synced = false;
+    have_transit = false;
+    seen.reset();
+  }
+
+  uint32_t current_session() const
+  {
+    return session;
+  }
+
+  /**
+   * @brief Account for one data datagram
+   * @param header Its header
+   * @param arrival_ns Receiver clock at arrival
+   */
+  void add(const McastHeader &header, uint64_t arrival_ns)
+  {
+    uint64_t seq = header.seq;
+    if (!synced)
+    {
+      first = next = seq;
+      synced = true;
+    }
+    if (seq < first)
+    {
+      too_late++;
+      return;
+    }
+    if (seq >= next)
+    {
+      if (seq > next)
+      {
+        gaps++;
+        lost += seq - next;
+        for (uint64_t s = next; s < seq && s < next + MCAST_WINDOW; s++)
+          seen[s % MCAST_WINDOW] = false;
+      }
+      next = seq + 1;
+    }
+    else if (next - seq > MCAST_WINDOW)
+    {
+      too_late++;
+      return;
+    }
+    else if (seen[seq % MCAST_WINDOW])
+    {
+      duplicates++;
+      return;
+    }
+    else
+    {
+      reordered++;
+      lost--;
+    }
+    seen[seq % MCAST_WINDOW] = true;
+    received++;
+
+    // J += (|D| - J) / 16, D the change in transit time
+    int64_t transit = (int64_t)(arrival_ns - header.sent_ns);
+    if (have_transit)
+    {
+      int64_t d = transit - last_transit;
+      jitter_ns += ((d < 0 ? -d : d) - jitter_ns) / 16;
+    }
+    last_transit = transit;
+    have_transit = true;
+  }
+
+  /**
+   * @brief Account for the datagrams that never came after the last one
+   * @param total Datagrams the sender sent
+   */
+  void end(uint64_t total)
+  {
+    if (synced && total > next)
+    {
+      gaps++;
+      lost += total - next;
+      next = total;
+    }
+  }
+
+private:
+  uint32_t session;               // Sender session followed
+  uint64_t first;                 // First sequence number counted
+  uint64_t next;                  // Next sequence number expected
+  bool synced;                    // first and next are set
+  int64_t last_transit;           // Transit time of the last datagram
+  bool have_transit;              // last_transit is set
+  std::bitset<MCAST_WINDOW> seen; // Recent sequence numbers received
+};
+
+/**
+ * @brief Parse a dotted IPv4 address
+ * @param text Address, empty for INADDR_ANY
+ * @return Address in network byte order
+ */
+inline struct in_addr parse_ipv4(const std::string &text)
+{
+  struct in_addr addr;
+  addr.s_addr = htonl(INADDR_ANY);
+  if (!text.empty())
+  {
+    int n = inet_pton(AF_INET, text.c_str(), &addr);
+    assert((n == 1) && "not an IPv4 address");
+  }
+  return addr;
+}
+
+/**
+ * @brief Create the socket of a multicast sender
+ * @param ttl Hops the datagrams may travel, 1 to stay on the link
+ * @param loop Deliver to receivers on this host too
+ * @param iface Address of the outgoing interface, empty for the default
+ * @return UDP socket
+ */
+inline int mcast_sender_socket(int ttl, bool loop, const std::string &iface)
+{
+  int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+  assert((sockfd >= 0) && "socket() failed");
+  unsigned char ttl_byte = ttl, loop_byte = loop;
+  int n = setsockopt(sockfd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl_byte,
+                     sizeof(ttl_byte));
+  assert((n == 0) && "setsockopt(IP_MULTICAST_TTL) failed");
+  n = setsockopt(sockfd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop_byte,
+                 sizeof(loop_byte));
+  assert((n == 0) && "setsockopt(IP_MULTICAST_LOOP) failed");
+  if (!iface.empty())
+  {
+    struct in_addr addr = parse_ipv4(iface);
+    n = setsockopt(sockfd, IPPROTO_IP, IP_MULTICAST_IF, &addr, sizeof(addr));
+    assert((n == 0) && "setsockopt(IP_MULTICAST_IF) failed");
+  }
+  return sockfd;
+}
+
+/**
+ * @brief Create a socket that has joined a multicast group
+ *
+ * Bound to the group address with SO_REUSEADDR, so that several receivers
+ * on one host each get a copy of every datagram and no unicast traffic
+ * to the port.
+ *
+ * @param group Group address
+ * @param port UDP port
+ * @param iface Address of the interface to join on, empty for the default
+ * @return UDP socket
+ */
+inline int mcast_receiver_socket(const std::string &group, int port,
+                                 const std::string &iface)
+{
+  int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+  assert((sockfd >= 0) && "socket() failed");
+  int on = 1;
+  setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr = parse_ipv4(group);
+  assert(IN_MULTICAST(ntohl(addr.sin_addr.s_addr)) &&
+         "not a multicast group");
+  int n = bind(sockfd, (struct sockaddr *)&addr, sizeof(addr));
+  assert((n == 0) && "bind() failed");
+
+  struct ip_mreq mreq;
+  mreq.imr_multiaddr = addr.sin_addr;
+  mreq.imr_interface = parse_ipv4(iface);
+  n = setsockopt(sockfd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq));
+  assert((n == 0) && "setsockopt(IP_ADD_MEMBERSHIP) failed");
+  return sockfd;
+}
+
+#endif
@@ -1,25 +1,50 @@
 #include <arpa/inet.h>
 #include <cassert>
+#include <cerrno>
 #include <chrono>
+#include <csignal>
 #include <cstring>
 #include <fstream>
+#include <getopt.h>
 #include <iomanip>
 #include <iostream>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <numeric>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string>
+#include <sys/prctl.h>
+#include <time.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <unistd.h>
 #include <vector>
 
-#define MAX_LINE 1024
+#include "../common/rate_limiter.h"
+#include "../common/uring_udp.h"
+#include "multicast.h"
+#include "shm_ring.h"
+#include "trace.h"
+
+#define MAX_LINE 2048 // Largest datagram the server echoes whole
+#define REPLAY_SPIN_NS 50000 // Spun rather than slept before a trace send
 using namespace std;
 using namespace std::chrono;
 
+static volatile sig_atomic_t stop = 0;   // Set by SIGINT and SIGTERM
+static volatile sig_atomic_t report = 0; // Set by SIGUSR1
+
+// How client and server exchange messages
+enum Transport
+{
+  UDP_TRANSPORT,  // UDP datagrams, the default
+  UNIX_TRANSPORT, // AF_UNIX datagrams (--unix)
+  SHM_TRANSPORT   // Shared-memory rings (--shm)
+};
+
 /**
  * @brief Class to monitor flow.
  *
@@ -40,6 +65,18 @@ public:
   }
 };
 
+/**
+ * @brief Signal handler that asks the server loop to report or stop
+ * @param sig Signal number
+ */
+void handle_signal(int sig)
+{
+  if (sig == SIGUSR1)
+    report = 1;
+  else
+    stop = 1;
+}
+
 /**
  * @brief Usage function
  *
@@ -63,6 +100,36 @@ void usage()
   cout << "Server specific:" << endl;
   cout << "\t"
        << "-s,            run in server mode" << endl;
+  cout << "\t"
+       << "-r,  #         packets per second echoed per client, 0 for no "
+          "limit (default: 0)"
+       << endl;
+  cout << "\t"
+       << "-b,  #         packets a quiet client may send at once (default: "
+          "32)"
+       << endl;
+  cout << "\t"
+       << "-n,  #         clients tracked at once (default: 4096)" << endl;
+  cout << "\t"
+       << "-q,            do not print every message" << endl;
+  cout << "\t"
+       << "-u,            echo with io_uring instead of recvfrom/sendto"
+       << endl;
+  cout << "\t"
+       << "-U,            echo with io_uring and a kernel polling thread "
+          "(SQPOLL)"
+       << endl;
+  cout << "\t"
+       << "--unix <path>  use AF_UNIX datagrams on <path> instead of UDP"
+       << endl;
+  cout << "\t"
+       << "--shm <name>   use shared-memory rings named <name> (e.g. "
+          "/my_iperf)"
+       << endl;
+  cout << "\t"
+       << "--busy-poll    with --shm, spin on an empty ring instead of "
+          "sleeping"
+       << endl;
   cout << "Client specific:" << endl;
   cout << "\t";
   cout << "-c, <host>     run in client mode, connecting to <host>" << endl;
@@ -71,9 +138,110 @@ void usage()
        << endl;
   cout << "\t"
        << "-l,  #         length of each message" << endl;
+  cout << "\t"
+       << "--trace <file> replay the (timestamp, size) records of <file>, "
+          "CSV if"
+       << endl
+       << "\t               it ends in .csv, else binary; UDP and --unix only"
+       << endl;
+  cout << "\t"
+       << "--time-scale # multiply the gaps of the trace by # (default 1)"
+       << endl;
+  cout << "Multicast:" << endl;
+  cout << "\t"
+       << "--mcast-send <group>  send -l byte datagrams to <group> every -i "
+          "us for -t s"
+       << endl;
+  cout << "\t"
+       << "--mcast-recv <group>  join <group> and report gaps, throughput "
+          "and jitter"
+       << endl;
+  cout << "\t"
+       << "--ttl #               hops multicast datagrams may travel "
+          "(default 1)"
+       << endl;
+  cout << "\t"
+       << "--no-loop             do not deliver to receivers on this host"
+       << endl;
+  cout << "\t"
+       << "--iface <address>     interface to send or join on, by IPv4 "
+          "address"
+       << endl;
   exit(0);
 }
 
+/**
+ * @brief Echo messages over AF_UNIX datagrams until SIGINT or SIGTERM
+ * @param path Path to bind the server socket to
+ * @param quiet Do not print every message
+ */
+void serve_unix(const string &path, bool quiet)
+{
+  int sockfd = socket(AF_UNIX, SOCK_DGRAM, 0);
+  assert((sockfd >= 0) && "socket() failed");
+  struct sockaddr_un server_addr, client_addr;
+  memset(&server_addr, 0, sizeof(server_addr));
+  server_addr.sun_family = AF_UNIX;
+  strncpy(server_addr.sun_path, path.c_str(), sizeof(server_addr.sun_path) - 1);
+  unlink(path.c_str());
+  int n = bind(sockfd, (struct sockaddr *)&server_addr, sizeof(server_addr));
+  assert((n >= 0) && "bind() failed");
+
+  cout << "\nServer Listening on " << path << endl;
+  char buffer[MAX_LINE];
+  uint64_t echoed = 0;
+  while (!stop)
+  {
+    socklen_t addrlen = sizeof(client_addr);
+    n = recvfrom(sockfd, buffer, sizeof(buffer), 0,
+                 (struct sockaddr *)&client_addr, &addrlen);
+    if (n < 0)
+    {
+      assert((errno == EINTR) && "recvfrom() failed");
+      continue;
+    }
+    if (!quiet)
+      cout << "Client's Message: " << string(buffer, strnlen(buffer, n))
+           << endl;
+    if (sendto(sockfd, buffer, n, 0, (struct sockaddr *)&client_addr,
+               addrlen) >= 0)
+      echoed++;
+  }
+  close(sockfd);
+  unlink(path.c_str());
+  cout << endl << echoed << " messages echoed" << endl;
+}
+
+/**
+ * @brief Echo messages over shared-memory rings until SIGINT or SIGTERM
+ * @param name Name of the shared memory object
+ * @param busy_poll Spin on an empty ring instead of sleeping
+ * @param quiet Do not print every message
+ */
+void serve_shm(const string &name, bool busy_poll, bool quiet)
+{
+  ShmRegion *region = shm_map(name, true);
+  cout << "\nServer Listening on shared memory " << name << endl;
+  char buffer[SHM_SLOT_LEN];
+  uint64_t echoed = 0;
+  while (!stop)
+  {
+    // Wake up now and then to notice SIGINT and SIGTERM
+    int n = shm_pop(region->requests, buffer, sizeof(buffer), busy_poll,
+                    100000);
+    if (n < 0)
+      continue;
+    if (!quiet)
+      cout << "Client's Message: " << string(buffer, strnlen(buffer, n))
+           << endl;
+    shm_push(region->replies, buffer, n);
+    echoed++;
+  }
+  munmap(region, sizeof(ShmRegion));
+  shm_unlink(name.c_str());
+  cout << endl << echoed << " messages echoed" << endl;
+}
+
 /**
  * @brief Function to write throughputs and avg delays values to a file.
  * @param flow Monitor object.
@@ -143,6 +311,420 @@ void divider()
        << endl;
 }
 
+/**
+ * @brief Outcome of the packets a trace replay sent during one second.
+ */
+struct ReplaySecond
+{
+  uint64_t sent;      // Packets sent
+  uint64_t received;  // Of those, packets echoed back
+  uint64_t bytes;     // Bytes echoed back
+  uint64_t delay_sum; // Sum of their RTTs in microseconds
+  uint64_t max_delay; // Largest of their RTTs in microseconds
+};
+
+/**
+ * @brief Header at the start of every packet of a trace replay.
+ */
+struct ReplayHeader
+{
+  uint64_t sent_ns; // Send time after the start of the replay
+  uint64_t seq;     // Index of the record
+};
+
+/**
+ * @brief Read every echo that is waiting on the socket
+ * @param sockfd Client socket
+ * @param start Start of the replay
+ * @param seconds Per-second outcomes, indexed by send time
+ * @param rtts RTTs of all echoes
+ * @return Number of echoes read
+ */
+uint64_t read_echoes(int sockfd, steady_clock::time_point start,
+                     vector<ReplaySecond> &seconds, LatencyHistogram &rtts)
+{
+  char buffer[MAX_LINE];
+  uint64_t echoes = 0;
+  while (1)
+  {
+    ssize_t n = recv(sockfd, buffer, sizeof(buffer), MSG_DONTWAIT);
+    if (n < (ssize_t)sizeof(ReplayHeader))
+    {
+      if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        perror("recv()");
+      if (n < 0)
+        return echoes;
+      continue;
+    }
+    ReplayHeader header;
+    memcpy(&header, buffer, sizeof(header));
+    uint64_t now_ns = duration_cast<nanoseconds>(steady_clock::now() - start)
+                          .count();
+    uint64_t rtt = (now_ns - header.sent_ns) / 1000;
+    size_t second = header.sent_ns / 1000000000;
+    if (second >= seconds.size())
+      continue; // Not one of ours
+    ReplaySecond &outcome = seconds[second];
+    outcome.received++;
+    outcome.bytes += n;
+    outcome.delay_sum += rtt;
+    outcome.max_delay = max(outcome.max_delay, rtt);
+    rtts.add(rtt);
+    echoes++;
+  }
+}
+
+/**
+ * @brief Wait for echoes until a point in time, reading those that come
+ * @param sockfd Client socket
+ * @param until Time to return at
+ * @param spin_ns Last nanoseconds to spin instead of sleeping in ppoll()
+ * @param start Start of the replay
+ * @param seconds Per-second outcomes, indexed by send time
+ * @param rtts RTTs of all echoes
+ * @return Echoes read
+ */
+uint64_t wait_for_echoes(int sockfd, steady_clock::time_point until,
+                         long spin_ns, steady_clock::time_point start,
+                         vector<ReplaySecond> &seconds, LatencyHistogram &rtts)
+{
+  uint64_t echoes = 0;
+  while (1)
+  {
+    long left = duration_cast<nanoseconds>(until - steady_clock::now())
+                    .count();
+    if (left <= 0)
+      return echoes;
+    if (left > spin_ns)
+    {
+      struct pollfd pfd = {sockfd, POLLIN, 0};
+      struct timespec ts;
+      ts.tv_sec = (left - spin_ns) / 1000000000;
+      ts.tv_nsec = (left - spin_ns) % 1000000000;
+      ppoll(&pfd, 1, &ts, NULL);
+    }
+    echoes += read_echoes(sockfd, start, seconds, rtts);
+  }
+}
+
+/**
+ * @brief Replay a trace against the echo server and report how latency and
+ * loss behave under its pattern
+ *
+ * Every record is sent at its own time, scaled, whether or not earlier
+ * packets were echoed yet: bursts in the trace are bursts on the wire.
+ * Between two sends the client sleeps in ppoll() reading echoes as they
+ * come, and spins for the last REPLAY_SPIN_NS so that the send is on time.
+ * The records are read as they are needed, so memory does not grow with
+ * the trace; only the per-second outcomes do.
+ *
+ * @param sockfd Client socket, connected for --unix
+ * @param dest Server address for UDP, NULL for a connected socket
+ * @param destlen Length of dest
+ * @param path Trace file
+ * @param time_scale Factor applied to the gaps of the trace
+ * @param timeout Microseconds to wait for the last echoes
+ * @param flow Filled with the per-second throughputs and delays
+ */
+void replay_trace(int sockfd, struct sockaddr *dest, socklen_t destlen,
+                  const string &path, double time_scale, int timeout,
+                  FlowMonitor &flow)
+{
+  TraceReader trace(path);
+  assert(trace.is_open() && "cannot open the trace");
+  cout << "Replaying " << path;
+  if (time_scale != 1)
+    cout << " with its gaps scaled by " << time_scale;
+  cout << endl;
+
+  vector<ReplaySecond> seconds; // By send time
+  LatencyHistogram rtts;        // RTTs in microseconds
+  LatencyHistogram lateness;    // Send time past the schedule, in us
+  uint64_t sent = 0, received = 0, send_errors = 0, clamped = 0;
+  char buffer[MAX_LINE];
+  memset(buffer, 0, sizeof(buffer));
+
+  // The default 50 us of timer slack would eat the whole spin margin
+  prctl(PR_SET_TIMERSLACK, 1);
+
+  auto start = steady_clock::now();
+  TraceRecord record;
+  while (!stop && trace.next(record))
+  {
+    auto due = start + nanoseconds((uint64_t)(record.time_us * 1000 *
+                                              time_scale));
+    received += wait_for_echoes(sockfd, due, REPLAY_SPIN_NS, start, seconds,
+                                rtts);
+
+    // Sizes the server cannot echo whole, or that cannot hold the header
+    size_t len = record.size;
+    if (len < sizeof(ReplayHeader) || len > sizeof(buffer))
+    {
+      len = len < sizeof(ReplayHeader) ? sizeof(ReplayHeader) : sizeof(buffer);
+      clamped++;
+    }
+
+    auto now = steady_clock::now();
+    ReplayHeader header;
+    header.sent_ns = duration_cast<nanoseconds>(now - start).count();
+    header.seq = sent;
+    memcpy(buffer, &header, sizeof(header));
+    size_t second = header.sent_ns / 1000000000;
+    if (second >= seconds.size())
+      seconds.resize(second + 1, ReplaySecond());
+
+    // Never block: a full socket buffer is a drop, as on a real link
+    ssize_t n = dest ? sendto(sockfd, buffer, len, MSG_DONTWAIT, dest, destlen)
+                     : send(sockfd, buffer, len, MSG_DONTWAIT);
+    if (n < 0)
+      send_errors++;
+    seconds[second].sent++;
+    sent++;
+    lateness.add(duration_cast<microseconds>(now - due).count());
+  }
+
+  // Echoes still in flight get the timeout to come back
+  auto last_send = steady_clock::now();
+  while (!stop && received < sent &&
+         steady_clock::now() < last_send + microseconds(timeout))
+    received += wait_for_echoes(sockfd,
+                                min(last_send + microseconds(timeout),
+                                    steady_clock::now() + milliseconds(10)),
+                                0, start, seconds, rtts);
+
+  // One line per second of sending
+  cout << setw(12) << "Interval" << setw(10) << "Sent" << setw(10) << "Lost"
+       << setw(15) << "Bandwidth" << setw(15) << "Avg Delay" << setw(15)
+       << "Max Delay" << endl;
+  for (size_t i = 0; i < seconds.size(); i++)
+  {
+    const ReplaySecond &outcome = seconds[i];
+    double avg_delay =
+        outcome.received ? outcome.delay_sum / (double)outcome.received : 0;
+    cout << setw(3) << i << "-" << i + 1 << setw(6) << "sec" << setw(10)
+         << outcome.sent << setw(10) << outcome.sent - outcome.received
+         << setw(10) << outcome.bytes * 8 << " bits/s" << setw(10) << fixed
+         << setprecision(0) << avg_delay << " µs" << setw(12)
+         << outcome.max_delay << " µs" << endl;
+    flow.throughputs.push_back(outcome.bytes);
+    flow.avg_delays.push_back(avg_delay);
+  }
+  divider();
+
+  uint64_t lost = sent - received;
+  cout << "Packets: Sent = " << sent << ", Received = " << received
+       << ", Lost = " << lost << " (" << setprecision(2)
+       << (sent ? lost * 100.0 / sent : 0) << "% loss)";
+  if (send_errors)
+    cout << ", " << send_errors << " of them refused by the socket";
+  cout << endl;
+  cout << "RTT: p50 = " << rtts.percentile(0.5)
+       << " µs, p90 = " << rtts.percentile(0.9)
+       << " µs, p99 = " << rtts.percentile(0.99)
+       << " µs, p99.9 = " << rtts.percentile(0.999)
+       << " µs, max = " << rtts.max() << " µs" << endl;
+  cout << "Pacing error: p50 = " << lateness.percentile(0.5)
+       << " µs, p99 = " << lateness.percentile(0.99)
+       << " µs, max = " << lateness.max() << " µs" << endl;
+  if (clamped || trace.malformed())
+    cout << clamped << " sizes clamped to [" << sizeof(ReplayHeader) << ", "
+         << sizeof(buffer) << "] bytes, " << trace.malformed()
+         << " malformed lines skipped" << endl;
+}
+
+/**
+ * @brief Stream datagrams to a multicast group at a fixed rate
+ * @param group Group address
+ * @param port UDP port of the receivers
+ * @param size Bytes per datagram, header included
+ * @param interval Microseconds between two datagrams, 0 for no pause
+ * @param time Seconds to send for
+ * @param ttl Hops the datagrams may travel
+ * @param loop Deliver to receivers on this host too
+ * @param iface Address of the outgoing interface, empty for the default
+ */
+void mcast_send(const string &group, int port, int size, int interval,
+                int time, int ttl, bool loop, const string &iface)
+{
+  int sockfd = mcast_sender_socket(ttl, loop, iface);
+  struct sockaddr_in dest;
+  memset(&dest, 0, sizeof(dest));
+  dest.sin_family = AF_INET;
+  dest.sin_port = htons(port);
+  dest.sin_addr = parse_ipv4(group);
+
+  vector<char> datagram(size, 0);
+  McastHeader header;
+  header.session = getpid() ^ (uint32_t)system_clock::now()
+                                  .time_since_epoch()
+                                  .count();
+  header.seq = 0;
+  header.sent_ns = 0;
+  header.total = 0;
+  header.end = false;
+
+  cout << "Sending " << size << " byte datagrams to " << group << ":" << port
+       << " every " << interval << " µs for " << time << " s" << endl;
+  cout << setw(12) << "Interval" << setw(10) << "Sent" << setw(15)
+       << "Bandwidth" << endl;
+
+  auto start = steady_clock::now(), end = start + seconds(time);
+  auto next_report = start + seconds(1);
+  uint64_t send_errors = 0, sent_in_second = 0;
+  int second = 0;
+  while (!stop)
+  {
+    // Absolute deadlines, so that time spent sending does not add up
+    auto due = start + microseconds((uint64_t)interval * header.seq);
+    if (due >= end)
+      break;
+    if (interval > 0)
+    {
+      struct timespec ts;
+      uint64_t due_ns = duration_cast<nanoseconds>(due.time_since_epoch())
+                            .count();
+      ts.tv_sec = due_ns / 1000000000;
+      ts.tv_nsec = due_ns % 1000000000;
+      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    }
+
+    auto now = steady_clock::now();
+    while (now >= next_report)
+    {
+      cout << setw(3) << second << "-" << second + 1 << setw(6) << "sec"
+           << setw(10) << sent_in_second << setw(10)
+           << sent_in_second * size * 8 << " bits/s" << endl;
+      second++;
+      sent_in_second = 0;
+      next_report += seconds(1);
+    }
+    if (now >= end)
+      break;
+
+    header.sent_ns =
+        duration_cast<nanoseconds>(system_clock::now().time_since_epoch())
+            .count();
+    encode_mcast_header(datagram.data(), header);
+    if (sendto(sockfd, datagram.data(), size, 0, (struct sockaddr *)&dest,
+               sizeof(dest)) < 0)
+      send_errors++;
+    header.seq++;
+    sent_in_second++;
+  }
+  double elapsed = duration<double>(steady_clock::now() - start).count();
+
+  // Tell the receivers how many there were
+  header.total = header.seq;
+  header.end = true;
+  for (int i = 0; i < MCAST_END_COPIES; i++)
+  {
+    encode_mcast_header(datagram.data(), header);
+    sendto(sockfd, datagram.data(), size, 0, (struct sockaddr *)&dest,
+           sizeof(dest));
+    usleep(1000);
+  }
+  close(sockfd);
+
+  divider();
+  cout << "Datagrams: Sent = " << header.seq << " (" << fixed
+       << setprecision(0) << header.seq / elapsed << " per second)";
+  if (send_errors)
+    cout << ", " << send_errors << " refused by the socket";
+  cout << endl;
+}
+
+/**
+ * @brief Join a multicast group and report what reaches this receiver
+ *
+ * Prints one line per second from the first datagram on, and a summary
+ * once the sender's end datagram arrives or on SIGINT.
+ *
+ * @param group Group address
+ * @param port UDP port
+ * @param iface Address of the interface to join on, empty for the default
+ */
+void mcast_receive(const string &group, int port, const string &iface)
+{
+  int sockfd = mcast_receiver_socket(group, port, iface);
+  struct timeval tv; // Wake up to print seconds without traffic
+  tv.tv_sec = 0;
+  tv.tv_usec = 200000;
+  setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+  cout << "Joined " << group << ":" << port << endl;
+  char buffer[MAX_LINE];
+  McastStream stream;
+  bool started = false, ended = false;
+  steady_clock::time_point next_report;
+  uint64_t bytes_in_second = 0, last_received = 0, last_lost = 0;
+  int second = 0;
+
+  while (!stop && !ended)
+  {
+    ssize_t n = recv(sockfd, buffer, sizeof(buffer), 0);
+    auto now = steady_clock::now();
+    uint64_t arrival_ns =
+        duration_cast<nanoseconds>(system_clock::now().time_since_epoch())
+            .count();
+
+    McastHeader header;
+    if (n > 0 && decode_mcast_header(buffer, n, header))
+    {
+      if (!started || header.session != stream.current_session())
+      {
+        if (started)
+          cout << "New sender session, starting over" << endl;
+        stream.reset(header.session);
+        started = true;
+        next_report = now + seconds(1);
+        second = 0;
+        bytes_in_second = last_received = last_lost = 0;
+        cout << setw(12) << "Interval" << setw(10) << "Received" << setw(10)
+             << "Lost" << setw(15) << "Bandwidth" << setw(15) << "Jitter"
+             << endl;
+      }
+      if (header.end)
+      {
+        stream.end(header.total);
+        ended = true;
+      }
+      else
+      {
+        stream.add(header, arrival_ns);
+        bytes_in_second += n;
+      }
+    }
+
+    while (started && (now >= next_report || ended))
+    {
+      cout << setw(3) << second << "-" << second + 1 << setw(6) << "sec"
+           << setw(10) << stream.received - last_received << setw(10)
+           << (int64_t)(stream.lost - last_lost) << setw(10)
+           << bytes_in_second * 8 << " bits/s" << setw(10) << fixed
+           << setprecision(1) << stream.jitter_ns / 1000 << " µs" << endl;
+      last_received = stream.received;
+      last_lost = stream.lost;
+      bytes_in_second = 0;
+      second++;
+      next_report += seconds(1);
+      if (ended)
+        break;
+    }
+  }
+  close(sockfd);
+
+  divider();
+  uint64_t expected = stream.received + stream.lost;
+  cout << "Datagrams: Received = " << stream.received
+       << ", Lost = " << stream.lost << " (" << fixed << setprecision(2)
+       << (expected ? stream.lost * 100.0 / expected : 0) << "% loss)"
+       << (ended ? "" : ", sender end not seen") << endl;
+  cout << "Gaps = " << stream.gaps << ", Reordered = " << stream.reordered
+       << ", Duplicates = " << stream.duplicates
+       << ", Too late = " << stream.too_late << ", Jitter = " << setprecision(1)
+       << stream.jitter_ns / 1000 << " µs" << endl;
+}
+
 int main(int argc, char **argv)
 {
   int ch;
@@ -153,13 +735,74 @@ int main(int argc, char **argv)
   int time = 10;          // Time in seconds to transmit for
   int size = 32;          // Size of each packet
   int timeout = 5000000;  // in microseconds
+  double rate = 0;        // Packets per second per client, 0 for no limit
+  double burst = 32;      // Bucket size of every client
+  int sources = 4096;     // Clients tracked by the rate limiter
+  bool quiet = false;     // Do not print every message
+  bool uring = false;     // Server echoes with io_uring
+  bool sqpoll = false;    // Let a kernel thread poll the io_uring
+  Transport transport = UDP_TRANSPORT;
+  string endpoint;        // AF_UNIX path or shared memory name
+  bool busy_poll = false; // Spin on an empty shared-memory ring
+  string trace;           // Trace to replay instead of constant traffic
+  double time_scale = 1;  // Factor applied to the gaps of the trace
+  string mcast_group;     // Multicast group to send to or join
+  bool mcast_sender = false;
+  int ttl = 1;            // Hops of multicast datagrams
+  bool loop = true;       // Multicast to receivers on this host too
+  string iface;           // Multicast interface address
   struct hostent *server;
 
+  struct option long_options[] = {{"unix", required_argument, 0, 'X'},
+                                  {"shm", required_argument, 0, 'S'},
+                                  {"busy-poll", no_argument, 0, 'B'},
+                                  {"trace", required_argument, 0, 'T'},
+                                  {"time-scale", required_argument, 0, 'Z'},
+                                  {"mcast-send", required_argument, 0, 'M'},
+                                  {"mcast-recv", required_argument, 0, 'G'},
+                                  {"ttl", required_argument, 0, 'L'},
+                                  {"no-loop", no_argument, 0, 'O'},
+                                  {"iface", required_argument, 0, 'I'},
+                                  {0, 0, 0, 0}};
+
   // Parse command line arguments
-  while ((ch = getopt(argc, argv, "t:l:i:p:sc:")) != -1)
+  while ((ch = getopt_long(argc, argv, "t:l:i:p:sc:r:b:n:quU", long_options,
+                           NULL)) != -1)
   {
     switch (ch)
     {
+    case 'X':
+      transport = UNIX_TRANSPORT;
+      endpoint = optarg;
+      break;
+    case 'S':
+      transport = SHM_TRANSPORT;
+      endpoint = optarg;
+      break;
+    case 'B':
+      busy_poll = true;
+      break;
+    case 'T':
+      trace = optarg;
+      break;
+    case 'Z':
+      time_scale = atof(optarg);
+      break;
+    case 'M':
+      mcast_sender = true;
+      // Fall through
+    case 'G':
+      mcast_group = optarg;
+      break;
+    case 'L':
+      ttl = atoi(optarg);
+      break;
+    case 'O':
+      loop = false;
+      break;
+    case 'I':
+      iface = optarg;
+      break;
     case 't':
       time = atoi(optarg);
       break;
@@ -180,19 +823,65 @@ int main(int argc, char **argv)
       host = optarg;
       server = gethostbyname(host.c_str());
       break;
+    case 'r':
+      rate = atof(optarg);
+      break;
+    case 'b':
+      burst = atof(optarg);
+      break;
+    case 'n':
+      sources = atoi(optarg);
+      break;
+    case 'q':
+      quiet = true;
+      break;
+    case 'U':
+      sqpoll = true;
+      // Fall through
+    case 'u':
+      uring = true;
+      break;
     }
   }
-  if (argc == 1)
+  if (argc == 1 || rate < 0 || sources < 1 || size < 1 ||
+      size > (int)sizeof(ShmSlot::data) || time_scale <= 0 ||
+      (!trace.empty() && transport == SHM_TRANSPORT) || ttl < 0 ||
+      ttl > 255 || (mcast_sender && size < MCAST_HEADER_LEN))
     usage();
 
+  // Without SA_RESTART, so that blocking receives return EINTR
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = handle_signal;
+
+  // Multicast sender or receiver
+  if (!mcast_group.empty())
+  {
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    if (mcast_sender)
+      mcast_send(mcast_group, port, size, interval, time, ttl, loop, iface);
+    else
+      mcast_receive(mcast_group, port, iface);
+  }
+  // Server over AF_UNIX or shared memory
+  else if (is_server && transport != UDP_TRANSPORT)
+  {
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    if (transport == UNIX_TRANSPORT)
+      serve_unix(endpoint, quiet);
+    else
+      serve_shm(endpoint, busy_poll, quiet);
+  }
   // Server Mode
-  if (is_server)
+  else if (is_server)
   {
     int sockfd;
     struct sockaddr_in server_addr, client_addr;
     socklen_t addrlen; // Length of addresses
     int n;
-    char buffer[1024]; // Buffer for data
+    char buffer[MAX_LINE]; // Buffer for data
 
     // Create socket
     sockfd = socket(AF_INET, SOCK_DGRAM, 0);
@@ -208,28 +897,55 @@ int main(int argc, char **argv)
         bind(sockfd, (struct sockaddr *)&server_addr, sizeof(server_addr));
     assert(bind_result >= 0 && "bind() failed");
 
+    // Per-client token buckets: over-rate packets are dropped unechoed
+    RateLimiter limiter(sources, rate, burst);
+
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGUSR1, &sa, NULL);
+
     cout << "\nServer Listening on " << port << endl;
 
-    while (1)
+    if (uring)
+      uring_udp_echo(sockfd, limiter, quiet, sqpoll, stop, report);
+
+    while (!stop)
     {
+      if (report)
+      {
+        report = 0;
+        report_sources(limiter);
+      }
       addrlen = sizeof(client_addr); // Length of addresses
 
       // Receive message from client
       n = recvfrom(sockfd, buffer, MAX_LINE, 0, (struct sockaddr *)&client_addr,
                    &addrlen);
-      assert((n >= 0) && "recvfrom() failed");
+      if (n < 0)
+      {
+        assert((errno == EINTR) && "recvfrom() failed");
+        continue;
+      }
 
-      cout << "Connection from client " << inet_ntoa(client_addr.sin_addr)
-           << ":" << ntohs(client_addr.sin_port) << endl;
+      if (!limiter.admit(client_addr, RateLimiter::clock::now()))
+        continue;
 
-      string message(buffer);
-      cout << "Client's Message: " << message << endl;
+      if (!quiet)
+      {
+        cout << "Connection from client " << inet_ntoa(client_addr.sin_addr)
+             << ":" << ntohs(client_addr.sin_port) << endl;
+
+        string message(buffer, strnlen(buffer, n));
+        cout << "Client's Message: " << message << endl;
+      }
 
       // Send message back to client
       n = sendto(sockfd, buffer, n, 0, (struct sockaddr *)&client_addr,
                  addrlen);
       assert((n >= 0) && "sendto() failed");
     }
+
+    report_sources(limiter);
   }
   // Client Mode
   else
@@ -240,6 +956,7 @@ int main(int argc, char **argv)
     char send_message[size], recv_message[size]; // Buffer for data
     int n;
     FlowMonitor flow; // Flow monitor object
+    ShmRegion *region = NULL; // Rings of the shared-memory transport
 
     // Timeout
     struct timeval tv;
@@ -248,17 +965,53 @@ int main(int argc, char **argv)
 
     setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, (const char *)&tv, sizeof(tv));
 
-    // Create UDP socket
-    sockfd = socket(AF_INET, SOCK_DGRAM, 0);
-    assert((sockfd >= 0) && "socket() failed");
+    if (transport == SHM_TRANSPORT)
+      region = shm_map(endpoint, false);
+    else if (transport == UNIX_TRANSPORT)
+    {
+      // Autobind to an abstract address, so that the server can reply
+      sockfd = socket(AF_UNIX, SOCK_DGRAM, 0);
+      assert((sockfd >= 0) && "socket() failed");
+      struct sockaddr_un unix_addr;
+      memset(&unix_addr, 0, sizeof(unix_addr));
+      unix_addr.sun_family = AF_UNIX;
+      n = bind(sockfd, (struct sockaddr *)&unix_addr, sizeof(sa_family_t));
+      assert((n >= 0) && "bind() failed");
+      strncpy(unix_addr.sun_path, endpoint.c_str(),
+              sizeof(unix_addr.sun_path) - 1);
+      n = connect(sockfd, (struct sockaddr *)&unix_addr, sizeof(unix_addr));
+      assert((n >= 0) && "connect() failed, is the server running?");
+      struct timeval unix_tv;
+      unix_tv.tv_sec = timeout / 1000000;
+      unix_tv.tv_usec = 0;
+      setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &unix_tv, sizeof(unix_tv));
+    }
+    else
+    {
+      // Create UDP socket
+      sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+      assert((sockfd >= 0) && "socket() failed");
 
-    // Initialize server address
-    bzero((char *)&server_addr, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(port);
+      // Initialize server address
+      bzero((char *)&server_addr, sizeof(server_addr));
+      server_addr.sin_family = AF_INET;
+      server_addr.sin_port = htons(port);
 
-    bcopy((char *)server->h_addr, (char *)&server_addr.sin_addr.s_addr,
-          server->h_length);
+      bcopy((char *)server->h_addr, (char *)&server_addr.sin_addr.s_addr,
+            server->h_length);
+    }
+
+    if (!trace.empty())
+    {
+      sigaction(SIGINT, &sa, NULL); // Stop early, still reporting
+      replay_trace(sockfd,
+                   transport == UDP_TRANSPORT ? (struct sockaddr *)&server_addr
+                                              : NULL,
+                   sizeof(server_addr), trace, time_scale, timeout, flow);
+      close(sockfd);
+      write_to_file(flow);
+      return 0;
+    }
 
     auto time_start = high_resolution_clock::now(); // Start time
     auto time_end = time_start;                     // End time
@@ -283,8 +1036,15 @@ int main(int argc, char **argv)
       msg_index++; // Increment the message index
 
       // Send echo packet
-      n = sendto(sockfd, send_message, sizeof(send_message), 0,
-                 (struct sockaddr *)&server_addr, addrlen);
+      if (transport == SHM_TRANSPORT)
+        n = shm_push(region->requests, send_message, sizeof(send_message))
+                ? sizeof(send_message)
+                : -1;
+      else if (transport == UNIX_TRANSPORT)
+        n = send(sockfd, send_message, sizeof(send_message), 0);
+      else
+        n = sendto(sockfd, send_message, sizeof(send_message), 0,
+                   (struct sockaddr *)&server_addr, addrlen);
       if (n < 0)
       {
         std::cout << "Error in sending packet" << endl;
@@ -294,8 +1054,14 @@ int main(int argc, char **argv)
         flow.txPackets++;
 
       // Receive echo packet
-      n = recvfrom(sockfd, recv_message, sizeof(recv_message), 0,
-                   (struct sockaddr *)&server_addr, &addrlen);
+      if (transport == SHM_TRANSPORT)
+        n = shm_pop(region->replies, recv_message, sizeof(recv_message),
+                    busy_poll, timeout);
+      else if (transport == UNIX_TRANSPORT)
+        n = recv(sockfd, recv_message, sizeof(recv_message), 0);
+      else
+        n = recvfrom(sockfd, recv_message, sizeof(recv_message), 0,
+                     (struct sockaddr *)&server_addr, &addrlen);
 
       if (n < 0)
       {
@@ -349,7 +1115,10 @@ int main(int argc, char **argv)
       }
     }
     // Close socket
-    close(sockfd);
+    if (transport == SHM_TRANSPORT)
+      munmap(region, sizeof(ShmRegion));
+    else
+      close(sockfd);
 
     divider();
     print_header();
@@ -0,0 +1,191 @@
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <new>
+#include <sched.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/**
+ * Shared-memory transport of my_iperf (--shm), to measure the same echo
+ * loop without the socket stack.
+ *
+ * The server creates a POSIX shared memory object holding two
+ * single-producer/single-consumer rings: requests from the client and
+ * replies from the server. A message is written straight into a slot of
+ * the ring and its index published with a release store, so a round trip
+ * involves no system call and no kernel copy. Head, tail and the
+ * consumer's sleeping flag live on cache lines of their own, so producer
+ * and consumer do not write to the same line.
+ *
+ * An empty ring is waited on either by spinning (busy-poll) or by
+ * sleeping on a futex on its tail; the producer only makes the wake-up
+ * system call when the consumer announced it is going to sleep. A full
+ * ring is waited on by yielding, since a ping never has more than one
+ * message in flight.
+ *
+ * One client at a time: the rings have one producer and one consumer.
+ */
+
+#define SHM_SLOTS 64          // Messages per ring, a power of 2
+#define SHM_SLOT_LEN 2048     // Bytes per slot, length included
+#define SHM_MAGIC 0x6d797368u // Marks an initialized region
+#define SHM_SPINS 64          // Busy-poll checks between two sched_yield()
+#define CACHE_LINE 64
+
+/**
+ * @brief One message of a ring.
+ */
+struct ShmSlot
+{
+  uint32_t len;                               // Bytes of data in use
+  char data[SHM_SLOT_LEN - sizeof(uint32_t)]; // Message
+};
+
+/**
+ * @brief Single-producer/single-consumer ring of messages.
+ */
+struct ShmRing
+{
+  alignas(CACHE_LINE) std::atomic<uint32_t> head;     // Next slot to read
+  alignas(CACHE_LINE) std::atomic<uint32_t> tail;     // Next slot to write
+  alignas(CACHE_LINE) std::atomic<uint32_t> sleeping; // Consumer on tail
+  alignas(CACHE_LINE) ShmSlot slots[SHM_SLOTS];
+};
+
+/**
+ * @brief Layout of the shared memory object.
+ */
+struct ShmRegion
+{
+  std::atomic<uint32_t> magic; // SHM_MAGIC once the rings are ready
+  ShmRing requests;            // Client to server
+  ShmRing replies;             // Server to client
+};
+
+/**
+ * @brief Map a shared memory object, creating it on the server side
+ * @param name Name of the object, starting with '/'
+ * @param create Create and initialize it (server)
+ * @return The region
+ */
+inline ShmRegion *shm_map(const std::string &name, bool create)
+{
+  int flags = create ? O_RDWR | O_CREAT | O_TRUNC : O_RDWR;
+  int fd = shm_open(name.c_str(), flags, 0600);
+  assert((fd >= 0) && "shm_open() failed, is the server running?");
+  if (create)
+  {
+    int n = ftruncate(fd, sizeof(ShmRegion));
+    assert((n == 0) && "ftruncate() failed");
+  }
+  void *memory = mmap(NULL, sizeof(ShmRegion), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, 0);
+  assert((memory != MAP_FAILED) && "mmap() failed");
+  close(fd);
+
+  ShmRegion *region = (ShmRegion *)memory;
+  if (create)
+  {
+    new (region) ShmRegion(); // Zeroed indices
+    region->magic.store(SHM_MAGIC, std::memory_order_release);
+  }
+  assert((region->magic.load(std::memory_order_acquire) == SHM_MAGIC) &&
+         "shared memory object is not a my_iperf ring");
+  return region;
+}
+
+inline long futex(std::atomic<uint32_t> *word, int op, uint32_t value,
+                  const struct timespec *timeout)
+{
+  return syscall(SYS_futex, (uint32_t *)word, op, value, timeout, NULL, 0);
+}
+
+/**
+ * @brief Copy a message into the ring, waiting while it is full
+ * @param ring Ring this process produces into
+ * @param data Message
+ * @param len Its length, at most the slot size
+ * @return false if the message does not fit in a slot
+ */
+inline bool shm_push(ShmRing &ring, const char *data, uint32_t len)
+{
+  if (len > sizeof(ring.slots[0].data))
+    return false;
+  uint32_t tail = ring.tail.load(std::memory_order_relaxed);
+  while (tail - ring.head.load(std::memory_order_acquire) == SHM_SLOTS)
+    sched_yield();
+
+  ShmSlot &slot = ring.slots[tail & (SHM_SLOTS - 1)];
+  slot.len = len;
+  memcpy(slot.data, data, len);
+  ring.tail.store(tail + 1, std::memory_order_seq_cst);
+  if (ring.sleeping.load(std::memory_order_seq_cst))
+    futex(&ring.tail, FUTEX_WAKE, INT_MAX, NULL);
+  return true;
+}
+
+/**
+ * @brief Take the next message out of the ring
+ * @param ring Ring this process consumes from
+ * @param data Filled with the message, cut to capacity
+ * @param capacity Size of data
+ * @param busy_poll Spin instead of sleeping while the ring is empty
+ * @param timeout_us Longest wait in microseconds
+ * @return Length of the message, or -1 on timeout
+ */
+inline int shm_pop(ShmRing &ring, char *data, size_t capacity, bool busy_poll,
+                   long timeout_us)
+{
+  uint32_t head = ring.head.load(std::memory_order_relaxed);
+  auto deadline = std::chrono::steady_clock::now() +
+                  std::chrono::microseconds(timeout_us);
+  uint32_t tail, spins = 0;
+  while ((tail = ring.tail.load(std::memory_order_acquire)) == head)
+  {
+    auto now = std::chrono::steady_clock::now();
+    if (now >= deadline)
+      return -1;
+    if (busy_poll)
+    {
+      // Give the CPU away now and then, the peer may share it
+      if (++spins % SHM_SPINS == 0)
+        sched_yield();
+      continue;
+    }
+
+    // Announce the sleep, then check again so no wake-up is missed
+    ring.sleeping.store(1, std::memory_order_seq_cst);
+    if (ring.tail.load(std::memory_order_seq_cst) == head)
+    {
+      long left = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      deadline - now)
+                      .count();
+      struct timespec ts;
+      ts.tv_sec = left / 1000000000;
+      ts.tv_nsec = left % 1000000000;
+      futex(&ring.tail, FUTEX_WAIT, head, &ts);
+    }
+    ring.sleeping.store(0, std::memory_order_relaxed);
+  }
+
+  const ShmSlot &slot = ring.slots[head & (SHM_SLOTS - 1)];
+  size_t len = slot.len < capacity ? slot.len : capacity;
+  memcpy(data, slot.data, len);
+  ring.head.store(head + 1, std::memory_order_release);
+  return len;
+}
+
+#endif
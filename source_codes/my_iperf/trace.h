@@ -0,0 +1,139 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "../common/latency_histogram.h"
+
+/**
+ * Traffic traces replayed by the my_iperf client (--trace).
+ *
+ * A trace is a series of (relative timestamp, size) records, read one at
+ * a time so that a trace of any length replays in constant memory. Two
+ * formats are accepted, told apart by the file name:
+ *
+ *  - *.csv: one "seconds,bytes" record per line, seconds as a decimal
+ *    fraction. Empty lines, lines starting with '#' and a header line
+ *    that does not start with a number are skipped.
+ *  - anything else: packed little-endian records of a uint64 timestamp in
+ *    microseconds followed by a uint32 size, 12 bytes each, no header.
+ *
+ * Timestamps are taken relative to the first record, so absolute capture
+ * times work as well.
+ */
+
+#define TRACE_RECORD_LEN 12 // Bytes of a binary record
+
+/**
+ * @brief One packet of a trace.
+ */
+struct TraceRecord
+{
+  uint64_t time_us; // Send time after the first record
+  uint32_t size;    // Bytes of the packet
+};
+
+class TraceReader
+{
+public:
+  /**
+   * @param path Trace file, CSV if its name ends in .csv
+   */
+  TraceReader(const std::string &path)
+      : in(path.c_str(), std::ios::binary), first_us(0), started(false),
+        skipped(0), any_line(false)
+  {
+    csv = path.size() >= 4 && path.compare(path.size() - 4, 4, ".csv") == 0;
+  }
+
+  bool is_open() const
+  {
+    return in.is_open();
+  }
+
+  /**
+   * @brief Read the next record
+   * @param record Filled with the record
+   * @return false at the end of the trace
+   */
+  bool next(TraceRecord &record)
+  {
+    uint64_t time_us;
+    bool found = csv ? next_csv(time_us, record.size)
+                     : next_binary(time_us, record.size);
+    if (!found)
+      return false;
+    if (!started)
+    {
+      first_us = time_us;
+      started = true;
+    }
+    record.time_us = time_us > first_us ? time_us - first_us : 0;
+    return true;
+  }
+
+  /**
+   * @brief CSV lines that could not be parsed
+   */
+  uint64_t malformed() const
+  {
+    return skipped;
+  }
+
+private:
+  std::ifstream in;  // Trace file
+  bool csv;          // Text records instead of binary ones
+  uint64_t first_us; // Timestamp of the first record
+  bool started;      // first_us is set
+  uint64_t skipped;  // Malformed CSV lines
+  bool any_line;     // A CSV line other than a comment was read
+
+  bool next_binary(uint64_t &time_us, uint32_t &size)
+  {
+    unsigned char raw[TRACE_RECORD_LEN];
+    if (!in.read((char *)raw, sizeof(raw)))
+      return false;
+    time_us = 0;
+    for (int i = 7; i >= 0; i--)
+      time_us = (time_us << 8) | raw[i];
+    size = raw[8] | raw[9] << 8 | raw[10] << 16 | (uint32_t)raw[11] << 24;
+    return true;
+  }
+
+  bool next_csv(uint64_t &time_us, uint32_t &size)
+  {
+    std::string line;
+    while (std::getline(in, line))
+    {
+      if (line.empty() || line[0] == '#' || line[0] == '\r')
+        continue;
+      bool header = !any_line; // Only the first line may be a header
+      any_line = true;
+      char *end;
+      double seconds = strtod(line.c_str(), &end);
+      if (end == line.c_str() || *end != ',')
+      {
+        if (!header)
+          skipped++;
+        continue;
+      }
+      long bytes = strtol(end + 1, NULL, 10);
+      if (seconds < 0 || bytes < 0)
+      {
+        skipped++;
+        continue;
+      }
+      time_us = (uint64_t)(seconds * 1e6 + 0.5);
+      size = bytes;
+      return true;
+    }
+    return false;
+  }
+};
+
+#endif
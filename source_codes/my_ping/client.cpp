@@ -2,6 +2,7 @@
 #include <cassert>
 #include <chrono>
 #include <cstring>
+#include <getopt.h>
 #include <iostream>
 #include <netdb.h>
 #include <netinet/in.h>
@@ -10,6 +11,9 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <vector>
+
+#include "../common/busy_poll.h"
 
 using namespace std;
 using namespace std::chrono;
@@ -38,6 +42,10 @@ void usage()
        << endl;
   cout << "\t";
   cout << " [ -p PORT ] [ -h HOSTNAME ] [ -v HELP ]" << endl;
+  cout << "\t";
+  cout << " [ --busy-poll[=MICROSECONDS] ]  Spin on the socket before "
+          "blocking (default budget "
+       << BUSY_POLL_US << "µs)" << endl;
   exit(0);
 }
 
@@ -64,12 +72,21 @@ int main(int argc, char **argv)
   tv.tv_usec = 0;
 
   int min_rtt = INT_MAX, max_rtt = 0, avg_rtt = 0; // RTT variables
+  vector<long> rtts;                               // For the percentiles
+  long busy_poll_us = 0;                           // Spin budget, 0 for none
+
+  struct option long_options[] = {
+      {"busy-poll", optional_argument, 0, 'B'}, {0, 0, 0, 0}};
 
   // Parse command line arguments
-  while ((ch = getopt(argc, argv, "i:n:l:h:p:v")) != -1)
+  while ((ch = getopt_long(argc, argv, "i:n:l:h:p:v", long_options, NULL)) !=
+         -1)
   {
     switch (ch)
     {
+    case 'B':
+      busy_poll_us = optarg ? atol(optarg) : BUSY_POLL_US;
+      break;
     case 'i':
       interval = atoi(optarg);
       break;
@@ -118,6 +135,9 @@ int main(int argc, char **argv)
   sockfd = socket(AF_INET, SOCK_DGRAM, 0);
   assert((sockfd >= 0) && "socket() failed");
 
+  BusyPoll busy(busy_poll_us); // Spins before every blocking receive
+  busy.setup(sockfd);
+
   // Initialize server address
   bzero((char *)&server_addr, sizeof(server_addr));
 
@@ -129,6 +149,10 @@ int main(int argc, char **argv)
   std::cout << "Pinging " << server_addr.sin_addr.s_addr << ":" << port
             << " with " << size << " bytes of data:" << endl;
 
+  double cpu_start = process_cpu_seconds();
+  auto run_start = high_resolution_clock::now();
+  double sleep_seconds = 0; // Time spent between pings, not measured
+
   // Send and recieve echo messages
   for (int i = 0; i < num_packets; i++)
   {
@@ -154,7 +178,7 @@ int main(int argc, char **argv)
       flow.txPackets++;
 
     // Receive echo packet
-    n = recvfrom(sockfd, recv_message, sizeof(recv_message), 0,
+    n = busy.recvfrom(sockfd, recv_message, sizeof(recv_message), 0,
                  (struct sockaddr *)&server_addr, &addrlen);
 
     // Check if the packet was received successfully
@@ -184,11 +208,19 @@ int main(int argc, char **argv)
         min_rtt = min(min_rtt, (int)duration.count());
         max_rtt = max(max_rtt, (int)duration.count());
         avg_rtt += (int)duration.count();
+        rtts.push_back(duration.count());
       }
     }
     // Sleep for interval seconds
+    auto sleep_start = high_resolution_clock::now();
     sleep(interval);
+    sleep_seconds +=
+        duration<double>(high_resolution_clock::now() - sleep_start).count();
   }
+  double cpu = process_cpu_seconds() - cpu_start;
+  double wall =
+      duration<double>(high_resolution_clock::now() - run_start).count() -
+      sleep_seconds;
 
   // Close socket
   close(sockfd);
@@ -211,6 +243,8 @@ int main(int argc, char **argv)
   std::cout << "Minimum = " << min_rtt << "µs, Maximum = " << max_rtt
             << "µs, Average = " << avg_rtt / (float)flow.rxPackets << "µs"
             << endl;
+  print_rtt_percentiles(rtts);
+  busy.report(cpu, wall, flow.txPackets);
 
   return 0;
 }
\ No newline at end of file
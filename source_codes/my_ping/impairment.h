@@ -0,0 +1,486 @@
+#ifndef IMPAIRMENT_H
+#define IMPAIRMENT_H
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <netinet/in.h>
+#include <poll.h>
+#include <random>
+#include <string>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <vector>
+
+#include "../common/latency_histogram.h"
+#include "../common/rate_limiter.h"
+#include "../common/timer_wheel.h"
+
+/**
+ * Network impairment emulator of the my_ping server, to test clients
+ * under bad networks without root or netem.
+ *
+ * Every admitted datagram goes through the same steps as in netem: it may
+ * be lost, at random or in bursts following a Gilbert-Elliott model, and
+ * may be duplicated; each copy then gets a delay drawn from the chosen
+ * distribution, except the ones picked for reordering, which are echoed
+ * at once and so overtake the delayed ones.
+ *
+ * A delayed echo waits in a preallocated slot that the datagram was
+ * received into, on a timer wheel ticking every microsecond, so holding
+ * and releasing it is O(1) and never allocates or copies. The loop sleeps
+ * in ppoll() until the socket is readable or the next release is due,
+ * spinning the last IMPAIR_SPIN_US, and moves datagrams in batches with
+ * recvmmsg() and sendmmsg(). How late every echo left compared to its
+ * release time is recorded and printed with the other counters.
+ */
+
+#define IMPAIR_DATAGRAM 2048 // Largest datagram echoed whole
+#define IMPAIR_BATCH 64      // Datagrams per recvmmsg() and sendmmsg()
+#define IMPAIR_SPIN_US 20    // Spun rather than slept before a release
+
+// Shape of the delay given to each echo
+enum DelayDistribution
+{
+  DELAY_CONSTANT, // Always the mean
+  DELAY_UNIFORM,  // Mean plus or minus up to the jitter
+  DELAY_NORMAL,   // Mean, the jitter as standard deviation
+  DELAY_PARETO    // Mean plus a heavy-tailed excess scaled by the jitter
+};
+
+/**
+ * @brief Impairments to apply, all off by default.
+ */
+struct ImpairmentConfig
+{
+  long delay_us = 0;  // Mean delay
+  long jitter_us = 0; // Spread of the delay
+  DelayDistribution distribution = DELAY_CONSTANT;
+  double loss = 0;      // Random loss probability
+  bool bursty = false;  // Gilbert-Elliott loss instead of random loss
+  double p_bad = 0;     // Good to bad state probability, per datagram
+  double p_good = 1;    // Bad to good state probability, per datagram
+  double loss_bad = 1;  // Loss probability in the bad state
+  double loss_good = 0; // Loss probability in the good state
+  double duplicate = 0; // Duplication probability
+  double reorder = 0;   // Probability to skip the delay
+  size_t queue = 16384; // Datagrams held at once
+  uint64_t seed = 0;    // Random seed, 0 for a random one
+
+  bool enabled() const
+  {
+    return delay_us > 0 || jitter_us > 0 || loss > 0 || bursty ||
+           duplicate > 0 || reorder > 0;
+  }
+};
+
+/**
+ * @brief Parse the name of a delay distribution
+ * @param name constant, uniform, normal or pareto
+ * @param distribution Set to the distribution
+ * @return false for an unknown name
+ */
+inline bool parse_distribution(const std::string &name,
+                               DelayDistribution &distribution)
+{
+  const char *names[] = {"constant", "uniform", "normal", "pareto"};
+  for (int i = 0; i < 4; i++)
+    if (name == names[i])
+    {
+      distribution = (DelayDistribution)i;
+      return true;
+    }
+  return false;
+}
+
+/**
+ * @brief Parse Gilbert-Elliott parameters, in percent as for netem
+ * @param text "p,r[,bad_loss[,good_loss]]"
+ * @param config Its bursty loss fields are set
+ * @return false if text is malformed
+ */
+inline bool parse_gilbert_elliott(const char *text, ImpairmentConfig &config)
+{
+  double values[4] = {0, 100, 100, 0};
+  int n = sscanf(text, "%lf,%lf,%lf,%lf", &values[0], &values[1], &values[2],
+                 &values[3]);
+  if (n < 2)
+    return false;
+  for (double value : values)
+    if (value < 0 || value > 100)
+      return false;
+  config.bursty = true;
+  config.p_bad = values[0] / 100;
+  config.p_good = values[1] / 100;
+  config.loss_bad = values[2] / 100;
+  config.loss_good = values[3] / 100;
+  return true;
+}
+
+/**
+ * @brief An echo waiting for its release time, in the slot it was
+ * received into.
+ */
+struct HeldEcho
+{
+  Timer timer;                       // First, see release()
+  TimerWheel::clock::time_point due; // Release time
+  struct sockaddr_in dest;           // Client to echo to
+  uint32_t len;                      // Bytes of data in use
+  char data[IMPAIR_DATAGRAM];        // Datagram
+};
+
+/**
+ * @brief Counters of the emulator.
+ */
+struct ImpairmentStats
+{
+  uint64_t received;   // Datagrams admitted by the rate limiter
+  uint64_t lost;       // Dropped by the loss model
+  uint64_t duplicated; // Echoed twice
+  uint64_t reordered;  // Echoed without their delay
+  uint64_t delayed;    // Held on the wheel
+  uint64_t overflow;   // Dropped because every slot was in use
+  uint64_t echoed;     // Sent back
+};
+
+class Impairer
+{
+public:
+  /**
+   * @param sockfd Bound UDP socket
+   * @param config Impairments to apply
+   */
+  Impairer(int sockfd, const ImpairmentConfig &config)
+      : sockfd(sockfd), config(config), slots(config.queue),
+        wheel(std::chrono::microseconds(1)), bad(false)
+  {
+    rng.seed(config.seed ? config.seed : std::random_device()());
+    for (HeldEcho &slot : slots)
+    {
+      slot.timer.expire = release;
+      slot.timer.data = this;
+      free_slots.push_back(&slot);
+    }
+    memset(&stats, 0, sizeof(stats));
+    outgoing.reserve(IMPAIR_BATCH);
+  }
+
+  Impairer(const Impairer &) = delete;
+  Impairer &operator=(const Impairer &) = delete;
+
+  /**
+   * @brief Echo datagrams with impairments until stop is set
+   * @param limiter Per-source admission control
+   * @param quiet Do not print every message
+   * @param stop Set by SIGINT and SIGTERM
+   * @param report Set by SIGUSR1 to print the counters
+   */
+  void run(RateLimiter &limiter, bool quiet, volatile sig_atomic_t &stop,
+           volatile sig_atomic_t &report)
+  {
+    // The default 50 us of timer slack would make every release late
+    prctl(PR_SET_TIMERSLACK, 1);
+    while (!stop)
+    {
+      if (report)
+      {
+        report = 0;
+        report_sources(limiter);
+        print();
+      }
+      wait();
+      // Releases first, so that a burst of arrivals does not delay them
+      wheel.advance(TimerWheel::clock::now());
+      flush();
+      receive(limiter, quiet);
+      flush(); // Echoes that were not delayed
+    }
+    report_sources(limiter);
+    print();
+  }
+
+  /**
+   * @brief Print the counters and how accurate the releases were
+   */
+  void print() const
+  {
+    printf("\n%lu datagrams impaired: %lu lost, %lu duplicated, %lu "
+           "reordered, %lu delayed, %lu over the queue, %lu echoed, %zu "
+           "held\n",
+           (unsigned long)stats.received, (unsigned long)stats.lost,
+           (unsigned long)stats.duplicated, (unsigned long)stats.reordered,
+           (unsigned long)stats.delayed, (unsigned long)stats.overflow,
+           (unsigned long)stats.echoed, wheel.size());
+    if (lateness.count() > 0)
+      printf("Release error: p50 = %luus, p99 = %luus, p99.9 = %luus, max "
+             "= %luus\n",
+             (unsigned long)lateness.percentile(0.5),
+             (unsigned long)lateness.percentile(0.99),
+             (unsigned long)lateness.percentile(0.999),
+             (unsigned long)lateness.max());
+  }
+
+private:
+  int sockfd;                         // Bound UDP socket
+  ImpairmentConfig config;            // Impairments to apply
+  std::vector<HeldEcho> slots;        // Every datagram buffer
+  std::vector<HeldEcho *> free_slots; // Buffers not in use
+  TimerWheel wheel;                   // Release times of held echoes
+  std::mt19937_64 rng;                // Source of every random choice
+  bool bad;                           // Gilbert-Elliott state
+  ImpairmentStats stats;              // Counters
+  LatencyHistogram lateness;          // Release error in microseconds
+  std::vector<HeldEcho *> outgoing;   // Echoes of the next sendmmsg()
+
+  bool chance(double p)
+  {
+    return p > 0 && std::uniform_real_distribution<double>(0, 1)(rng) < p;
+  }
+
+  /**
+   * @brief Run the loss model for one datagram
+   * @return true to drop it
+   */
+  bool lose()
+  {
+    if (!config.bursty)
+      return chance(config.loss);
+    bad = bad ? !chance(config.p_good) : chance(config.p_bad);
+    return chance(bad ? config.loss_bad : config.loss_good);
+  }
+
+  /**
+   * @brief Draw the delay of one echo
+   * @return Microseconds, never negative
+   */
+  long draw_delay()
+  {
+    double mean = config.delay_us, jitter = config.jitter_us, delay = mean;
+    switch (config.distribution)
+    {
+    case DELAY_CONSTANT:
+      break;
+    case DELAY_UNIFORM:
+      delay = std::uniform_real_distribution<double>(mean - jitter,
+                                                     mean + jitter)(rng);
+      break;
+    case DELAY_NORMAL:
+      if (jitter > 0)
+        delay = std::normal_distribution<double>(mean, jitter)(rng);
+      break;
+    case DELAY_PARETO:
+    {
+      // Shape 3: a finite variance but a long tail, excess mean jitter / 2
+      double u = std::uniform_real_distribution<double>(0, 1)(rng);
+      delay = mean + jitter * (pow(1 - u, -1.0 / 3) - 1);
+      break;
+    }
+    }
+    return delay > 0 ? (long)(delay + 0.5) : 0;
+  }
+
+  /**
+   * @brief Sleep until the socket is readable or the next release is due
+   */
+  void wait()
+  {
+    struct pollfd pfd = {sockfd, POLLIN, 0};
+    TimerWheel::clock::time_point due = wheel.next_due();
+    if (due == TimerWheel::clock::time_point::max())
+    {
+      ppoll(&pfd, 1, NULL, NULL);
+      return;
+    }
+    auto left = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    due - TimerWheel::clock::now()) -
+                std::chrono::microseconds(IMPAIR_SPIN_US);
+    struct timespec ts = {0, 0}; // Spinning: only look at the socket
+    if (left.count() > 0)
+    {
+      ts.tv_sec = left.count() / 1000000000;
+      ts.tv_nsec = left.count() % 1000000000;
+    }
+    ppoll(&pfd, 1, &ts, NULL);
+  }
+
+  /**
+   * @brief Receive every waiting datagram, up to a batch, and impair it
+   */
+  void receive(RateLimiter &limiter, bool quiet)
+  {
+    struct mmsghdr msgs[IMPAIR_BATCH];
+    struct iovec iovs[IMPAIR_BATCH];
+    HeldEcho *taken[IMPAIR_BATCH];
+    int n = 0;
+    for (; n < IMPAIR_BATCH && !free_slots.empty(); n++)
+    {
+      taken[n] = free_slots.back();
+      free_slots.pop_back();
+      iovs[n].iov_base = taken[n]->data;
+      iovs[n].iov_len = sizeof(taken[n]->data);
+      memset(&msgs[n].msg_hdr, 0, sizeof(msgs[n].msg_hdr));
+      msgs[n].msg_hdr.msg_name = &taken[n]->dest;
+      msgs[n].msg_hdr.msg_namelen = sizeof(taken[n]->dest);
+      msgs[n].msg_hdr.msg_iov = &iovs[n];
+      msgs[n].msg_hdr.msg_iovlen = 1;
+    }
+    if (n == 0)
+    {
+      // Every slot is held: drain the socket rather than let it back up
+      char sink[IMPAIR_DATAGRAM];
+      while (recv(sockfd, sink, sizeof(sink), MSG_DONTWAIT) >= 0)
+        stats.overflow++;
+      return;
+    }
+
+    int got = recvmmsg(sockfd, msgs, n, MSG_DONTWAIT, NULL);
+    if (got < 0)
+      got = 0;
+    TimerWheel::clock::time_point now = TimerWheel::clock::now();
+    for (int i = 0; i < got; i++)
+    {
+      HeldEcho *echo = taken[i];
+      echo->len = msgs[i].msg_len;
+      if (!limiter.admit(echo->dest, now))
+      {
+        free_slots.push_back(echo);
+        continue;
+      }
+      if (!quiet)
+      {
+        std::cout << "\nConnection from client "
+                  << inet_ntoa(echo->dest.sin_addr) << ":"
+                  << ntohs(echo->dest.sin_port) << std::endl;
+        std::cout << "Client's Message: "
+                  << std::string(echo->data, strnlen(echo->data, echo->len))
+                  << std::endl;
+      }
+      impair(echo, now);
+    }
+    for (int i = got; i < n; i++)
+      free_slots.push_back(taken[i]);
+  }
+
+  /**
+   * @brief Apply the loss, duplication, reordering and delay steps
+   * @param echo Received datagram, in its slot
+   * @param now Time it was received
+   */
+  void impair(HeldEcho *echo, TimerWheel::clock::time_point now)
+  {
+    stats.received++;
+    if (lose())
+    {
+      stats.lost++;
+      free_slots.push_back(echo);
+      return;
+    }
+    if (chance(config.duplicate))
+    {
+      if (free_slots.empty())
+        stats.overflow++;
+      else
+      {
+        HeldEcho *copy = free_slots.back();
+        free_slots.pop_back();
+        copy->dest = echo->dest;
+        copy->len = echo->len;
+        memcpy(copy->data, echo->data, echo->len);
+        stats.duplicated++;
+        schedule(copy, now);
+      }
+    }
+    schedule(echo, now);
+  }
+
+  /**
+   * @brief Hold an echo for its delay, or queue it for sending now
+   */
+  void schedule(HeldEcho *echo, TimerWheel::clock::time_point now)
+  {
+    long delay = draw_delay();
+    if (delay > 0 && chance(config.reorder))
+    {
+      stats.reordered++;
+      delay = 0;
+    }
+    echo->due = now + std::chrono::microseconds(delay);
+    if (delay == 0)
+    {
+      queue_send(echo);
+      return;
+    }
+    stats.delayed++;
+    wheel.schedule(echo->timer, echo->due - TimerWheel::clock::now());
+  }
+
+  /**
+   * @brief Expire callback of a held echo
+   */
+  static void release(Timer *timer)
+  {
+    // The timer is the first member of its slot
+    HeldEcho *echo = (HeldEcho *)timer;
+    ((Impairer *)timer->data)->queue_send(echo);
+  }
+
+  void queue_send(HeldEcho *echo)
+  {
+    outgoing.push_back(echo);
+    if (outgoing.size() == IMPAIR_BATCH)
+      flush();
+  }
+
+  /**
+   * @brief Send the queued echoes and give their slots back
+   */
+  void flush()
+  {
+    if (outgoing.empty())
+      return;
+    struct mmsghdr msgs[IMPAIR_BATCH];
+    struct iovec iovs[IMPAIR_BATCH];
+    size_t n = outgoing.size();
+    for (size_t i = 0; i < n; i++)
+    {
+      iovs[i].iov_base = outgoing[i]->data;
+      iovs[i].iov_len = outgoing[i]->len;
+      memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+      msgs[i].msg_hdr.msg_name = &outgoing[i]->dest;
+      msgs[i].msg_hdr.msg_namelen = sizeof(outgoing[i]->dest);
+      msgs[i].msg_hdr.msg_iov = &iovs[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    TimerWheel::clock::time_point now = TimerWheel::clock::now();
+    size_t done = 0;
+    while (done < n)
+    {
+      int sent = sendmmsg(sockfd, msgs + done, n - done, 0);
+      if (sent < 0 && errno == EINTR)
+        continue;
+      if (sent <= 0)
+        sent = 1; // Skip the datagram that failed
+      else
+        stats.echoed += sent;
+      done += sent;
+    }
+    for (HeldEcho *echo : outgoing)
+    {
+      lateness.add(std::chrono::duration_cast<std::chrono::microseconds>(
+                       now - echo->due)
+                       .count());
+      free_slots.push_back(echo);
+    }
+    outgoing.clear();
+  }
+};
+
+#endif
@@ -1,5 +1,9 @@
 #include <arpa/inet.h>
 #include <cassert>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <getopt.h>
 #include <iostream>
 #include <netinet/in.h>
 #include <stdio.h>
@@ -8,25 +12,185 @@
 #include <sys/types.h>
 #include <unistd.h>
 
-#define MAX_LINE 1024
+#include "../common/busy_poll.h"
+#include "../common/rate_limiter.h"
+#include "../common/uring_udp.h"
+#include "impairment.h"
+#include "udp_echo.h"
+
 using namespace std;
 
+static volatile sig_atomic_t stop = 0;   // Set by SIGINT and SIGTERM
+static volatile sig_atomic_t report = 0; // Set by SIGUSR1
+
+/**
+ * @brief Signal handler that asks the receive loop to report or stop
+ * @param sig Signal number
+ */
+void handle_signal(int sig)
+{
+  if (sig == SIGUSR1)
+    report = 1;
+  else
+    stop = 1;
+}
+
+/**
+ * @brief Usage function
+ *
+ * This is a helper function to print the usage of the program.
+ */
+void usage()
+{
+  cout << "Usage: ./server [ -r RATE ] [ -b BURST ] [ -n SOURCES ] [ -q ] "
+          "[ -u | -U ] [ --busy-poll[=MICROSECONDS] ] [ IMPAIRMENTS ] PORT"
+       << endl
+       << "  -r RATE     Datagrams per second echoed per source, 0 for no "
+          "limit (default 0)"
+       << endl
+       << "  -b BURST    Datagrams a quiet source may send at once "
+          "(default 32)"
+       << endl
+       << "  -n SOURCES  Sources tracked at once (default 4096)" << endl
+       << "  -q          Do not print every message" << endl
+       << "  -u          Echo with io_uring instead of recvfrom/sendto" << endl
+       << "  -U          Echo with io_uring and a kernel polling thread "
+          "(SQPOLL)"
+       << endl
+       << "  --busy-poll Spin on the socket before blocking (default budget "
+       << BUSY_POLL_US << "us)" << endl
+       << "Impairments, applied to every echo as netem would:" << endl
+       << "  --delay US           Mean delay" << endl
+       << "  --jitter US          Spread of the delay" << endl
+       << "  --delay-dist NAME    constant, uniform, normal or pareto "
+          "(default constant, uniform with a jitter)"
+       << endl
+       << "  --loss PERCENT       Random loss" << endl
+       << "  --loss-burst P,R[,BAD[,GOOD]]" << endl
+       << "                       Gilbert-Elliott loss: percent chances to "
+          "enter and leave"
+       << endl
+       << "                       the bad state, and to lose in it "
+          "(default 100) and out of it"
+       << endl
+       << "                       (default 0)" << endl
+       << "  --duplicate PERCENT  Echo twice" << endl
+       << "  --reorder PERCENT    Echo at once, ahead of the delayed echoes"
+       << endl
+       << "  --queue N            Echoes held at once (default 16384)" << endl
+       << "  --seed N             Random seed (default random)" << endl;
+  exit(0);
+}
+
 // UDP echo server application
 int main(int argc, char *argv[])
 {
+  int ch;
+  double rate = 0;    // Per source, 0 for no limit
+  double burst = 32;  // Bucket size of every source
+  int sources = 4096; // Size of the source table
+  bool quiet = false; // Do not print every message
+  bool uring = false;  // Echo with io_uring
+  bool sqpoll = false; // Let a kernel thread poll the io_uring
+  long busy_poll_us = 0; // Spin budget of a receive, 0 for none
+  ImpairmentConfig impair; // Off unless an impairment is given
+  bool distribution_set = false; // --delay-dist given
+  bool impair_error = false;     // Malformed impairment option
+
+  struct option long_options[] = {
+      {"busy-poll", optional_argument, 0, 'B'},
+      {"delay", required_argument, 0, 'D'},
+      {"jitter", required_argument, 0, 'J'},
+      {"delay-dist", required_argument, 0, 'T'},
+      {"loss", required_argument, 0, 'L'},
+      {"loss-burst", required_argument, 0, 'G'},
+      {"duplicate", required_argument, 0, 'P'},
+      {"reorder", required_argument, 0, 'O'},
+      {"queue", required_argument, 0, 'Q'},
+      {"seed", required_argument, 0, 'S'},
+      {0, 0, 0, 0}};
+
+  // Parse command line arguments
+  while ((ch = getopt_long(argc, argv, "r:b:n:quUv", long_options, NULL)) !=
+         -1)
+  {
+    switch (ch)
+    {
+    case 'B':
+      busy_poll_us = optarg ? atol(optarg) : BUSY_POLL_US;
+      break;
+    case 'D':
+      impair.delay_us = atol(optarg);
+      break;
+    case 'J':
+      impair.jitter_us = atol(optarg);
+      break;
+    case 'T':
+      impair_error |= !parse_distribution(optarg, impair.distribution);
+      distribution_set = true;
+      break;
+    case 'L':
+      impair.loss = atof(optarg) / 100;
+      break;
+    case 'G':
+      impair_error |= !parse_gilbert_elliott(optarg, impair);
+      break;
+    case 'P':
+      impair.duplicate = atof(optarg) / 100;
+      break;
+    case 'O':
+      impair.reorder = atof(optarg) / 100;
+      break;
+    case 'Q':
+      impair.queue = atol(optarg);
+      break;
+    case 'S':
+      impair.seed = strtoull(optarg, NULL, 10);
+      break;
+    case 'r':
+      rate = atof(optarg);
+      break;
+    case 'b':
+      burst = atof(optarg);
+      break;
+    case 'n':
+      sources = atoi(optarg);
+      break;
+    case 'q':
+      quiet = true;
+      break;
+    case 'U':
+      sqpoll = true;
+      // Fall through
+    case 'u':
+      uring = true;
+      break;
+    default:
+      usage();
+    }
+  }
+
   // Check command line arguments
-  if (argc < 2)
+  if (optind >= argc)
   {
     fprintf(stderr, "ERROR, no port provided\n");
     exit(1);
   }
-  int port = atoi(argv[1]); // First arg:  local port
+  if (rate < 0 || sources < 1 || busy_poll_us < 0 ||
+      (uring && busy_poll_us > 0))
+    usage();
+  if (impair.jitter_us > 0 && !distribution_set)
+    impair.distribution = DELAY_UNIFORM;
+  if (impair_error || impair.delay_us < 0 || impair.jitter_us < 0 ||
+      impair.loss < 0 || impair.loss > 1 || impair.duplicate < 0 ||
+      impair.duplicate > 1 || impair.reorder < 0 || impair.reorder > 1 ||
+      impair.queue < IMPAIR_BATCH ||
+      (impair.enabled() && (uring || busy_poll_us > 0)))
+    usage();
+  int port = atoi(argv[optind]); // First positional arg: local port
 
   int sockfd;
-  struct sockaddr_in server_addr, client_addr;
-  socklen_t addrlen; // Length of addresses
-  int n;
-  char buffer[1024]; // Message buffer
+  struct sockaddr_in server_addr;
 
   // Create socket
   sockfd = socket(AF_INET, SOCK_DGRAM, 0);
@@ -42,27 +206,40 @@ int main(int argc, char *argv[])
       bind(sockfd, (struct sockaddr *)&server_addr, sizeof(server_addr));
   assert(bind_result >= 0 && "bind() failed");
 
-  printf("\nServer Started ...\n");
+  BusyPoll busy(busy_poll_us); // Spins before every blocking receive
+  busy.setup(sockfd);
 
-  while (1)
-  {
-    cout << "\n";
-    addrlen = sizeof(client_addr); // Length of addresses
+  // Per-source token buckets: over-rate datagrams are dropped unechoed
+  RateLimiter limiter(sources, rate, burst);
 
-    // Receive message from client
-    n = recvfrom(sockfd, buffer, MAX_LINE, 0, (struct sockaddr *)&client_addr,
-                 &addrlen);
-    assert((n >= 0) && "recvfrom() failed");
+  // Without SA_RESTART, so that recvfrom() returns EINTR
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = handle_signal;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  sigaction(SIGUSR1, &sa, NULL);
 
-    cout << "Connection from client " << inet_ntoa(client_addr.sin_addr) << ":"
-         << ntohs(client_addr.sin_port) << endl;
-
-    string message(buffer);
-    cout << "Client's Message: " << message << endl;
+  printf("\nServer Started ...\n");
+  double cpu_start = process_cpu_seconds();
+  auto run_start = BusyPoll::clock::now();
 
-    // Send message back to client
-    n = sendto(sockfd, buffer, n, 0, (struct sockaddr *)&client_addr, addrlen);
-    assert((n >= 0) && "sendto() failed");
+  if (uring)
+    uring_udp_echo(sockfd, limiter, quiet, sqpoll, stop, report);
+  else if (impair.enabled())
+  {
+    Impairer impairer(sockfd, impair);
+    impairer.run(limiter, quiet, stop, report);
   }
+  else
+    udp_echo(sockfd, busy, limiter, quiet, stop, report);
+
+  report_sources(limiter);
+  uint64_t admitted, dropped;
+  limiter.totals(admitted, dropped);
+  busy.report(process_cpu_seconds() - cpu_start,
+              chrono::duration<double>(BusyPoll::clock::now() - run_start)
+                  .count(),
+              admitted);
   return 0;
 }
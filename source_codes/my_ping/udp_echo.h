@@ -0,0 +1,85 @@
+#ifndef UDP_ECHO_H
+#define UDP_ECHO_H
+
+#include <arpa/inet.h>
+#include <cassert>
+#include <cerrno>
+#include <csignal>
+#include <iostream>
+#include <netinet/in.h>
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+
+#include "../common/busy_poll.h"
+#include "../common/rate_limiter.h"
+
+/**
+ * Blocking receive loop of the my_ping echo server, the default engine
+ * next to io_uring (common/uring_udp.h) and the impairment emulator
+ * (impairment.h). benchmarks/microbench.cpp runs it on a thread to time a
+ * round trip through it.
+ */
+
+#define MAX_DATAGRAM 2048 // Largest datagram echoed whole
+
+/**
+ * @brief Echo datagrams with recvfrom() and sendto() until stop is set
+ *
+ * stop is checked once per datagram, so whoever sets it outside a signal
+ * handler should also send one more datagram to wake the loop.
+ *
+ * @param sockfd Bound UDP socket
+ * @param busy Spins before every blocking receive
+ * @param limiter Per-source admission control
+ * @param quiet Do not print every message
+ * @param stop Set by SIGINT and SIGTERM
+ * @param report Set by SIGUSR1 to print the per-source counters
+ */
+inline void udp_echo(int sockfd, BusyPoll &busy, RateLimiter &limiter,
+                     bool quiet, volatile sig_atomic_t &stop,
+                     volatile sig_atomic_t &report)
+{
+  struct sockaddr_in client_addr;
+  socklen_t addrlen;         // Length of addresses
+  char buffer[MAX_DATAGRAM]; // Message buffer
+
+  while (!stop)
+  {
+    if (report)
+    {
+      report = 0;
+      report_sources(limiter);
+    }
+    addrlen = sizeof(client_addr); // Length of addresses
+
+    // Receive message from client
+    int n = busy.recvfrom(sockfd, buffer, MAX_DATAGRAM, 0,
+                          (struct sockaddr *)&client_addr, &addrlen, &stop);
+    if (n < 0)
+    {
+      assert((errno == EINTR) && "recvfrom() failed");
+      continue;
+    }
+
+    if (!limiter.admit(client_addr, RateLimiter::clock::now()))
+      continue;
+
+    if (!quiet)
+    {
+      std::cout << "\nConnection from client "
+                << inet_ntoa(client_addr.sin_addr) << ":"
+                << ntohs(client_addr.sin_port) << std::endl;
+
+      std::string message(buffer, strnlen(buffer, n));
+      std::cout << "Client's Message: " << message << std::endl;
+    }
+
+    // Send message back to client
+    n = sendto(sockfd, buffer, n, 0, (struct sockaddr *)&client_addr,
+               addrlen);
+    assert((n >= 0) && "sendto() failed");
+  }
+}
+
+#endif
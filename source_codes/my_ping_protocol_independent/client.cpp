@@ -1,10 +1,16 @@
 #include <arpa/inet.h>
 #include <cassert>
 #include <chrono>
+#include <cerrno>
 #include <climits>
+#include <fcntl.h>
+#include <fstream>
+#include <getopt.h>
 #include <iostream>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <linux/tcp.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -12,10 +18,18 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <vector>
+
+#include "../common/busy_poll.h"
+#include "frame.h"
+
+#define CONNECTION_ATTEMPT_DELAY 250 // In milliseconds, RFC 8305 default
 
 using namespace std;
 using namespace std::chrono;
 
+static BusyPoll busy_poll; // Spins before every blocking read, if enabled
+
 /**
  * @brief Class to monitor transferred and recieved packets.
  */
@@ -39,10 +53,593 @@ void usage()
           "PACKET_SIZE ]"
        << endl;
   cout << "\t";
-  cout << " [ -p PORT ] [ -h HOSTNAME ] [ -v HELP ]" << endl;
+  cout << " [ -P PIPELINE_DEPTH ] [ -p PORT ] [ -h HOSTNAME ] [ -v HELP ]"
+       << endl;
+  cout << "\t";
+  cout << " [ -C, --connect-per-probe ] [ -F, --fastopen ] [ -N, --nagle ]"
+       << endl;
+  cout << "\t";
+  cout << " [ --busy-poll[=MICROSECONDS] ]  Spin on the socket before "
+          "blocking (default budget "
+       << BUSY_POLL_US << "µs)" << endl;
   exit(0);
 }
 
+/**
+ * @brief Minimum, maximum and average of a series of samples.
+ */
+struct Summary
+{
+  long min_value;
+  long max_value;
+  long sum;
+  int count;
+  Summary() : min_value(LONG_MAX), max_value(0), sum(0), count(0)
+  {
+  }
+
+  /**
+   * @brief Add one sample
+   * @param value Sample value
+   */
+  void add(long value)
+  {
+    min_value = min(min_value, value);
+    max_value = max(max_value, value);
+    sum += value;
+    count++;
+  }
+
+  /**
+   * @brief Print the summary on one line
+   * @param unit Unit of the samples
+   * @param label Optional name printed in front of the values
+   */
+  void print(string unit, string label = "") const
+  {
+    std::cout << "\t";
+    if (!label.empty())
+      std::cout << label << ": ";
+    std::cout << "Minimum = " << (count ? min_value : 0) << unit
+              << ", Maximum = " << max_value << unit
+              << ", Average = " << (count ? sum / (double)count : 0) << unit
+              << endl;
+  }
+};
+
+/**
+ * @brief Kernel view of the connection, sampled with TCP_INFO after every
+ * echo.
+ *
+ * Comparing the kernel's smoothed RTT with the RTT the application
+ * measured separates network effects from stalls on the hosts, such as
+ * Nagle's algorithm waiting on a delayed ACK.
+ */
+struct TcpTelemetry
+{
+  Summary srtt;          // Smoothed RTT in microseconds
+  Summary rttvar;        // RTT variance in microseconds
+  Summary cwnd;          // Congestion window in segments
+  Summary delivery_rate; // Delivery rate in bytes per second
+  Summary app_overhead;  // Application RTT minus smoothed RTT
+  long retransmits;      // Retransmitted segments over all connections
+  uint32_t conn_retrans; // Retransmits seen so far on this connection
+  TcpTelemetry() : retransmits(0), conn_retrans(0)
+  {
+  }
+
+  /**
+   * @brief Reset the per connection counters for a new connection
+   */
+  void new_connection()
+  {
+    conn_retrans = 0;
+  }
+
+  /**
+   * @brief Record one sample
+   * @param info Sample taken right after an echo
+   * @param app_rtt RTT of that echo measured by the application
+   */
+  void add(const struct tcp_info &info, long app_rtt)
+  {
+    srtt.add(info.tcpi_rtt);
+    rttvar.add(info.tcpi_rttvar);
+    cwnd.add(info.tcpi_snd_cwnd);
+    delivery_rate.add(info.tcpi_delivery_rate);
+    app_overhead.add(max(0L, app_rtt - (long)info.tcpi_rtt));
+    retransmits += info.tcpi_total_retrans - conn_retrans;
+    conn_retrans = info.tcpi_total_retrans;
+  }
+
+  /**
+   * @brief Print the statistics block
+   */
+  void print() const
+  {
+    std::cout << "Kernel TCP_INFO, " << srtt.count << " samples:" << endl;
+    srtt.print("µs", "Smoothed RTT");
+    rttvar.print("µs", "RTT variance");
+    cwnd.print(" segments", "Congestion window");
+    delivery_rate.print(" B/s", "Delivery rate");
+    app_overhead.print("µs", "Application RTT above smoothed RTT");
+    std::cout << "\tRetransmits = " << retransmits << endl;
+  }
+};
+
+/**
+ * @brief Timings of a probe made on a connection of its own.
+ */
+struct ProbeTiming
+{
+  long handshake;       // connect(), or the fast open sendto(), in µs
+  long rtt;             // Request sent to reply received, in microseconds
+  long total;           // Socket creation to reply received, in microseconds
+  bool fastopen;        // Server accepted the request carried in the SYN
+  struct tcp_info info; // Kernel view of the connection after the reply
+};
+
+/**
+ * @brief Sample the kernel's view of a connection
+ * @param fd Connected socket
+ * @param info Filled with the sample
+ * @return false if TCP_INFO is not available
+ */
+bool sample_tcp_info(int fd, struct tcp_info &info)
+{
+  socklen_t len = sizeof(info);
+  memset(&info, 0, sizeof(info));
+  return getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) == 0;
+}
+
+/**
+ * @brief Turn Nagle's algorithm off or on
+ *
+ * Small requests otherwise wait for the ACK of the previous segment, which
+ * the server may delay, and that shows up as a multi-millisecond RTT.
+ *
+ * @param fd Socket
+ * @param nodelay true to send segments right away
+ */
+void set_nodelay(int fd, bool nodelay)
+{
+  int value = nodelay;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &value, sizeof(value));
+}
+
+/**
+ * @brief Check that the kernel allows TCP Fast Open for a role
+ * @param flag 1 for the client side, 2 for the server side
+ * @return true if net.ipv4.tcp_fastopen has the flag set
+ */
+bool fastopen_enabled(int flag)
+{
+  ifstream sysctl("/proc/sys/net/ipv4/tcp_fastopen");
+  int value = 0;
+  sysctl >> value;
+  return (value & flag) != 0;
+}
+
+/**
+ * @brief Bound every read on a socket so a dead server shows up as a
+ * timeout instead of a hang
+ * @param fd Socket
+ * @param timeout Timeout in microseconds
+ */
+void set_timeout(int fd, int timeout)
+{
+  struct timeval tv;
+  tv.tv_sec = timeout / 1000000;
+  tv.tv_usec = timeout % 1000000;
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, (const char *)&tv, sizeof(tv));
+}
+
+/**
+ * @brief Current monotonic time
+ * @return Nanoseconds on the steady clock
+ */
+uint64_t now_ns()
+{
+  return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch())
+      .count();
+}
+
+/**
+ * @brief Sleep between two probes
+ * @param seconds Interval to sleep
+ * @return Seconds actually slept
+ */
+double sleep_between_probes(int seconds)
+{
+  auto start = steady_clock::now();
+  sleep(seconds);
+  return duration<double>(steady_clock::now() - start).count();
+}
+
+/**
+ * @brief Read exactly len bytes from a stream socket
+ * @param fd Socket
+ * @param buffer Destination buffer
+ * @param len Number of bytes to read
+ * @return false on error, timeout or end of stream
+ */
+bool read_full(int fd, char *buffer, size_t len)
+{
+  size_t got = 0;
+  while (got < len)
+  {
+    ssize_t n = busy_poll.recvfrom(fd, buffer + got, len - got, 0, NULL, NULL);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    got += n;
+  }
+  return true;
+}
+
+/**
+ * @brief Write exactly len bytes to a stream socket
+ * @param fd Socket
+ * @param buffer Source buffer
+ * @param len Number of bytes to write
+ * @return false on error
+ */
+bool write_full(int fd, const char *buffer, size_t len)
+{
+  size_t sent = 0;
+  while (sent < len)
+  {
+    ssize_t n = write(fd, buffer + sent, len - sent);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      return false;
+    sent += n;
+  }
+  return true;
+}
+
+/**
+ * @brief Convert a socket address to a printable IP address
+ * @param addr sockaddr struct
+ * @return IP address as a string
+ */
+string address_to_string(struct sockaddr *addr)
+{
+  char buffer[INET6_ADDRSTRLEN]; // Buffer for address conversion
+  void *ip;
+
+  if (addr->sa_family == AF_INET6)
+    ip = &((struct sockaddr_in6 *)addr)->sin6_addr;
+  else
+    ip = &((struct sockaddr_in *)addr)->sin_addr;
+
+  if (inet_ntop(addr->sa_family, ip, buffer, sizeof(buffer)) == NULL)
+    return "Invalid Address";
+  return buffer;
+}
+
+/**
+ * @brief One connection attempt made while racing the resolved addresses.
+ */
+struct ConnectAttempt
+{
+  int fd;                          // Non-blocking socket, -1 once closed
+  int family;                      // AF_INET or AF_INET6
+  string address;                  // Printable IP address
+  steady_clock::time_point start;  // Time connect() was issued
+  steady_clock::time_point finish; // Time the attempt succeeded or failed
+  int error;                       // 0 on success, errno otherwise
+  bool done;                       // Attempt finished, won or cancelled
+};
+
+/**
+ * @brief Order addresses as RFC 8305 section 4 asks
+ *
+ * Addresses keep the order getaddrinfo() returned, but families are
+ * interleaved starting with the family of the first result, so a broken
+ * IPv6 path is followed directly by an IPv4 candidate.
+ *
+ * @param result List returned by getaddrinfo()
+ * @return Interleaved list of addresses
+ */
+vector<struct addrinfo *> interleave_families(struct addrinfo *result)
+{
+  vector<struct addrinfo *> first, second, ordered;
+  for (struct addrinfo *rp = result; rp != NULL; rp = rp->ai_next)
+  {
+    if (rp->ai_family == result->ai_family)
+      first.push_back(rp);
+    else
+      second.push_back(rp);
+  }
+  for (size_t i = 0; i < max(first.size(), second.size()); i++)
+  {
+    if (i < first.size())
+      ordered.push_back(first[i]);
+    if (i < second.size())
+      ordered.push_back(second[i]);
+  }
+  return ordered;
+}
+
+/**
+ * @brief Connect to the first address that answers (Happy Eyeballs)
+ *
+ * A non-blocking connect() is started on the first address, and another
+ * one on the next address every CONNECTION_ATTEMPT_DELAY ms, or right away
+ * when an attempt fails. The first socket to complete its handshake wins
+ * and all others are closed.
+ *
+ * @param result List returned by getaddrinfo()
+ * @param timeout_ms Give up after this many milliseconds
+ * @param attempts Filled with one entry per attempt that was started
+ * @return Connected blocking socket, or -1 if every attempt failed
+ */
+int happy_eyeballs(struct addrinfo *result, int timeout_ms,
+                   vector<ConnectAttempt> &attempts)
+{
+  vector<struct addrinfo *> candidates = interleave_families(result);
+  size_t next = 0; // Next candidate to try
+  int winner = -1; // Index of the attempt that connected
+  auto deadline = steady_clock::now() + milliseconds(timeout_ms);
+  auto next_start = steady_clock::now(); // When to start the next attempt
+
+  while (winner < 0)
+  {
+    auto now = steady_clock::now();
+    if (now >= deadline)
+      break;
+
+    // Start the next attempt if its turn has come
+    if (next < candidates.size() && now >= next_start)
+    {
+      struct addrinfo *rp = candidates[next++];
+      ConnectAttempt attempt;
+      attempt.family = rp->ai_family;
+      attempt.address = address_to_string(rp->ai_addr);
+      attempt.start = now;
+      attempt.finish = now;
+      attempt.error = 0;
+      attempt.done = false;
+      attempt.fd = socket(rp->ai_family, rp->ai_socktype | SOCK_NONBLOCK,
+                          rp->ai_protocol);
+
+      if (attempt.fd < 0)
+        attempt.error = errno;
+      else if (connect(attempt.fd, rp->ai_addr, rp->ai_addrlen) < 0 &&
+               errno != EINPROGRESS)
+        attempt.error = errno;
+
+      if (attempt.error != 0)
+      {
+        if (attempt.fd >= 0)
+          close(attempt.fd);
+        attempt.fd = -1;
+        attempt.done = true;
+        next_start = now; // Failed at once, try the next one right away
+      }
+      else
+        next_start = now + milliseconds(CONNECTION_ATTEMPT_DELAY);
+      attempts.push_back(attempt);
+      continue;
+    }
+
+    // Wait for an attempt to finish, or for the next one to be due
+    vector<struct pollfd> fds;
+    vector<int> index;
+    for (size_t i = 0; i < attempts.size(); i++)
+    {
+      if (attempts[i].done)
+        continue;
+      fds.push_back({attempts[i].fd, POLLOUT, 0});
+      index.push_back(i);
+    }
+
+    // Nothing in flight and nothing left to try
+    if (fds.empty() && next >= candidates.size())
+      break;
+
+    auto wake = deadline;
+    if (next < candidates.size())
+      wake = min(wake, max(now, next_start));
+    int wait_ms = duration_cast<milliseconds>(wake - now).count();
+
+    int ready = poll(fds.data(), fds.size(), wait_ms);
+    if (ready <= 0)
+      continue;
+
+    now = steady_clock::now();
+    for (size_t i = 0; i < fds.size(); i++)
+    {
+      if (fds[i].revents == 0)
+        continue;
+
+      ConnectAttempt &attempt = attempts[index[i]];
+      socklen_t len = sizeof(attempt.error);
+      getsockopt(attempt.fd, SOL_SOCKET, SO_ERROR, &attempt.error, &len);
+      attempt.finish = now;
+      attempt.done = true;
+
+      if (attempt.error == 0 && winner < 0)
+        winner = index[i];
+      else if (attempt.error != 0)
+      {
+        close(attempt.fd);
+        attempt.fd = -1;
+        next_start = now; // Do not wait out the delay after a failure
+      }
+    }
+  }
+
+  // Cancel every attempt that lost the race
+  for (size_t i = 0; i < attempts.size(); i++)
+  {
+    if ((int)i == winner || attempts[i].fd < 0)
+      continue;
+    close(attempts[i].fd);
+    attempts[i].fd = -1;
+  }
+
+  if (winner < 0)
+    return -1;
+
+  // The rest of the client uses blocking I/O
+  int sockfd = attempts[winner].fd;
+  int flags = fcntl(sockfd, F_GETFL, 0);
+  fcntl(sockfd, F_SETFL, flags & ~O_NONBLOCK);
+  return sockfd;
+}
+
+/**
+ * @brief Print which family won the connection race and how long each
+ * attempt took
+ * @param attempts Attempts made by happy_eyeballs()
+ */
+void print_attempts(vector<ConnectAttempt> &attempts)
+{
+  for (size_t i = 0; i < attempts.size(); i++)
+  {
+    ConnectAttempt &attempt = attempts[i];
+    string family = attempt.family == AF_INET6 ? "IPv6" : "IPv4";
+    std::cout << "Connect attempt " << family << " " << attempt.address;
+
+    if (!attempt.done)
+      std::cout << ": cancelled" << endl;
+    else if (attempt.error != 0)
+      std::cout << ": " << strerror(attempt.error) << " after "
+                << duration_cast<microseconds>(attempt.finish - attempt.start)
+                       .count()
+                << "µs" << endl;
+    else if (attempt.fd >= 0)
+      std::cout << ": connected in "
+                << duration_cast<microseconds>(attempt.finish - attempt.start)
+                       .count()
+                << "µs (winner)" << endl;
+    else
+      std::cout << ": connected in "
+                << duration_cast<microseconds>(attempt.finish - attempt.start)
+                       .count()
+                << "µs (too late)" << endl;
+  }
+}
+
+/**
+ * @brief Send one echo request
+ * @param fd Connected socket
+ * @param seq Sequence number of the request
+ * @param frame Frame buffer, payload already filled in
+ * @return false if the request could not be sent
+ */
+bool send_probe(int fd, int seq, vector<char> &frame)
+{
+  FrameHeader header;
+  header.length = frame.size() - FRAME_HEADER_LEN;
+  header.seq = seq;
+  header.timestamp = now_ns(); // Retrieve the current time
+  encode_header(frame.data(), header);
+  return write_full(fd, frame.data(), frame.size());
+}
+
+/**
+ * @brief Receive one echo reply
+ * @param fd Connected socket
+ * @param buffer Reply buffer, FRAME_HEADER_LEN + MAX_PAYLOAD bytes
+ * @param size Expected payload size
+ * @param header Filled with the header of the reply
+ * @return false if the reply timed out or was malformed
+ */
+bool read_reply(int fd, char *buffer, int size, FrameHeader &header)
+{
+  if (!read_full(fd, buffer, FRAME_HEADER_LEN))
+  {
+    std::cout << "Request timed out" << endl;
+    return false;
+  }
+  header = decode_header(buffer);
+  if (header.length != (uint32_t)size ||
+      !read_full(fd, buffer + FRAME_HEADER_LEN, header.length))
+  {
+    std::cout << "Malformed reply" << endl;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Open a connection, send one request, wait for the reply and close
+ *
+ * Without fast open the handshake is a blocking connect() and is timed on
+ * its own. With fast open the request is handed to sendto(MSG_FASTOPEN) so
+ * it rides in the SYN once the client holds a cookie for the server.
+ *
+ * @param peer Server address
+ * @param peerlen Length of the server address
+ * @param seq Sequence number of the request
+ * @param frame Request frame, payload already filled in
+ * @param reply Reply buffer, FRAME_HEADER_LEN + MAX_PAYLOAD bytes
+ * @param timeout Read timeout in microseconds
+ * @param fastopen Use TCP Fast Open
+ * @param nodelay Disable Nagle's algorithm
+ * @param timing Filled with the timings of the probe
+ * @return false if the probe failed
+ */
+bool probe_on_new_connection(struct sockaddr_storage &peer, socklen_t peerlen,
+                             int seq, vector<char> &frame, char *reply,
+                             int timeout, bool fastopen, bool nodelay,
+                             ProbeTiming &timing)
+{
+  auto start = steady_clock::now(); // Retrieve the current time
+  int fd = socket(peer.ss_family, SOCK_STREAM, 0);
+  if (fd < 0)
+    return false;
+  set_timeout(fd, timeout);
+  set_nodelay(fd, nodelay);
+  busy_poll.setup(fd);
+
+  bool ok;
+  if (fastopen)
+  {
+    FrameHeader header;
+    header.length = frame.size() - FRAME_HEADER_LEN;
+    header.seq = seq;
+    header.timestamp = now_ns();
+    encode_header(frame.data(), header);
+
+    // The SYN carries as much of the request as fits
+    ssize_t n = sendto(fd, frame.data(), frame.size(), MSG_FASTOPEN,
+                       (struct sockaddr *)&peer, peerlen);
+    timing.handshake =
+        duration_cast<microseconds>(steady_clock::now() - start).count();
+    ok = n >= 0 &&
+         write_full(fd, frame.data() + n, frame.size() - (size_t)n);
+  }
+  else
+  {
+    ok = connect(fd, (struct sockaddr *)&peer, peerlen) == 0;
+    timing.handshake =
+        duration_cast<microseconds>(steady_clock::now() - start).count();
+    ok = ok && send_probe(fd, seq, frame);
+  }
+
+  FrameHeader header;
+  ok = ok && read_reply(fd, reply, frame.size() - FRAME_HEADER_LEN, header);
+  if (ok)
+  {
+    timing.rtt = (now_ns() - header.timestamp) / 1000;
+    timing.total =
+        duration_cast<microseconds>(steady_clock::now() - start).count();
+
+    // Ask the kernel whether the data in the SYN was accepted
+    sample_tcp_info(fd, timing.info);
+    timing.fastopen = timing.info.tcpi_options & TCPI_OPT_SYN_DATA;
+  }
+
+  close(fd);
+  return ok;
+}
+
 int main(int argc, char *argv[])
 {
   int ch;
@@ -51,23 +648,45 @@ int main(int argc, char *argv[])
   int size = 32;         // Size of each packet
   int timeout = 5000000; // in microseconds
   int port = -1;         // Port number
+  int depth = 1;         // Requests in flight on the connection
+  bool connect_per_probe = false; // Open a new connection for every probe
+  bool fastopen = false;          // Use TCP Fast Open for new connections
+  bool nodelay = true;            // Disable Nagle's algorithm
   string hostname;
   int n;
-  struct hostent
-      *server; // Pointer to a structure of type hostent defined in netdb.h
+  Summary rtts;          // Request/response round trip times
+  Summary handshakes;    // Connection setup times
+  Summary totals;        // Handshake plus request/response times
+  int fastopen_hits = 0; // Probes whose request was carried in the SYN
+  TcpTelemetry telemetry; // TCP_INFO samples
+  vector<long> rtt_samples; // Every RTT, for the percentiles
+  long busy_poll_us = 0;    // Spin budget of a read, 0 for none
 
-  // Timeout
-  struct timeval tv;
-  tv.tv_sec = timeout;
-  tv.tv_usec = 0;
-
-  int min_rtt = INT_MAX, max_rtt = 0, avg_rtt = 0; // RTT variables
+  struct option long_options[] = {
+      {"connect-per-probe", no_argument, 0, 'C'},
+      {"fastopen", no_argument, 0, 'F'},
+      {"nagle", no_argument, 0, 'N'},
+      {"busy-poll", optional_argument, 0, 'B'},
+      {0, 0, 0, 0}};
 
   // Parse command line arguments
-  while ((ch = getopt(argc, argv, "i:n:l:h:p:v")) != -1)
+  while ((ch = getopt_long(argc, argv, "i:n:l:h:p:P:CFNv", long_options,
+                           NULL)) != -1)
   {
     switch (ch)
     {
+    case 'B':
+      busy_poll_us = optarg ? atol(optarg) : BUSY_POLL_US;
+      break;
+    case 'C':
+      connect_per_probe = true;
+      break;
+    case 'F':
+      fastopen = true;
+      break;
+    case 'N':
+      nodelay = false;
+      break;
     case 'i':
       interval = atoi(optarg);
       break;
@@ -79,11 +698,13 @@ int main(int argc, char *argv[])
       break;
     case 'h':
       hostname = optarg;
-      server = gethostbyname(hostname.c_str());
       break;
     case 'p':
       port = atoi(optarg);
       break;
+    case 'P':
+      depth = atoi(optarg);
+      break;
     case 'v':
       usage();
       break;
@@ -101,13 +722,29 @@ int main(int argc, char *argv[])
     cerr << "Please specify hostname -h" << endl;
     return -1;
   }
+  if (size < 0 || size > MAX_PAYLOAD || depth < 1)
+  {
+    cerr << "Packet size must be in [0, " << MAX_PAYLOAD
+         << "] and pipeline depth at least 1" << endl;
+    return -1;
+  }
+  if (fastopen && !connect_per_probe)
+  {
+    cerr << "Fast open only applies to --connect-per-probe" << endl;
+    return -1;
+  }
+  busy_poll = BusyPoll(busy_poll_us);
+  if (fastopen && !fastopen_enabled(1))
+    cerr << "Warning: net.ipv4.tcp_fastopen does not enable the client side"
+         << endl;
 
   int sockfd;
   struct in6_addr server_addr; // Server address
   struct addrinfo hints;       // Address information
-  struct addrinfo *result, *rp;
-  char send_message[size], recv_message[size]; // Send and receive buffers
-  FlowMonitor flow;                            // Flow monitor
+  struct addrinfo *result;
+  vector<char> send_message(FRAME_HEADER_LEN + size); // Request frame
+  char recv_message[FRAME_HEADER_LEN + MAX_PAYLOAD];  // Reply frame
+  FlowMonitor flow;                                   // Flow monitor
 
   memset(&hints, 0, sizeof(hints)); // Initialize hints
   hints.ai_family = AF_UNSPEC;      // Allow IPv4 or IPv6
@@ -134,87 +771,128 @@ int main(int argc, char *argv[])
                   &result); // Get address information
   assert(n == 0 && "getaddrinfo failed");
 
-  // Loop through all the results and connect to the first we can
-  for (rp = result; rp != NULL; rp = rp->ai_next)
-  {
-    // Create UDP socket
-    sockfd = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
-    if (sockfd == -1)
-      continue;
+  // Race connection attempts to all the results, see happy_eyeballs()
+  vector<ConnectAttempt> attempts;
+  sockfd = happy_eyeballs(result, timeout / 1000, attempts);
+  freeaddrinfo(result); // No longer needed
 
-    if (connect(sockfd, rp->ai_addr, rp->ai_addrlen) == 0)
-      break; /* Success */
+  print_attempts(attempts);
+  assert(sockfd >= 0 && "Could not connect");
 
-    close(sockfd);
-    sockfd = -1;
-  }
+  // Payload is the usual "Ping" text, zero padded or truncated to size
+  string message = "Ping";
+  memcpy(send_message.data() + FRAME_HEADER_LEN, message.c_str(),
+         min((size_t)size, message.size()));
 
-  freeaddrinfo(result); // No longer needed
-  assert(rp != NULL && "Could not connect");
-  assert(sockfd >= 0 && "Could not connect");
+  set_timeout(sockfd, timeout);
+  set_nodelay(sockfd, nodelay);
+  busy_poll.setup(sockfd);
 
   std::cout << "Pinging " << hostname << ":" << port << " with " << size
-            << " bytes of data:" << endl;
-
-  // Send and recieve echo messages
-  for (int i = 0; i < num_packets; i++)
-  {
-    auto start = high_resolution_clock::now(); // Retrieve the current time
+            << " bytes of data";
+  if (connect_per_probe)
+    std::cout << ", one connection per probe";
+  else if (depth > 1)
+    std::cout << ", " << depth << " requests in flight";
+  std::cout << ":" << endl;
 
-    // Convert message to char array and store it in buffer
-    string message = "Ping: " + to_string(i);
-    strcpy(send_message, message.c_str());
+  int next_seq = 0;                     // Sequence number of next request
+  auto run_start = steady_clock::now(); // Start of the whole run
+  auto run_end = run_start;             // Time the last reply arrived
+  double cpu_start = process_cpu_seconds();
+  double sleep_seconds = 0; // Time spent between probes, not measured
 
-    // Send echo packet
-    n = write(sockfd, send_message, strlen(send_message));
+  if (connect_per_probe)
+  {
+    // The first connection only picked the address; every probe below
+    // opens and closes a connection of its own
+    struct sockaddr_storage peer;
+    socklen_t peerlen = sizeof(peer);
+    getpeername(sockfd, (struct sockaddr *)&peer, &peerlen);
+    close(sockfd);
+    sockfd = -1;
 
-    // Check if the packet was sent successfully
-    if (n < 0)
+    for (int i = 0; i < num_packets; i++)
     {
-      std::cout << "Error in sending packet" << endl;
-      continue;
-    }
-    else
+      ProbeTiming timing;
       flow.txPackets++;
+      if (probe_on_new_connection(peer, peerlen, i, send_message,
+                                  recv_message, timeout, fastopen, nodelay,
+                                  timing))
+      {
+        flow.rxPackets++;
+        std::cout << "Reply from " << hostname << ":" << port << " seq=" << i
+                  << " bytes=" << size << " handshake=" << timing.handshake
+                  << "µs rtt=" << timing.rtt << "µs total=" << timing.total
+                  << "µs srtt=" << timing.info.tcpi_rtt << "µs"
+                  << (timing.fastopen ? " (fast open)" : "") << endl;
 
-    // Receive echo packet
-    n = read(sockfd, recv_message, sizeof(recv_message));
+        handshakes.add(timing.handshake);
+        rtts.add(timing.rtt);
+        rtt_samples.push_back(timing.rtt);
+        totals.add(timing.total);
+        fastopen_hits += timing.fastopen;
+        telemetry.new_connection();
+        telemetry.add(timing.info, timing.rtt);
+      }
 
-    // Check if the packet was received successfully
-    if (n < 0)
-    {
-      std::cout << "Packet " << i << " lost" << endl;
-      continue;
+      // Sleep for interval seconds
+      if (i + 1 < num_packets)
+        sleep_seconds += sleep_between_probes(interval);
     }
-    else
+  }
+  else
+  {
+    // Fill the pipeline, then send one new request for every reply
+    while (next_seq < num_packets && next_seq - flow.rxPackets < depth)
+      if (send_probe(sockfd, next_seq++, send_message))
+        flow.txPackets++;
+
+    while (flow.rxPackets < flow.txPackets)
     {
-      auto end = high_resolution_clock::now(); // Retrieve the current time
-      auto duration = duration_cast<microseconds>(
-          end - start); // Calculate the time difference
-
-      // Wait up to timeout for a reply from the server; if no reply is
-      // received, the client should assume and print that the packet was lost
-      if (duration.count() > timeout)
-        std::cout << "Request timed out" << endl;
-      else
-      {
-        flow.rxPackets++;
+      // Receive echo frame
+      FrameHeader header;
+      if (!read_reply(sockfd, recv_message, size, header))
+        break;
+
+      run_end = steady_clock::now();
+      long rtt = (now_ns() - header.timestamp) / 1000; // In microseconds
+      flow.rxPackets++;
+
+      struct tcp_info info; // Kernel view of the connection after the echo
+      bool sampled = sample_tcp_info(sockfd, info);
+
+      if (depth == 1)
         std::cout << "Reply from " << hostname << ":" << port
-                  << " bytes sent=" << size << " rtt=" << duration.count()
-                  << "µs" << endl;
+                  << " seq=" << header.seq << " bytes=" << header.length
+                  << " rtt=" << rtt << "µs srtt=" << info.tcpi_rtt
+                  << "µs cwnd=" << info.tcpi_snd_cwnd << endl;
 
-        // Calculate min, max and avg rtt
-        min_rtt = min(min_rtt, (int)duration.count());
-        max_rtt = max(max_rtt, (int)duration.count());
-        avg_rtt += (int)duration.count();
+      rtts.add(rtt); // Calculate min, max and avg rtt
+      rtt_samples.push_back(rtt);
+      if (sampled)
+        telemetry.add(info, rtt);
+
+      if (next_seq < num_packets)
+      {
+        // Sleep for interval seconds between single probes
+        if (depth == 1)
+          sleep_seconds += sleep_between_probes(interval);
+        if (send_probe(sockfd, next_seq++, send_message))
+          flow.txPackets++;
+        else
+          std::cout << "Error in sending packet" << endl;
       }
     }
-    // Sleep for interval seconds
-    sleep(interval);
   }
 
+  double cpu = process_cpu_seconds() - cpu_start;
+  double wall =
+      duration<double>(steady_clock::now() - run_start).count() - sleep_seconds;
+
   // Close socket
-  close(sockfd);
+  if (sockfd >= 0)
+    close(sockfd);
 
   // Display Ping statistics
   int num_lost_packets = flow.txPackets - flow.rxPackets;
@@ -229,9 +907,33 @@ int main(int argc, char *argv[])
             << "% loss)" << endl;
 
   std::cout << "Approximate round trip times in milli-seconds:" << endl;
-  std::cout << "\t";
-  std::cout << "Minimum = " << min_rtt << "µs, Maximum = " << max_rtt
-            << "µs, Average = " << avg_rtt / (float)flow.rxPackets << "µs"
-            << endl;
+  rtts.print("µs");
+  print_rtt_percentiles(rtt_samples);
+  busy_poll.report(cpu, wall, flow.txPackets);
+
+  if (telemetry.srtt.count > 0)
+    telemetry.print();
+
+  // Connection setup cost, and what fast open saved of it
+  if (connect_per_probe)
+  {
+    std::cout << "Handshake times:" << endl;
+    handshakes.print("µs");
+    std::cout << "Handshake plus round trip times:" << endl;
+    totals.print("µs");
+    if (fastopen)
+      std::cout << "\tFast open used by " << fastopen_hits << " of "
+                << flow.rxPackets << " probes" << endl;
+  }
+
+  // With a pipeline the interesting number is request/response throughput
+  if (!connect_per_probe && depth > 1)
+  {
+    double elapsed = duration<double>(run_end - run_start).count();
+    std::cout << "Throughput:" << endl;
+    std::cout << "\t";
+    std::cout << "Requests/s = " << flow.rxPackets / elapsed
+              << ", Elapsed = " << elapsed * 1000 << "ms" << endl;
+  }
   return 0;
 }
\ No newline at end of file
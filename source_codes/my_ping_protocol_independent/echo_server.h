@@ -0,0 +1,384 @@
+#ifndef ECHO_SERVER_H
+#define ECHO_SERVER_H
+
+#include <arpa/inet.h>
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <iostream>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#include "../common/busy_poll.h"
+#include "../common/timer_wheel.h"
+#include "frame.h"
+
+/**
+ * Connection state and the epoll engine of the TCP echo server.
+ *
+ * server.cpp runs epoll_echo() unless it serves with io_uring, whose
+ * engine shares the connection state and frame handling below.
+ * benchmarks/microbench.cpp runs the same loop on a thread to time a
+ * round trip through it.
+ */
+
+#define MAX_LINE 1024
+#define MAX_EVENTS 1024
+#define MAX_PENDING (1 << 20) // Max unsent bytes before a peer is dropped
+
+/**
+ * @brief State kept for every open client connection.
+ *
+ * The socket is non-blocking and registered edge-triggered, so every
+ * readable event must drain the socket until EAGAIN. Received bytes are
+ * collected in inbox until a whole frame is available; echoed frames that
+ * could not be written immediately are parked in pending and flushed on
+ * EPOLLOUT. The deadline is re-armed on every event: the idle timeout
+ * while nothing is buffered, the read timeout while a frame is half
+ * received or an echo half sent.
+ */
+struct Connection
+{
+  int fd;              // Client socket
+  std::string inbox;   // Received bytes of incomplete frames
+  std::string pending; // Echo bytes not yet written
+  Timer deadline;      // Idle or read deadline
+};
+
+/**
+ * @brief Server counters, printed on SIGINT and SIGTERM.
+ */
+struct ServerStats
+{
+  uint64_t accepted;  // Connections accepted
+  uint64_t closed;    // Connections closed, for any reason
+  uint64_t timed_out; // Connections closed because a deadline passed
+};
+
+static std::vector<int> expired;   // Connections whose deadline passed
+static uint64_t frames_echoed = 0; // By either engine
+
+/**
+ * @brief Display client's IP address and port number
+ * @param client_addr sockaddr struct
+ */
+inline void display_address(struct sockaddr *client_addr)
+{
+  void *addr;                    // IP address
+  char buffer[INET6_ADDRSTRLEN]; // Buffer for address conversion
+  in_port_t port;                // Port number
+
+  // Check if IP version is IPv4
+  if (client_addr->sa_family == AF_INET)
+  {
+    struct sockaddr_in *ipv4 =
+        (struct sockaddr_in *)client_addr; // Cast to IPv4 address
+    addr = &(ipv4->sin_addr);              // Get IP address
+    port = ntohs(ipv4->sin_port);          // Get port number
+  }
+  // Check if IP version is IPv6
+  else if (client_addr->sa_family == AF_INET6)
+  {
+    struct sockaddr_in6 *ipv6 =
+        (struct sockaddr_in6 *)client_addr; // Cast to IPv6 address
+    addr = &(ipv6->sin6_addr);              // Get IP address
+    port = ntohs(ipv6->sin6_port);          // Get port number
+  }
+  else
+  {
+    fprintf(stderr, "Unsupported address family\n"); // Error
+    return;
+  }
+
+  // Convert IP address to a string and print it
+  auto n = inet_ntop(client_addr->sa_family, addr, buffer, sizeof(buffer));
+  if (n == NULL)
+    std::cout << "Invalid Address" << std::endl;
+  else
+    std::cout << "Client Address: " << buffer << ":" << port << std::endl;
+}
+
+/**
+ * @brief Expire callback of a connection's deadline
+ *
+ * Only queues the connection: it is closed by the event loop once the
+ * wheel is done firing.
+ *
+ * @param timer Deadline of the connection
+ */
+inline void queue_expired(Timer *timer)
+{
+  expired.push_back(((Connection *)timer->data)->fd);
+}
+
+/**
+ * @brief Arm the deadline of a connection for its current state
+ * @param wheel Timer wheel of the event loop
+ * @param conn Client connection
+ * @param idle_timeout Seconds allowed between frames, 0 for no limit
+ * @param read_timeout Seconds allowed to finish a frame or an echo, 0 for
+ * no limit
+ */
+inline void set_deadline(TimerWheel &wheel, Connection &conn,
+                         int idle_timeout, int read_timeout)
+{
+  bool busy = !conn.inbox.empty() || !conn.pending.empty();
+  int timeout = busy ? read_timeout : idle_timeout;
+  if (timeout > 0)
+    wheel.schedule(conn.deadline, std::chrono::seconds(timeout));
+  else
+    wheel.cancel(conn.deadline);
+}
+
+/**
+ * @brief Close a client connection and forget its state
+ * @param epfd epoll instance
+ * @param wheel Timer wheel holding the connection's deadline
+ * @param connections Table of open connections
+ * @param fd Client socket to close
+ */
+inline void close_connection(int epfd, TimerWheel &wheel,
+                             std::unordered_map<int, Connection> &connections,
+                             int fd)
+{
+  auto it = connections.find(fd);
+  if (it == connections.end())
+    return;
+  wheel.cancel(it->second.deadline);
+  epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+  close(fd);
+  connections.erase(it);
+}
+
+/**
+ * @brief Write as much of the pending echo data as the socket accepts
+ * @param conn Client connection
+ * @return false if the connection failed and must be closed
+ */
+inline bool flush_pending(Connection &conn)
+{
+  size_t sent = 0;
+  while (sent < conn.pending.size())
+  {
+    ssize_t n = send(conn.fd, conn.pending.data() + sent,
+                     conn.pending.size() - sent, MSG_NOSIGNAL);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        break; // Resume on EPOLLOUT
+      return false;
+    }
+    sent += n;
+  }
+  conn.pending.erase(0, sent);
+  return true;
+}
+
+/**
+ * @brief Move every complete frame from the inbox to the echo buffer
+ * @param conn Client connection
+ * @param quiet Suppress printing of client messages
+ * @return false if the peer sent a malformed frame
+ */
+inline bool echo_frames(Connection &conn, bool quiet)
+{
+  size_t offset = 0;
+  while (conn.inbox.size() - offset >= FRAME_HEADER_LEN)
+  {
+    FrameHeader header = decode_header(conn.inbox.data() + offset);
+    if (header.length > MAX_PAYLOAD)
+      return false;
+
+    size_t frame_len = FRAME_HEADER_LEN + header.length;
+    if (conn.inbox.size() - offset < frame_len)
+      break; // Wait for the rest of the payload
+
+    if (!quiet)
+      std::cout << "Client's Message: seq=" << header.seq
+                << " length=" << header.length << std::endl;
+
+    // Send the frame back to the client unchanged
+    conn.pending.append(conn.inbox, offset, frame_len);
+    offset += frame_len;
+    frames_echoed++;
+  }
+  conn.inbox.erase(0, offset);
+  return true;
+}
+
+/**
+ * @brief Drain a readable socket and echo every complete frame back
+ * @param conn Client connection
+ * @param quiet Suppress printing of client messages
+ * @return false if the peer closed or the connection failed
+ */
+inline bool handle_readable(Connection &conn, bool quiet)
+{
+  char buffer[MAX_LINE]; // Buffer for echo string
+
+  while (1)
+  {
+    ssize_t n = read(conn.fd, buffer, sizeof(buffer));
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        break; // Socket drained
+      return false;
+    }
+    if (n == 0)
+      return false; // Peer closed the connection
+
+    conn.inbox.append(buffer, n);
+    if (!echo_frames(conn, quiet) || !flush_pending(conn))
+      return false;
+
+    // A peer that never reads its echoes is not allowed to grow the buffer
+    if (conn.pending.size() > MAX_PENDING)
+      return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Accept clients and echo their frames until stop is set
+ *
+ * stop is checked once per wakeup, so whoever sets it outside a signal
+ * handler should also wake the loop, e.g. by closing a connection.
+ *
+ * @param sockfd Non-blocking listening socket
+ * @param busy Spins before every blocking epoll_wait()
+ * @param wheel Connection deadlines
+ * @param stats Counters, updated as connections come and go
+ * @param idle_timeout Seconds allowed between frames, 0 for no limit
+ * @param read_timeout Seconds allowed to finish a frame or an echo, 0 for
+ * no limit
+ * @param quiet Do not print every connection and message
+ * @param stop Set to return
+ */
+inline void epoll_echo(int sockfd, BusyPoll &busy, TimerWheel &wheel,
+                       ServerStats &stats, int idle_timeout,
+                       int read_timeout, bool quiet,
+                       volatile sig_atomic_t &stop)
+{
+  // Create epoll instance and watch the listening socket
+  int epfd = epoll_create1(0);
+  assert((epfd >= 0) && "epoll_create1() failed");
+
+  struct epoll_event ev, events[MAX_EVENTS];
+  ev.events = EPOLLIN;
+  ev.data.fd = sockfd;
+  int n = epoll_ctl(epfd, EPOLL_CTL_ADD, sockfd, &ev);
+  assert((n >= 0) && "epoll_ctl() failed");
+
+  std::unordered_map<int, Connection> connections; // Open connections
+  socklen_t addrlen;                   // Length of client address
+  struct sockaddr_storage client_addr; // Client address
+
+  while (!stop)
+  {
+    // Sleep until the next deadline at the latest
+    int nready =
+        busy.epoll_wait(epfd, events, MAX_EVENTS, wheel.timeout_ms(), &stop);
+    if (nready < 0)
+    {
+      assert((errno == EINTR) && "epoll_wait() failed");
+      continue;
+    }
+
+    for (int i = 0; i < nready; i++)
+    {
+      int fd = events[i].data.fd;
+
+      // New connections on the listening socket
+      if (fd == sockfd)
+      {
+        while (1)
+        {
+          addrlen = sizeof(client_addr); // Length of client address
+          int newsockfd =
+              accept4(sockfd, (struct sockaddr *)&client_addr, &addrlen,
+                      SOCK_NONBLOCK); // Accept connection
+          if (newsockfd < 0)
+          {
+            // EAGAIN: backlog drained. EMFILE and friends: retry later
+            // instead of bringing the whole server down.
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+              perror("accept4()");
+            break;
+          }
+
+          if (!quiet)
+          {
+            printf("\nNew Connection from client ");
+            display_address(
+                (struct sockaddr *)&client_addr); // Display client address
+          }
+
+          ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+          ev.data.fd = newsockfd;
+          if (epoll_ctl(epfd, EPOLL_CTL_ADD, newsockfd, &ev) < 0)
+          {
+            close(newsockfd);
+            continue;
+          }
+          busy.setup(newsockfd);
+          Connection &conn = connections[newsockfd];
+          conn.fd = newsockfd;
+          conn.deadline.expire = queue_expired;
+          conn.deadline.data = &conn; // Map nodes never move
+          set_deadline(wheel, conn, idle_timeout, read_timeout);
+          stats.accepted++;
+        }
+        continue;
+      }
+
+      auto it = connections.find(fd);
+      if (it == connections.end())
+        continue;
+      Connection &conn = it->second;
+
+      bool alive = !(events[i].events & (EPOLLERR | EPOLLHUP));
+      if (alive && (events[i].events & EPOLLOUT))
+        alive = flush_pending(conn);
+      if (alive && (events[i].events & (EPOLLIN | EPOLLRDHUP)))
+        alive = handle_readable(conn, quiet);
+
+      if (alive)
+        set_deadline(wheel, conn, idle_timeout, read_timeout);
+      else
+      {
+        close_connection(epfd, wheel, connections, fd);
+        stats.closed++;
+      }
+    }
+
+    // Close the peers whose deadline passed
+    wheel.advance(TimerWheel::clock::now());
+    for (int fd : expired)
+    {
+      if (!quiet)
+        printf("Closing connection %d: deadline passed\n", fd);
+      close_connection(epfd, wheel, connections, fd);
+      stats.closed++;
+      stats.timed_out++;
+    }
+    expired.clear();
+  }
+
+  while (!connections.empty())
+    close_connection(epfd, wheel, connections, connections.begin()->first);
+  close(epfd);
+}
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <cstdint>
+#include <endian.h>
+#include <string.h>
+
+#define FRAME_HEADER_LEN 16     // Size of the encoded frame header
+#define MAX_PAYLOAD (64 * 1024) // Largest payload a peer may announce
+
+/**
+ * @brief Header of a ping frame.
+ *
+ * On the wire every message is a 16 byte header in network byte order
+ * followed by length bytes of payload:
+ *
+ *   | length (4) | seq (4) | timestamp (8) | payload (length) |
+ *
+ * The server echoes frames unchanged, so the client can match replies by
+ * seq and compute the RTT from the timestamp it put in the request.
+ */
+struct FrameHeader
+{
+  uint32_t length;    // Payload length in bytes
+  uint32_t seq;       // Sequence number chosen by the client
+  uint64_t timestamp; // Client send time in nanoseconds
+};
+
+/**
+ * @brief Encode a frame header into a buffer
+ * @param buffer Destination, at least FRAME_HEADER_LEN bytes
+ * @param header Header to encode
+ */
+inline void encode_header(char *buffer, const FrameHeader &header)
+{
+  uint32_t length = htobe32(header.length);
+  uint32_t seq = htobe32(header.seq);
+  uint64_t timestamp = htobe64(header.timestamp);
+
+  memcpy(buffer, &length, 4);
+  memcpy(buffer + 4, &seq, 4);
+  memcpy(buffer + 8, &timestamp, 8);
+}
+
+/**
+ * @brief Decode a frame header from a buffer
+ * @param buffer Source, at least FRAME_HEADER_LEN bytes
+ * @return Decoded header in host byte order
+ */
+inline FrameHeader decode_header(const char *buffer)
+{
+  uint32_t length, seq;
+  uint64_t timestamp;
+
+  memcpy(&length, buffer, 4);
+  memcpy(&seq, buffer + 4, 4);
+  memcpy(&timestamp, buffer + 8, 8);
+
+  FrameHeader header;
+  header.length = be32toh(length);
+  header.seq = be32toh(seq);
+  header.timestamp = be64toh(timestamp);
+  return header;
+}
+
+#endif
@@ -1,77 +1,458 @@
 #include <arpa/inet.h>
 #include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <fcntl.h>
+#include <fstream>
+#include <getopt.h>
 #include <iostream>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <string>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <unistd.h>
-#define MAX_LINE 1024
+#include <unordered_map>
+#include <vector>
+
+#include "../common/busy_poll.h"
+#include "../common/timer_wheel.h"
+#include "../common/uring.h"
+#include "echo_server.h"
+#include "frame.h"
+
+#define URING_ENTRIES 1024    // Submission queue entries of io_uring
+#define URING_BUFFERS 1024    // Provided receive buffers, a power of 2
+#define URING_BUFFER_LEN 4096 // Bytes per receive buffer
+#define URING_FILES 4096      // Registered file slots, listener included
+
+// Request kinds of the io_uring engine, in the high half of user_data
+enum UringOp
+{
+  OP_ACCEPT,
+  OP_RECV,
+  OP_SEND,
+  OP_CANCEL,
+  OP_CLOSE
+};
 
 using namespace std;
+using namespace std::chrono;
+
+static volatile sig_atomic_t stop = 0; // Set by SIGINT and SIGTERM
+
+/**
+ * @brief Usage function
+ *
+ * This is a helper function to print the usage of the program.
+ */
+void usage()
+{
+  cout << "Usage: ./server [ -t IDLE_TIMEOUT ] [ -r READ_TIMEOUT ] "
+          "[ -q QUIET ] [ -F, --fastopen QUEUE_LENGTH ] [ -u | -U ] "
+          "[ --busy-poll[=MICROSECONDS] ] PORT"
+       << endl
+       << "  -u  Serve with io_uring instead of epoll" << endl
+       << "  -U  Serve with io_uring and a kernel polling thread (SQPOLL)"
+       << endl
+       << "  --busy-poll  Spin on epoll before blocking (default budget "
+       << BUSY_POLL_US << "us)" << endl;
+  exit(0);
+}
+
+/**
+ * @brief Check that the kernel allows TCP Fast Open for a role
+ * @param flag 1 for the client side, 2 for the server side
+ * @return true if net.ipv4.tcp_fastopen has the flag set
+ */
+bool fastopen_enabled(int flag)
+{
+  ifstream sysctl("/proc/sys/net/ipv4/tcp_fastopen");
+  int value = 0;
+  sysctl >> value;
+  return (value & flag) != 0;
+}
+
+/**
+ * @brief Put a file descriptor into non-blocking mode
+ * @param fd File descriptor
+ */
+void set_nonblocking(int fd)
+{
+  int flags = fcntl(fd, F_GETFL, 0);
+  assert((flags >= 0) && "fcntl() failed");
+  int n = fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+  assert((n >= 0) && "fcntl() failed");
+}
+
+/**
+ * @brief Signal handler that asks the event loop to stop
+ * @param sig Signal number
+ */
+void request_stop(int sig)
+{
+  (void)sig;
+  stop = 1;
+}
 
 /**
- * @brief Display client's IP address and port number
- * @param client_addr sockaddr struct
+ * @brief State of a connection of the io_uring engine, in the slot of its
+ * registered file.
+ *
+ * A slot is only handed back to the kernel (closed) once its multishot
+ * recv and its send have both completed, so a late completion can never
+ * be taken for one of the next client in the same slot.
  */
-void display_address(struct sockaddr *client_addr)
+struct UringConnection
 {
-  void *addr;                    // IP address
-  char buffer[INET6_ADDRSTRLEN]; // Buffer for address conversion
-  in_port_t port;                // Port number
+  Connection conn; // Buffers and deadline, fd is the file slot
+  string outbox;   // Bytes of the send in flight
+  bool receiving;  // Multishot recv armed
+  bool sending;    // Send in flight
+  bool closing;    // Closing once recv and send have ended
+};
 
-  // Check if IP version is IPv4
-  if (client_addr->sa_family == AF_INET)
+/**
+ * @brief io_uring engine of the echo server, selected with -u or -U.
+ *
+ * One multishot accept installs every new client straight into the
+ * registered file table, and one multishot recv per client fills buffers
+ * from a provided buffer ring. Complete frames are echoed as in the epoll
+ * loop, with at most one send in flight per client so the stream stays in
+ * order. Deadlines use the same timer wheel, as the timeout of the wait.
+ */
+struct UringEngine
+{
+  Uring ring;                    // Submission and completion queues
+  BufferRing buffers;            // Receive buffers
+  vector<UringConnection> slots; // Clients, by registered file slot
+  TimerWheel &wheel;             // Connection deadlines
+  ServerStats &stats;            // Server counters
+  int idle_timeout;              // Seconds between frames, 0 for none
+  int read_timeout;              // Seconds to finish a frame or an echo
+  bool quiet;                    // Do not print every message
+  uint64_t receives;             // Receive completions with data
+  uint64_t sends;                // Send completions
+
+  UringEngine(int sockfd, bool sqpoll, TimerWheel &wheel, ServerStats &stats,
+              int idle_timeout, int read_timeout, bool quiet)
+      : ring(URING_ENTRIES, sqpoll),
+        buffers(ring, 0, URING_BUFFERS, URING_BUFFER_LEN),
+        slots(URING_FILES), wheel(wheel), stats(stats),
+        idle_timeout(idle_timeout), read_timeout(read_timeout), quiet(quiet),
+        receives(0), sends(0)
   {
-    struct sockaddr_in *ipv4 =
-        (struct sockaddr_in *)client_addr; // Cast to IPv4 address
-    addr = &(ipv4->sin_addr);              // Get IP address
-    port = ntohs(ipv4->sin_port);          // Get port number
+    // Slot 0 is the listening socket, the others are free for clients
+    vector<int> files(URING_FILES, -1);
+    files[0] = sockfd;
+    ring.register_files(files.data(), URING_FILES, 1);
+    arm_accept();
   }
-  // Check if IP version is IPv6
-  else if (client_addr->sa_family == AF_INET6)
+
+  /**
+   * @brief Re-arm a client's deadline; an echo in flight counts as busy
+   * @param c Client connection
+   */
+  void rearm(UringConnection &c)
   {
-    struct sockaddr_in6 *ipv6 =
-        (struct sockaddr_in6 *)client_addr; // Cast to IPv6 address
-    addr = &(ipv6->sin6_addr);              // Get IP address
-    port = ntohs(ipv6->sin6_port);          // Get port number
+    if (!c.outbox.empty() && read_timeout > 0)
+      wheel.schedule(c.conn.deadline, seconds(read_timeout));
+    else
+      set_deadline(wheel, c.conn, idle_timeout, read_timeout);
   }
-  else
-    fprintf(stderr, "Unsupported address family\n"); // Error
 
-  // Convert IP address to a string and print it
-  auto n = inet_ntop(client_addr->sa_family, addr, buffer, sizeof(buffer));
-  if (n == NULL)
-    cout << "Invalid Address" << endl;
-  else
-    cout << "Client Address: " << buffer << ":" << port << endl;
-}
+  void arm_accept()
+  {
+    io_uring_sqe *sqe = ring.get_sqe();
+    uring_prep(sqe, IORING_OP_ACCEPT, 0, NULL, 0, (uint64_t)OP_ACCEPT << 32);
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->file_index = IORING_FILE_INDEX_ALLOC;
+  }
+
+  void arm_recv(UringConnection &c)
+  {
+    io_uring_sqe *sqe = ring.get_sqe();
+    uring_prep(sqe, IORING_OP_RECV, c.conn.fd, NULL, 0,
+               ((uint64_t)OP_RECV << 32) | c.conn.fd);
+    sqe->flags = IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->buf_group = buffers.group;
+    c.receiving = true;
+  }
+
+  /**
+   * @brief Send the echoed frames if no send is in flight
+   * @param c Client connection
+   */
+  void send_pending(UringConnection &c)
+  {
+    if (c.sending || c.conn.pending.empty())
+      return;
+    c.outbox.swap(c.conn.pending);
+    c.conn.pending.clear();
+    send_outbox(c);
+  }
+
+  void send_outbox(UringConnection &c)
+  {
+    io_uring_sqe *sqe = ring.get_sqe();
+    uring_prep(sqe, IORING_OP_SEND, c.conn.fd, c.outbox.data(),
+               c.outbox.size(), ((uint64_t)OP_SEND << 32) | c.conn.fd);
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    c.sending = true;
+  }
+
+  /**
+   * @brief Stop a client: cancel its requests, close it once they ended
+   * @param c Client connection
+   */
+  void start_close(UringConnection &c)
+  {
+    if (c.closing)
+      return;
+    c.closing = true;
+    wheel.cancel(c.conn.deadline);
+    if (c.receiving || c.sending)
+    {
+      io_uring_sqe *sqe = ring.get_sqe();
+      uring_prep(sqe, IORING_OP_ASYNC_CANCEL, c.conn.fd, NULL, 0,
+                 (uint64_t)OP_CANCEL << 32);
+      sqe->cancel_flags = IORING_ASYNC_CANCEL_FD |
+                          IORING_ASYNC_CANCEL_FD_FIXED |
+                          IORING_ASYNC_CANCEL_ALL;
+    }
+    finish_close(c);
+  }
+
+  void finish_close(UringConnection &c)
+  {
+    if (!c.closing || c.receiving || c.sending)
+      return;
+    io_uring_sqe *sqe = ring.get_sqe();
+    uring_prep(sqe, IORING_OP_CLOSE, 0, NULL, 0,
+               ((uint64_t)OP_CLOSE << 32) | c.conn.fd);
+    sqe->file_index = c.conn.fd + 1;
+    c.closing = false; // Nothing may refer to the slot from here on
+    c.conn.inbox.clear();
+    c.conn.pending.clear();
+    c.outbox.clear();
+    stats.closed++;
+  }
+
+  void on_accept(const io_uring_cqe &cqe)
+  {
+    if (!(cqe.flags & IORING_CQE_F_MORE))
+      arm_accept();
+    if (cqe.res < 0)
+    {
+      perror_code("accept", cqe.res);
+      return;
+    }
+    UringConnection &c = slots[cqe.res];
+    c.conn.fd = cqe.res;
+    c.conn.deadline.expire = queue_expired;
+    c.conn.deadline.data = &c.conn;
+    c.sending = false;
+    c.closing = false;
+    stats.accepted++;
+    if (!quiet)
+      printf("\nNew Connection in file slot %d\n", c.conn.fd);
+    arm_recv(c);
+    rearm(c);
+  }
+
+  void on_recv(UringConnection &c, const io_uring_cqe &cqe)
+  {
+    int id = uring_buffer_id(cqe);
+    if (id >= 0)
+    {
+      if (cqe.res > 0)
+        c.conn.inbox.append(buffers.buffer(id), cqe.res);
+      buffers.recycle(id);
+    }
+    if (!(cqe.flags & IORING_CQE_F_MORE))
+      c.receiving = false;
+
+    if (c.closing)
+      finish_close(c);
+    else if (cqe.res == -ENOBUFS)
+      arm_recv(c); // Buffers are recycled as soon as they are copied
+    else if (cqe.res <= 0)
+      start_close(c); // Peer closed or the connection failed
+    else
+    {
+      receives++;
+      if (!echo_frames(c.conn, quiet) ||
+          c.conn.pending.size() > MAX_PENDING)
+      {
+        start_close(c);
+        return;
+      }
+      if (!c.receiving)
+        arm_recv(c);
+      send_pending(c);
+      rearm(c);
+    }
+  }
+
+  void on_send(UringConnection &c, const io_uring_cqe &cqe)
+  {
+    c.sending = false;
+    sends++;
+    if (c.closing)
+      finish_close(c);
+    else if (cqe.res < 0)
+      start_close(c);
+    else
+    {
+      c.outbox.erase(0, cqe.res);
+      if (!c.outbox.empty())
+        send_outbox(c); // Cut short, e.g. by a signal
+      else
+        send_pending(c);
+      rearm(c);
+    }
+  }
+
+  /**
+   * @brief Print a failed request's error
+   * @param what Request
+   * @param res Negative errno from the completion
+   */
+  static void perror_code(const char *what, int res)
+  {
+    fprintf(stderr, "%s(): %s\n", what, strerror(-res));
+  }
 
-// UDP echo server application
+  /**
+   * @brief Serve clients until stop is set
+   * @param stop Set by SIGINT and SIGTERM
+   */
+  void run(volatile sig_atomic_t &stop)
+  {
+    while (!stop)
+    {
+      ring.wait(wheel.timeout_ms());
+      ring.for_each_cqe([&](const io_uring_cqe &cqe) {
+        unsigned slot = cqe.user_data & 0xFFFFFFFF;
+        switch (cqe.user_data >> 32)
+        {
+        case OP_ACCEPT:
+          on_accept(cqe);
+          break;
+        case OP_RECV:
+          on_recv(slots[slot], cqe);
+          break;
+        case OP_SEND:
+          on_send(slots[slot], cqe);
+          break;
+        case OP_CLOSE:
+          if (cqe.res < 0)
+            perror_code("close", cqe.res);
+          break;
+        }
+      });
+
+      // Close the peers whose deadline passed
+      wheel.advance(TimerWheel::clock::now());
+      for (int slot : expired)
+      {
+        if (!quiet)
+          printf("Closing connection %d: deadline passed\n", slot);
+        stats.timed_out++;
+        start_close(slots[slot]);
+      }
+      expired.clear();
+    }
+    printf("\n%lu receives and %lu sends with %lu io_uring_enter() calls\n",
+           (unsigned long)receives, (unsigned long)sends,
+           (unsigned long)ring.enters);
+  }
+};
+
+// TCP echo server application
 int main(int argc, char *argv[])
 {
+  int ch;
+  int idle_timeout = 60; // In seconds, 0 disables reaping
+  int read_timeout = 10; // In seconds, for a started frame or echo
+  bool quiet = false;    // Do not print every message
+  int fastopen_qlen = 0; // Pending TCP Fast Open requests, 0 disables it
+  bool uring = false;    // Serve with io_uring
+  bool sqpoll = false;   // Let a kernel thread poll the io_uring
+  long busy_poll_us = 0; // Spin budget of epoll_wait(), 0 for none
+
+  struct option long_options[] = {{"fastopen", required_argument, 0, 'F'},
+                                  {"busy-poll", optional_argument, 0, 'B'},
+                                  {0, 0, 0, 0}};
+
+  // Parse command line arguments
+  while ((ch = getopt_long(argc, argv, "t:r:qF:uUv", long_options, NULL)) != -1)
+  {
+    switch (ch)
+    {
+    case 'B':
+      busy_poll_us = optarg ? atol(optarg) : BUSY_POLL_US;
+      break;
+    case 'F':
+      fastopen_qlen = atoi(optarg);
+      break;
+    case 't':
+      idle_timeout = atoi(optarg);
+      break;
+    case 'r':
+      read_timeout = atoi(optarg);
+      break;
+    case 'q':
+      quiet = true;
+      break;
+    case 'U':
+      sqpoll = true;
+      // Fall through
+    case 'u':
+      uring = true;
+      break;
+    case 'v':
+      usage();
+      break;
+    }
+  }
+
   // Check command line arguments
-  if (argc < 2)
+  if (optind >= argc)
   {
     fprintf(stderr, "ERROR, no port provided\n");
     exit(1);
   }
 
-  int port = atoi(argv[1]); // First arg: port number
+  if (uring && busy_poll_us > 0)
+  {
+    fprintf(stderr, "ERROR, --busy-poll only applies to the epoll engine\n");
+    exit(1);
+  }
+
+  int port = atoi(argv[optind]); // First positional arg: port number
 
   int sockfd;
-  socklen_t addrlen;                   // Length of client address
-  struct sockaddr_in6 server_addr;     // Server address
-  struct sockaddr_storage client_addr; // Client address
+  struct sockaddr_in6 server_addr; // Server address
   int n;
-  char buffer[MAX_LINE]; // Buffer for echo string
 
   // Create socket
   sockfd = socket(AF_INET6, SOCK_STREAM, 0);
   assert((sockfd >= 0) && "socket() failed");
 
+  // Accept IPv4 clients on the same socket and allow quick restarts
+  int off = 0, on = 1;
+  setsockopt(sockfd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+  setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
   // Initialize server address
   bzero((char *)&server_addr, sizeof(server_addr));
   server_addr.sin6_family = AF_INET6;
@@ -82,32 +463,54 @@ int main(int argc, char *argv[])
   n = bind(sockfd, (struct sockaddr *)&server_addr, sizeof(server_addr));
   assert((n >= 0) && "bind() failed");
 
-  listen(sockfd, 5); // Listen for client connection requests
-  printf("\nServer Started ...\n");
-
-  while (1)
+  // Let clients put their first request in the SYN
+  if (fastopen_qlen > 0)
   {
-    cout << "\n";
-    addrlen = sizeof(client_addr); // Length of client address
-    int newsockfd = accept(sockfd, (struct sockaddr *)&client_addr,
-                           &addrlen); // Accept connection
-    assert((newsockfd >= 0) && "accept() failed");
+    n = setsockopt(sockfd, IPPROTO_TCP, TCP_FASTOPEN, &fastopen_qlen,
+                   sizeof(fastopen_qlen));
+    assert((n >= 0) && "setsockopt(TCP_FASTOPEN) failed");
+    if (!fastopen_enabled(2))
+      cerr << "Warning: net.ipv4.tcp_fastopen does not enable the server "
+              "side, SYN data will be ignored"
+           << endl;
+  }
 
-    printf("\nNew Connection from client ");
-    display_address((struct sockaddr *)&client_addr); // Display client address
+  n = listen(sockfd, SOMAXCONN); // Listen for client connection requests
+  assert((n >= 0) && "listen() failed");
+  set_nonblocking(sockfd);
 
-    bzero(buffer, 256);
+  TimerWheel wheel(milliseconds(10));          // Connection deadlines
+  ServerStats stats = {0, 0, 0};
+  BusyPoll busy(busy_poll_us); // Spins before every blocking epoll_wait()
 
-    // Receive message from client
-    n = read(newsockfd, buffer, MAX_LINE);
-    assert((n >= 0) && "read() failed");
+  // Without SA_RESTART, so that epoll_wait() returns EINTR
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = request_stop;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
 
-    string message(buffer);
-    cout << "Client's Message: " << message << endl;
+  printf("\nServer Started ...\n");
+  double cpu_start = process_cpu_seconds();
+  auto run_start = steady_clock::now();
 
-    // Send message back to client
-    n = write(newsockfd, buffer, MAX_LINE);
-    assert((n >= 0) && "write() failed");
+  if (uring)
+  {
+    UringEngine engine(sockfd, sqpoll, wheel, stats, idle_timeout,
+                       read_timeout, quiet);
+    engine.run(stop);
   }
+  else
+    epoll_echo(sockfd, busy, wheel, stats, idle_timeout, read_timeout, quiet,
+               stop);
+
+  printf("\n%lu connections accepted, %lu closed, %lu of them by a "
+         "deadline\n",
+         (unsigned long)stats.accepted, (unsigned long)stats.closed,
+         (unsigned long)stats.timed_out);
+  if (!uring)
+    busy.report(process_cpu_seconds() - cpu_start,
+                duration<double>(steady_clock::now() - run_start).count(),
+                frames_echoed);
   return 0;
 }
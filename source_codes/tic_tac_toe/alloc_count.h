@@ -0,0 +1,78 @@
+#ifndef ALLOC_COUNT_H
+#define ALLOC_COUNT_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+/**
+ * Heap allocation counters for benchmarks and instrumented builds.
+ *
+ * Replaces the global operator new and delete of the program that
+ * includes it, so include it from exactly one translation unit: the
+ * benchmarks, and the server only when built with -DCOUNT_ALLOCATIONS.
+ * Aligned allocations, such as the slabs of slab.h, are counted too.
+ *
+ * The replacements are not inlined, or g++ pairs the malloc() inside them
+ * with the delete of a constructor that throws and warns
+ * (-Wmismatched-new-delete).
+ */
+
+static std::atomic<uint64_t> heap_allocations{0};     // By every thread
+static thread_local uint64_t thread_heap_allocations; // By this thread
+
+/**
+ * @brief Count one allocation
+ */
+inline void count_allocation()
+{
+  heap_allocations.fetch_add(1, std::memory_order_relaxed);
+  thread_heap_allocations++;
+}
+
+__attribute__((noinline)) void *operator new(size_t size)
+{
+  count_allocation();
+  void *p = malloc(size ? size : 1);
+  if (p == NULL)
+    throw std::bad_alloc();
+  return p;
+}
+
+__attribute__((noinline)) void *operator new(size_t size,
+                                             std::align_val_t align)
+{
+  count_allocation();
+  size_t alignment = (size_t)align;
+  // aligned_alloc() wants a whole number of alignments
+  void *p = aligned_alloc(alignment,
+                          (size + alignment - 1) / alignment * alignment);
+  if (p == NULL)
+    throw std::bad_alloc();
+  return p;
+}
+
+__attribute__((noinline)) void operator delete(void *p) noexcept
+{
+  free(p);
+}
+
+__attribute__((noinline)) void operator delete(void *p, size_t) noexcept
+{
+  free(p);
+}
+
+__attribute__((noinline)) void operator delete(void *p,
+                                               std::align_val_t) noexcept
+{
+  free(p);
+}
+
+__attribute__((noinline)) void operator delete(void *p, size_t,
+                                               std::align_val_t) noexcept
+{
+  free(p);
+}
+
+#endif
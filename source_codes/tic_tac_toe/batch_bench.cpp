@@ -0,0 +1,179 @@
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "batch_eval.h"
+#include "engine.h"
+#include "legacy.h"
+
+using namespace std;
+using namespace std::chrono;
+
+/**
+ * Throughput benchmark of the batch board evaluator.
+ *
+ * Builds a log of random game positions and evaluates all of them with the
+ * original vector<vector<int>> evaluate_board() one board at a time, then
+ * with every batch kernel this CPU can run. Prints boards/s for each and
+ * checks that all of them agree.
+ */
+
+/**
+ * @brief Logged positions, as the two mask arrays the batch API takes.
+ */
+struct PositionLog
+{
+  vector<uint16_t> client; // Client's cells of every board
+  vector<uint16_t> server; // Server's cells of every board
+};
+
+/**
+ * @brief Function to log random positions
+ *
+ * Each position is a game played with random moves, stopped after a random
+ * number of moves or at its first line, whichever comes first.
+ *
+ * @param n Number of positions
+ * @return The positions
+ */
+PositionLog random_positions(size_t n)
+{
+  mt19937 rng(12345);
+  PositionLog log;
+  log.client.resize(n);
+  log.server.resize(n);
+  for (size_t i = 0; i < n; i++)
+  {
+    Board board;
+    int moves = uniform_int_distribution<int>(0, 9)(rng);
+    for (int m = 0; m < moves && evaluate_board(board) == 0; m++)
+    {
+      uint16_t empty = empty_cells(board);
+      int skip = uniform_int_distribution<int>(
+          0, __builtin_popcount(empty) - 1)(rng);
+      while (skip-- > 0)
+        empty &= empty - 1;
+      make_move(board, __builtin_ctz(empty), m % 2 == 0 ? CLIENT : SERVER);
+    }
+    log.client[i] = board.cells[CLIENT];
+    log.server[i] = board.cells[SERVER];
+  }
+  return log;
+}
+
+/**
+ * @brief Evaluate the log one vector<vector<int>> board at a time
+ * @param log Positions to evaluate
+ * @param status Filled with the status of every board
+ * @return Seconds taken
+ */
+double bench_legacy(const PositionLog &log, vector<uint8_t> &status)
+{
+  // The boards are unpacked up front, as if they had been logged this way
+  size_t n = log.client.size();
+  vector<vector<vector<int>>> boards(n);
+  for (size_t i = 0; i < n; i++)
+  {
+    boards[i].assign(3, vector<int>(3, -1));
+    for (int cell = 0; cell < 9; cell++)
+    {
+      if (log.client[i] >> cell & 1)
+        boards[i][cell / 3][cell % 3] = CLIENT;
+      if (log.server[i] >> cell & 1)
+        boards[i][cell / 3][cell % 3] = SERVER;
+    }
+  }
+
+  auto start = steady_clock::now();
+  for (size_t i = 0; i < n; i++)
+  {
+    int score = legacy::evaluate_board(boards[i]);
+    if (score > 0)
+      status[i] = BOARD_SERVER_WON;
+    else if (score < 0)
+      status[i] = BOARD_CLIENT_WON;
+    else
+      status[i] = legacy::isMovesLeft(boards[i]) ? BOARD_ONGOING : BOARD_DRAW;
+  }
+  return duration<double>(steady_clock::now() - start).count();
+}
+
+/**
+ * @brief Evaluate the log with one batch kernel
+ * @param log Positions to evaluate
+ * @param kernel Kernel to run
+ * @param status Filled with the status of every board
+ * @param rounds Number of passes over the log
+ * @return Seconds taken by one pass
+ */
+double bench_kernel(const PositionLog &log, BatchKernel kernel,
+                    vector<uint8_t> &status, int rounds)
+{
+  auto start = steady_clock::now();
+  for (int r = 0; r < rounds; r++)
+    kernel(log.client.data(), log.server.data(), status.data(),
+           log.client.size());
+  return duration<double>(steady_clock::now() - start).count() / rounds;
+}
+
+/**
+ * @brief Print one line of the results table
+ * @param name Name of the implementation
+ * @param seconds Time of one pass
+ * @param n Boards in one pass
+ * @param base Time of one pass of the baseline
+ */
+void print_result(string name, double seconds, size_t n, double base)
+{
+  cout << setw(10) << name << setw(16) << fixed << setprecision(1)
+       << n / seconds / 1e6 << setw(12) << setprecision(1) << base / seconds
+       << "x" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+  size_t n = argc > 1 ? atol(argv[1]) : 1 << 22; // Logged positions
+  int rounds = argc > 2 ? atoi(argv[2]) : 20;    // Passes per kernel
+  PositionLog log = random_positions(n);
+
+  vector<uint8_t> expected(n), status(n);
+  double legacy_seconds = bench_legacy(log, expected);
+
+  struct
+  {
+    const char *name;
+    BatchKernel kernel;
+    bool supported;
+  } kernels[] = {
+      {"scalar", evaluate_batch_scalar, true},
+#ifdef BATCH_X86
+      {"sse4.1", evaluate_batch_sse4, __builtin_cpu_supports("sse4.1") > 0},
+      {"avx2", evaluate_batch_avx2, __builtin_cpu_supports("avx2") > 0},
+#endif
+  };
+
+  const char *chosen;
+  batch_kernel(&chosen);
+  cout << n << " positions, dispatch picks " << chosen << endl << endl;
+  cout << setw(10) << "Kernel" << setw(16) << "M boards/s" << setw(13)
+       << "Speedup" << endl;
+  print_result("vector", legacy_seconds, n, legacy_seconds);
+
+  for (auto &k : kernels)
+  {
+    if (!k.supported)
+      continue;
+    double seconds = bench_kernel(log, k.kernel, status, rounds);
+    print_result(k.name, seconds, n, legacy_seconds);
+    if (status != expected)
+    {
+      cerr << k.name << " disagrees with evaluate_board()" << endl;
+      return 1;
+    }
+  }
+  return 0;
+}
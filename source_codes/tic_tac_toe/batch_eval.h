@@ -0,0 +1,191 @@
+#ifndef BATCH_EVAL_H
+#define BATCH_EVAL_H
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BATCH_X86 1
+#endif
+
+#include "engine.h"
+
+/**
+ * Batch status of many 3x3 boards at once, for offline analysis of logged
+ * games.
+ *
+ * Boards are passed as two arrays of 9 bit masks (structure of arrays):
+ * client[i] and server[i] are the cells of board i, as in Board::cells.
+ * The status of every board is one of the BOARD_* values below, which are
+ * the same numbers as GameStatus in protocol.h. A board with lines of both
+ * players counts as a server win, the order evaluate_board() checks them.
+ *
+ * Besides the scalar loop there are SSE4.1 and AVX2 kernels that test 8
+ * and 16 boards per instruction. The widest one the CPU supports is picked
+ * at the first call.
+ */
+
+#define BOARD_ONGOING 0    // Empty cells left and no line
+#define BOARD_CLIENT_WON 1 // Client has three in a row
+#define BOARD_SERVER_WON 2 // Server has three in a row
+#define BOARD_DRAW 3       // Full board and no line
+
+// Rows, columns and diagonals, as in WinTable
+static const uint16_t board_lines[8] = {0007, 0070, 0700, 0111,
+                                        0222, 0444, 0421, 0124};
+
+/**
+ * @brief Function to get the status of one board
+ * @param client Mask of the client's cells
+ * @param server Mask of the server's cells
+ * @return BOARD_ONGOING, BOARD_CLIENT_WON, BOARD_SERVER_WON or BOARD_DRAW
+ */
+inline uint8_t board_status(uint16_t client, uint16_t server)
+{
+  if (win_table.wins[server & FULL_BOARD])
+    return BOARD_SERVER_WON;
+  if (win_table.wins[client & FULL_BOARD])
+    return BOARD_CLIENT_WON;
+  return (client | server) == FULL_BOARD ? BOARD_DRAW : BOARD_ONGOING;
+}
+
+/**
+ * @brief Scalar kernel, also used for the tail of the SIMD kernels
+ * @param client Masks of the client's cells
+ * @param server Masks of the server's cells
+ * @param status Filled with the status of every board
+ * @param n Number of boards
+ */
+inline void evaluate_batch_scalar(const uint16_t *client,
+                                  const uint16_t *server, uint8_t *status,
+                                  size_t n)
+{
+  for (size_t i = 0; i < n; i++)
+    status[i] = board_status(client[i], server[i]);
+}
+
+#ifdef BATCH_X86
+
+/**
+ * @brief SSE4.1 kernel: 8 boards in the 16 bit lanes of a register
+ */
+__attribute__((target("sse4.1"))) inline void
+evaluate_batch_sse4(const uint16_t *client, const uint16_t *server,
+                    uint8_t *status, size_t n)
+{
+  const __m128i full = _mm_set1_epi16(FULL_BOARD);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8)
+  {
+    __m128i c = _mm_loadu_si128((const __m128i *)(client + i));
+    __m128i s = _mm_loadu_si128((const __m128i *)(server + i));
+    __m128i c_won = _mm_setzero_si128(), s_won = _mm_setzero_si128();
+    for (int l = 0; l < 8; l++)
+    {
+      __m128i line = _mm_set1_epi16(board_lines[l]);
+      c_won = _mm_or_si128(
+          c_won, _mm_cmpeq_epi16(_mm_and_si128(c, line), line));
+      s_won = _mm_or_si128(
+          s_won, _mm_cmpeq_epi16(_mm_and_si128(s, line), line));
+    }
+    __m128i is_full =
+        _mm_cmpeq_epi16(_mm_and_si128(_mm_or_si128(c, s), full), full);
+
+    // Later blends win: draw, then client, then server
+    __m128i result = _mm_and_si128(is_full, _mm_set1_epi16(BOARD_DRAW));
+    result = _mm_blendv_epi8(result, _mm_set1_epi16(BOARD_CLIENT_WON), c_won);
+    result = _mm_blendv_epi8(result, _mm_set1_epi16(BOARD_SERVER_WON), s_won);
+    _mm_storel_epi64((__m128i *)(status + i),
+                     _mm_packus_epi16(result, result));
+  }
+  evaluate_batch_scalar(client + i, server + i, status + i, n - i);
+}
+
+/**
+ * @brief AVX2 kernel: 16 boards in the 16 bit lanes of a register
+ */
+__attribute__((target("avx2"))) inline void
+evaluate_batch_avx2(const uint16_t *client, const uint16_t *server,
+                    uint8_t *status, size_t n)
+{
+  const __m256i full = _mm256_set1_epi16(FULL_BOARD);
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16)
+  {
+    __m256i c = _mm256_loadu_si256((const __m256i *)(client + i));
+    __m256i s = _mm256_loadu_si256((const __m256i *)(server + i));
+    __m256i c_won = _mm256_setzero_si256(), s_won = _mm256_setzero_si256();
+    for (int l = 0; l < 8; l++)
+    {
+      __m256i line = _mm256_set1_epi16(board_lines[l]);
+      c_won = _mm256_or_si256(
+          c_won, _mm256_cmpeq_epi16(_mm256_and_si256(c, line), line));
+      s_won = _mm256_or_si256(
+          s_won, _mm256_cmpeq_epi16(_mm256_and_si256(s, line), line));
+    }
+    __m256i is_full = _mm256_cmpeq_epi16(
+        _mm256_and_si256(_mm256_or_si256(c, s), full), full);
+
+    __m256i result =
+        _mm256_and_si256(is_full, _mm256_set1_epi16(BOARD_DRAW));
+    result = _mm256_blendv_epi8(result, _mm256_set1_epi16(BOARD_CLIENT_WON),
+                                c_won);
+    result = _mm256_blendv_epi8(result, _mm256_set1_epi16(BOARD_SERVER_WON),
+                                s_won);
+    // Narrow to bytes; packus works per 128 bit half, so the two halves
+    // of each register are joined before the store
+    __m128i low = _mm256_castsi256_si128(result);
+    __m128i high = _mm256_extracti128_si256(result, 1);
+    _mm_storeu_si128((__m128i *)(status + i), _mm_packus_epi16(low, high));
+  }
+  evaluate_batch_scalar(client + i, server + i, status + i, n - i);
+}
+
+#endif
+
+typedef void (*BatchKernel)(const uint16_t *, const uint16_t *, uint8_t *,
+                            size_t);
+
+/**
+ * @brief Function to pick the widest kernel the CPU supports
+ * @param name Set to the kernel's name if not NULL
+ * @return The kernel
+ */
+inline BatchKernel batch_kernel(const char **name = NULL)
+{
+  BatchKernel kernel = evaluate_batch_scalar;
+  const char *kernel_name = "scalar";
+#ifdef BATCH_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+  {
+    kernel = evaluate_batch_avx2;
+    kernel_name = "avx2";
+  }
+  else if (__builtin_cpu_supports("sse4.1"))
+  {
+    kernel = evaluate_batch_sse4;
+    kernel_name = "sse4.1";
+  }
+#endif
+  if (name != NULL)
+    *name = kernel_name;
+  return kernel;
+}
+
+/**
+ * @brief Function to get the status of many boards
+ * @param client Masks of the client's cells, n of them
+ * @param server Masks of the server's cells, n of them
+ * @param status Filled with the status of every board, n of them
+ * @param n Number of boards
+ */
+inline void evaluate_batch(const uint16_t *client, const uint16_t *server,
+                           uint8_t *status, size_t n)
+{
+  static const BatchKernel kernel = batch_kernel();
+  kernel(client, server, status, n);
+}
+
+#endif
@@ -0,0 +1,225 @@
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include "engine.h"
+#include "legacy.h"
+#include "mnk.h"
+
+using namespace std;
+using namespace std::chrono;
+
+/**
+ * Benchmark of the Tic-Tac-Toe engine.
+ *
+ * Runs the full minimax search the server does for its first reply, once
+ * with the original vector<vector<int>> board (kept in legacy.h as the
+ * baseline) and once with the bitboard engine, and prints nodes per second
+ * for both. Then runs the same searches with alpha-beta, move ordering and
+ * the transposition table, which is what the server uses.
+ *
+ * Last, a fixed-depth search of a 15,15,5 position is run serially and on
+ * the work-stealing pool; both must choose the same move and score.
+ */
+
+/**
+ * @brief Result of one benchmark run.
+ */
+struct Result
+{
+  uint64_t nodes; // Boards visited
+  double seconds; // Wall clock time
+  int checksum;   // Sum of the chosen moves, keeps the work alive
+};
+
+/**
+ * @brief Search the server's reply to every first client move
+ * @param rounds Number of times to repeat the 9 searches
+ * @return Nodes, time and checksum of the run
+ */
+Result bench_legacy(int rounds)
+{
+  Result result = {0, 0, 0};
+  auto start = steady_clock::now();
+  for (int r = 0; r < rounds; r++)
+  {
+    for (int cell = 0; cell < 9; cell++)
+    {
+      vector<vector<int>> game_board{
+          {-1, -1, -1}, {-1, -1, -1}, {-1, -1, -1}};
+      game_board[cell / 3][cell % 3] = 0;
+      result.checksum += legacy::search_best_move(game_board, result.nodes);
+    }
+  }
+  result.seconds = duration<double>(steady_clock::now() - start).count();
+  return result;
+}
+
+/**
+ * @brief Full minimax search for the best move with the bitboard engine
+ * @param board The current state of the game.
+ * @param nodes Incremented once per visited board.
+ * @return The best cell for the Server.
+ */
+int full_best_move(Board &board, uint64_t &nodes)
+{
+  int best_val = -1000;
+  int best_move = -1;
+
+  for (uint16_t empty = empty_cells(board); empty; empty &= empty - 1)
+  {
+    int cell = __builtin_ctz(empty);
+    make_move(board, cell, SERVER);
+    int move_val = minimax_full(board, false, nodes);
+    unmake_move(board, cell, SERVER);
+    if (move_val > best_val)
+    {
+      best_move = cell;
+      best_val = move_val;
+    }
+  }
+  return best_move;
+}
+
+/**
+ * @brief Same searches as bench_legacy() with the bitboard engine
+ * @param rounds Number of times to repeat the 9 searches
+ * @return Nodes, time and checksum of the run
+ */
+Result bench_bitboard(int rounds)
+{
+  Result result = {0, 0, 0};
+  auto start = steady_clock::now();
+  for (int r = 0; r < rounds; r++)
+  {
+    for (int cell = 0; cell < 9; cell++)
+    {
+      Board board;
+      make_move(board, cell, CLIENT);
+      result.checksum += full_best_move(board, result.nodes);
+    }
+  }
+  result.seconds = duration<double>(steady_clock::now() - start).count();
+  return result;
+}
+
+/**
+ * @brief Same searches with alpha-beta and a transposition table
+ *
+ * Every round starts with an empty table, so the node count is that of
+ * answering the 9 possible first moves on a fresh server.
+ *
+ * @param rounds Number of times to repeat the 9 searches
+ * @return Nodes, time and checksum of the run
+ */
+Result bench_alpha_beta(int rounds)
+{
+  Result result = {0, 0, 0};
+  auto start = steady_clock::now();
+  for (int r = 0; r < rounds; r++)
+  {
+    Search *search = new Search();
+    for (int cell = 0; cell < 9; cell++)
+    {
+      Board board;
+      make_move(board, cell, CLIENT);
+      result.checksum += search_best_move(board, *search);
+    }
+    result.nodes += search->nodes;
+    delete search;
+  }
+  result.seconds = duration<double>(steady_clock::now() - start).count();
+  return result;
+}
+
+/**
+ * @brief Search a 15,15,5 middle game position to a fixed depth
+ * @param pool Threads to search on, NULL for the calling thread
+ * @param depth Moves to search
+ * @param rounds Number of times to repeat the search
+ * @return Nodes, time and checksum (move * 1000 + score) of the run
+ */
+Result bench_mnk(WorkStealingPool *pool, int depth, int rounds)
+{
+  static const int client_cells[] = {112, 113, 128};
+  static const int server_cells[] = {96, 98};
+  MnkGame game(15, 15, 5);
+  MnkBoard board(&game);
+  for (int cell : client_cells)
+    board.make_move(cell, CLIENT);
+  for (int cell : server_cells)
+    board.make_move(cell, SERVER);
+
+  Result result = {0, 0, 0};
+  auto start = steady_clock::now();
+  for (int r = 0; r < rounds; r++)
+  {
+    MnkSearchInfo info;
+    int move = mnk_best_move(board, SERVER, 1000000, &info, pool, depth);
+    result.nodes += info.nodes;
+    result.checksum = move * 1000 + info.score;
+  }
+  result.seconds = duration<double>(steady_clock::now() - start).count();
+  return result;
+}
+
+/**
+ * @brief Print one line of the results table
+ * @param name Name of the implementation
+ * @param result Result of the run
+ */
+void print_result(string name, Result &result)
+{
+  cout << setw(12) << name << setw(14) << result.nodes << setw(12) << fixed
+       << setprecision(1) << result.seconds * 1000 << " ms" << setw(14)
+       << setprecision(2) << result.nodes / result.seconds / 1e6 << " M/s"
+       << endl;
+}
+
+int main(int argc, char *argv[])
+{
+  int rounds = argc > 1 ? atoi(argv[1]) : 5; // Repetitions of each search
+
+  Result legacy_result = bench_legacy(rounds);
+  Result bitboard_result = bench_bitboard(rounds);
+  Result alpha_beta_result = bench_alpha_beta(rounds);
+
+  int threads = max(2u, thread::hardware_concurrency());
+  WorkStealingPool pool(threads);
+  int mnk_rounds = max(1, rounds / 10);
+  Result serial_result = bench_mnk(NULL, 5, mnk_rounds);
+  Result parallel_result = bench_mnk(&pool, 5, mnk_rounds);
+
+  cout << setw(12) << "Board" << setw(14) << "Nodes" << setw(15) << "Time"
+       << setw(18) << "Nodes/s" << endl;
+  print_result("vector", legacy_result);
+  print_result("bitboard", bitboard_result);
+  print_result("alpha-beta", alpha_beta_result);
+  print_result("15,15,5", serial_result);
+  print_result("parallel", parallel_result);
+
+  double speedup = (bitboard_result.nodes / bitboard_result.seconds) /
+                   (legacy_result.nodes / legacy_result.seconds);
+  cout << endl << "Bitboard speedup: " << setprecision(1) << speedup
+       << "x nodes/s" << endl;
+  cout << "Alpha-beta: " << alpha_beta_result.nodes / rounds
+       << " nodes per round instead of " << bitboard_result.nodes / rounds
+       << ", " << legacy_result.seconds / alpha_beta_result.seconds
+       << "x faster than the original search" << endl;
+  cout << "15,15,5 depth 5: " << serial_result.seconds / parallel_result.seconds
+       << "x speedup on " << threads << " threads" << endl;
+
+  // Both boards must pick the same replies
+  if (legacy_result.checksum != bitboard_result.checksum)
+  {
+    cerr << "Moves differ between the two boards" << endl;
+    return 1;
+  }
+  if (serial_result.checksum != parallel_result.checksum)
+  {
+    cerr << "Parallel search chose a different move" << endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,429 @@
+#ifndef BOT_H
+#define BOT_H
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <netinet/in.h>
+#include <queue>
+#include <random>
+#include <sstream>
+#include <stdlib.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <vector>
+
+#include "../common/latency_histogram.h"
+#include "engine.h"
+#include "protocol.h"
+#include "reactor.h"
+
+/**
+ * Headless load generator for the Tic-Tac-Toe server.
+ *
+ * Every bot is a coroutine on one epoll reactor that keeps a connection
+ * open and plays games on it: each frame carries one move of every game
+ * of the connection, and each answer is timed from the write of the frame
+ * to the last byte of the reply. Moves are random empty cells, or follow
+ * a script file with one game per line. Bots reconnect after a disconnect,
+ * so the offered load stays constant while the server saturates.
+ *
+ * Needs C++20 (g++ -std=c++20).
+ */
+
+#define RECONNECT_MS 100 // Pause before a bot reconnects
+
+using std::chrono::steady_clock;
+
+/**
+ * @brief Settings of a load test, set once from the command line.
+ */
+struct LoadConfig
+{
+  int connections; // Bots, one connection each
+  int games;       // Games played at once per connection
+  double rate;     // Frames per second per bot, 0 for as fast as answered
+  int seconds;     // Length of the run
+  unsigned seed;   // Seed of the random moves
+  std::vector<std::vector<int>> script; // Cells of scripted games, or empty
+};
+
+/**
+ * @brief Counters of a load test.
+ */
+struct LoadStats
+{
+  uint64_t games = 0;          // Games that ended in a win or a draw
+  uint64_t moves = 0;          // Moves answered by the server
+  uint64_t errors = 0;         // Refused moves and error frames
+  uint64_t disconnects = 0;    // Connections lost or refused
+  LatencyHistogram latency_us; // Response times of the frames
+};
+
+/**
+ * @brief Coroutine sleeps on one timerfd of the reactor.
+ */
+class Timers
+{
+public:
+  explicit Timers(Reactor &reactor) : reactor(reactor)
+  {
+    fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    assert((fd >= 0) && "timerfd_create() failed");
+    reactor.add(fd);
+    tick();
+  }
+
+  /**
+   * @brief Awaitable that resumes the coroutine at a given time.
+   */
+  struct Sleep
+  {
+    Timers *timers;
+    steady_clock::time_point due;
+
+    bool await_ready()
+    {
+      return due <= steady_clock::now();
+    }
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+      timers->sleepers.push({due, handle});
+      timers->arm();
+    }
+    void await_resume()
+    {
+    }
+  };
+
+  /**
+   * @brief co_await timers.until(due): resume at due or right after
+   */
+  Sleep until(steady_clock::time_point due)
+  {
+    return Sleep{this, due};
+  }
+
+private:
+  typedef std::pair<steady_clock::time_point, std::coroutine_handle<>>
+      Sleeper;
+
+  Reactor &reactor;
+  int fd; // timerfd set to the earliest sleeper
+  std::priority_queue<Sleeper, std::vector<Sleeper>, std::greater<Sleeper>>
+      sleepers;
+  steady_clock::time_point armed = steady_clock::time_point::max();
+
+  /**
+   * @brief Set the timerfd to the earliest sleeper if it is not already
+   */
+  void arm()
+  {
+    if (sleepers.empty() || sleepers.top().first >= armed)
+      return;
+    armed = sleepers.top().first;
+    struct itimerspec spec = {};
+    auto ns = armed.time_since_epoch().count();
+    spec.it_value.tv_sec = ns / 1000000000;
+    spec.it_value.tv_nsec = ns % 1000000000;
+    if (ns <= 0)
+      spec.it_value.tv_nsec = 1; // 0 would disarm the timer
+    int n = timerfd_settime(fd, TFD_TIMER_ABSTIME, &spec, NULL);
+    assert((n >= 0) && "timerfd_settime() failed");
+  }
+
+  /**
+   * @brief Resume the sleepers that are due every time the timerfd fires
+   */
+  Detached tick()
+  {
+    while (1)
+    {
+      co_await reactor.readable(fd);
+      uint64_t expirations;
+      if (::read(fd, &expirations, sizeof(expirations)) < 0)
+        continue; // Woken for an older deadline, still armed
+      armed = steady_clock::time_point::max();
+      while (!sleepers.empty() &&
+             sleepers.top().first <= steady_clock::now())
+      {
+        std::coroutine_handle<> handle = sleepers.top().second;
+        sleepers.pop();
+        handle.resume();
+      }
+      arm();
+    }
+  }
+};
+
+/**
+ * @brief One game a bot is playing.
+ */
+struct BotGame
+{
+  uint32_t id;               // Game ID sent to the server
+  std::vector<int8_t> cells; // -1 empty, CLIENT or SERVER
+  size_t script_line;        // Line of the script being followed
+  size_t script_pos;         // Next cell of that line
+};
+
+/**
+ * @brief Function to read a script of games
+ *
+ * Every line is one game: the client's cells in order, separated by
+ * spaces or commas. A cell that is taken when its turn comes is replaced
+ * with a random one.
+ *
+ * @param path File to read
+ * @return Cells of every game
+ */
+inline std::vector<std::vector<int>> read_script(const char *path)
+{
+  std::ifstream file(path);
+  assert(file && "cannot open the script");
+  std::vector<std::vector<int>> script;
+  std::string line;
+  while (getline(file, line))
+  {
+    replace(line.begin(), line.end(), ',', ' ');
+    std::istringstream cells(line);
+    std::vector<int> game;
+    int cell;
+    while (cells >> cell)
+      game.push_back(cell);
+    if (!game.empty())
+      script.push_back(game);
+  }
+  return script;
+}
+
+/**
+ * @brief Function to start a new game
+ * @param game Game to reset
+ * @param id Its new game ID
+ * @param size Cells of the board
+ * @param config The load test, for its script
+ */
+inline void bot_new_game(BotGame &game, uint32_t id, int size,
+                         const LoadConfig &config)
+{
+  game.id = id;
+  game.cells.assign(size, -1);
+  game.script_line = config.script.empty() ? 0 : id % config.script.size();
+  game.script_pos = 0;
+}
+
+/**
+ * @brief Function to choose the bot's next cell
+ * @param game Game to move in, with at least one empty cell
+ * @param config The load test, for its script
+ * @param rng Random numbers of the bot
+ * @return An empty cell
+ */
+inline int bot_pick_cell(BotGame &game, const LoadConfig &config,
+                         std::mt19937 &rng)
+{
+  int size = (int)game.cells.size();
+  if (!config.script.empty())
+  {
+    const std::vector<int> &line = config.script[game.script_line];
+    while (game.script_pos < line.size())
+    {
+      int cell = line[game.script_pos++];
+      if (cell >= 0 && cell < size && game.cells[cell] == -1)
+        return cell;
+    }
+  }
+  int cell = std::uniform_int_distribution<int>(0, size - 1)(rng);
+  while (game.cells[cell] != -1)
+    cell = (cell + 1) % size;
+  return cell;
+}
+
+/**
+ * @brief Bot that keeps a connection open and plays games on it
+ * @param reactor Reactor of the load test
+ * @param timers Sleeps of the load test
+ * @param address Server address
+ * @param config The load test
+ * @param stats Counters to update
+ * @param index Number of the bot, seeds its moves and game IDs
+ */
+inline Detached run_bot(Reactor &reactor, Timers &timers,
+                        const sockaddr_in &address, const LoadConfig &config,
+                        LoadStats &stats, int index)
+{
+  std::mt19937 rng(config.seed + index);
+  uint32_t next_id = (uint32_t)index * 1000000; // Unique across the bots
+  auto interval = std::chrono::nanoseconds(
+      config.rate > 0 ? (int64_t)(1e9 / config.rate) : 0);
+  std::vector<BotGame> games(config.games);
+  std::string hello, frame;
+  encode_header(hello, OP_HELLO, 0);
+  char header[FRAME_HEADER_LEN];
+  std::string records(config.games * RECORD_LEN, '\0');
+
+  while (1)
+  {
+    int sockfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    assert((sockfd >= 0) && "socket() failed");
+    int n = connect(sockfd, (const struct sockaddr *)&address,
+                    sizeof(address));
+    bool connecting = n == 0 || errno == EINPROGRESS;
+    reactor.add(sockfd);
+
+    // A write on a connecting socket waits for the handshake to finish
+    bool ok = connecting &&
+              co_await reactor.write(sockfd, hello.data(), hello.size()) &&
+              co_await reactor.read(sockfd, header, FRAME_HEADER_LEN);
+    FrameHeader answer = decode_header(header);
+    ok = ok && answer.opcode == OP_HELLO && answer.count == 1 &&
+         co_await reactor.read(sockfd, &records[0], RECORD_LEN);
+    int size = 0;
+    if (ok)
+    {
+      ShapeRecord shape = decode_shape(records.data());
+      size = shape.rows * shape.cols;
+      for (BotGame &game : games)
+        bot_new_game(game, next_id++, size, config);
+    }
+
+    auto due = steady_clock::now();
+    while (ok)
+    {
+      if (interval.count() > 0)
+      {
+        co_await timers.until(due);
+        // Never send a burst to catch up with a slow server
+        due = std::max(due + interval, steady_clock::now());
+      }
+
+      frame.clear();
+      encode_header(frame, OP_MOVE, config.games);
+      for (BotGame &game : games)
+      {
+        int cell = bot_pick_cell(game, config, rng);
+        game.cells[cell] = CLIENT;
+        encode_move(frame, MoveRecord{game.id, (uint16_t)cell, 0, 0});
+      }
+
+      auto sent = steady_clock::now();
+      ok = co_await reactor.write(sockfd, frame.data(), frame.size()) &&
+           co_await reactor.read(sockfd, header, FRAME_HEADER_LEN);
+      answer = decode_header(header);
+      if (ok && answer.opcode == OP_ERROR)
+      {
+        stats.errors++;
+        break;
+      }
+      ok = ok && answer.opcode == OP_MOVE &&
+           answer.count == config.games &&
+           co_await reactor.read(sockfd, &records[0], records.size());
+      if (!ok)
+        break;
+      stats.latency_us.add(
+          std::chrono::duration_cast<std::chrono::microseconds>(
+              steady_clock::now() - sent)
+              .count());
+
+      for (int i = 0; i < config.games; i++)
+      {
+        BotGame &game = games[i];
+        MoveRecord reply = decode_move(records.data() + i * RECORD_LEN);
+        if (reply.status >= ILLEGAL_MOVE)
+        {
+          stats.errors++; // Lost track of the board, start over
+          bot_new_game(game, next_id++, size, config);
+          continue;
+        }
+        stats.moves++;
+        if (reply.cell != NO_CELL && reply.cell < size)
+          game.cells[reply.cell] = SERVER;
+        if (reply.status != ONGOING)
+        {
+          stats.games++;
+          bot_new_game(game, next_id++, size, config);
+        }
+      }
+    }
+
+    if (!ok)
+      stats.disconnects++;
+    reactor.remove(sockfd);
+    close(sockfd);
+    co_await timers.until(steady_clock::now() +
+                          std::chrono::milliseconds(RECONNECT_MS));
+  }
+}
+
+/**
+ * @brief Print the progress of every second, then the summary, and exit
+ * @param timers Sleeps of the load test
+ * @param config The load test
+ * @param stats Counters of the bots
+ */
+inline Detached report_load(Timers &timers, const LoadConfig &config,
+                            LoadStats &stats)
+{
+  using namespace std;
+  auto start = steady_clock::now();
+  LoadStats last;
+  cout << setw(6) << "Second" << setw(12) << "Games/s" << setw(12)
+       << "Moves/s" << setw(10) << "Errors" << setw(13) << "Disconnects"
+       << endl;
+  for (int second = 1; second <= config.seconds; second++)
+  {
+    co_await timers.until(start + chrono::seconds(second));
+    cout << setw(6) << second << setw(12) << stats.games - last.games
+         << setw(12) << stats.moves - last.moves << setw(10)
+         << stats.errors - last.errors << setw(13)
+         << stats.disconnects - last.disconnects << endl;
+    last.games = stats.games;
+    last.moves = stats.moves;
+    last.errors = stats.errors;
+    last.disconnects = stats.disconnects;
+  }
+
+  double seconds = chrono::duration<double>(steady_clock::now() - start)
+                       .count();
+  cout << endl
+       << config.connections << " connections, " << config.games
+       << " games each, " << fixed << setprecision(1) << seconds << " s"
+       << endl
+       << setprecision(0) << stats.games / seconds << " games/s, "
+       << stats.moves / seconds << " moves/s, " << stats.errors
+       << " errors, " << stats.disconnects << " disconnects" << endl;
+
+  const LatencyHistogram &latency = stats.latency_us;
+  if (latency.count() > 0)
+    cout << "Move latency (us): p50 " << latency.percentile(0.5)
+         << ", p90 " << latency.percentile(0.9) << ", p99 "
+         << latency.percentile(0.99) << ", p99.9 "
+         << latency.percentile(0.999) << ", max " << latency.max() << endl;
+  exit(0);
+}
+
+/**
+ * @brief Run a load test against a server until config.seconds have passed
+ * @param address Server address
+ * @param config The load test
+ */
+inline void run_load(const sockaddr_in &address, const LoadConfig &config)
+{
+  Reactor reactor;
+  Timers timers(reactor);
+  LoadStats stats;
+  for (int i = 0; i < config.connections; i++)
+    run_bot(reactor, timers, address, config, stats, i);
+  report_load(timers, config, stats);
+  reactor.run();
+}
+
+#endif
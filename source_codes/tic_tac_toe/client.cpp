@@ -2,6 +2,7 @@
 #include <cassert>
 #include <chrono>
 #include <cstring>
+#include <getopt.h>
 #include <iostream>
 #include <netdb.h>
 #include <netinet/in.h>
@@ -12,10 +13,14 @@
 #include <unistd.h>
 #include <vector>
 
+#include "bot.h"
+#include "mnk.h"
+#include "protocol.h"
+
 using namespace std;
 
-vector<vector<int>> game_board{
-    {-1, -1, -1}, {-1, -1, -1}, {-1, -1, -1}}; // game board
+MnkGame *game;        // Board shape sent by the server
+MnkBoard *game_board; // game board
 
 /**
  * @brief Function to get the corresponding character for given integer
@@ -47,24 +52,24 @@ char get_char(int n)
  */
 void board()
 {
+  string separator;
+  for (int col = 0; col < game->cols; col++)
+    separator += col > 0 ? "|---" : "---";
+
   cout << endl;
-  cout << " " << get_char(game_board[0][0]) << " "
-       << "|"
-       << " " << get_char(game_board[0][1]) << " "
-       << "|"
-       << " " << get_char(game_board[0][2]) << " " << endl;
-  cout << "---|---|---" << endl;
-  cout << " " << get_char(game_board[1][0]) << " "
-       << "|"
-       << " " << get_char(game_board[1][1]) << " "
-       << "|"
-       << " " << get_char(game_board[1][2]) << " " << endl;
-  cout << "---|---|---" << endl;
-  cout << " " << get_char(game_board[2][0]) << " "
-       << "|"
-       << " " << get_char(game_board[2][1]) << " "
-       << "|"
-       << " " << get_char(game_board[2][2]) << " " << endl;
+  for (int row = 0; row < game->rows; row++)
+  {
+    if (row > 0)
+      cout << separator << endl;
+    for (int col = 0; col < game->cols; col++)
+    {
+      if (col > 0)
+        cout << "|";
+      cout << " " << get_char(game_board->cells[row * game->cols + col])
+           << " ";
+    }
+    cout << endl;
+  }
   cout << endl;
 }
 
@@ -74,56 +79,122 @@ void board()
  */
 bool check_win()
 {
-  pair<bool, int> ans(false, -1);
-  // Rows
-  for (int i = 0; i < 3; i++)
-    if (game_board[i][0] == game_board[i][1] &&
-        game_board[i][0] == game_board[i][2] && game_board[i][0] != -1)
-      ans = make_pair(true, game_board[i][0]);
-
-  // Columns
-  for (int j = 0; j < 3; j++)
-    if (game_board[0][j] == game_board[1][j] &&
-        game_board[0][j] == game_board[2][j] && game_board[0][j] != -1)
-      ans = make_pair(true, game_board[0][j]);
-
-  // Diagnols
-  if (game_board[0][0] == game_board[1][1] &&
-      game_board[1][1] == game_board[2][2] && game_board[0][0] != -1)
-    ans = make_pair(true, game_board[0][0]);
-
-  if (game_board[0][2] == game_board[1][1] &&
-      game_board[1][1] == game_board[2][0] && game_board[0][2] != -1)
-    ans = make_pair(true, game_board[0][2]);
-
-  if (ans.first == true)
+  if (game_board->winner != -1)
   {
-    string player = ans.second == 0 ? "Client" : "Server";
+    string player = game_board->winner == CLIENT ? "Client" : "Server";
     cout << player << " won!" << endl;
     return true;
   }
   return false;
 }
 
+/**
+ * @brief Function to read exactly len bytes
+ * @param sockfd The server socket
+ * @param buffer Destination
+ * @param len Bytes to read
+ * @return false if the server closed the connection first
+ */
+bool read_full(int sockfd, char *buffer, size_t len)
+{
+  size_t done = 0;
+  while (done < len)
+  {
+    ssize_t n = read(sockfd, buffer + done, len - done);
+    if (n <= 0)
+      return false;
+    done += n;
+  }
+  return true;
+}
+
+/**
+ * @brief Function to send a frame and receive the server's answer
+ * @param sockfd The server socket
+ * @param frame Encoded request
+ * @param records Filled with the records of the answer
+ * @return Header of the answer, opcode 0 if the connection failed
+ */
+FrameHeader request(int sockfd, const string &frame, string &records)
+{
+  FrameHeader header = {0, 0, 0};
+  char raw[FRAME_HEADER_LEN];
+  int n = write(sockfd, frame.data(), frame.size());
+  assert((n >= 0) && "write() failed");
+
+  if (!read_full(sockfd, raw, FRAME_HEADER_LEN))
+    return header;
+  FrameHeader answer = decode_header(raw);
+  records.resize(answer.count * RECORD_LEN);
+  if (answer.count > MAX_RECORDS ||
+      !read_full(sockfd, &records[0], records.size()))
+    return header;
+  return answer;
+}
+
+/**
+ * @brief Print usage of the client
+ * @param name Name of the program
+ */
+void usage(const char *name)
+{
+  fprintf(stderr,
+          "usage %s [-b CONNECTIONS] [-g GAMES] [-r RATE] [-d SECONDS] "
+          "[-f SCRIPT] [-S SEED] hostname port\n"
+          "  -b N  play as N bots instead of interactively\n"
+          "  -g N  games played at once on each bot connection (1)\n"
+          "  -r N  frames per second per bot, 0 as fast as answered (0)\n"
+          "  -d N  length of the bot run in seconds (10)\n"
+          "  -f F  play the games of a script, one game of cells per line\n"
+          "  -S N  seed of the random moves (1)\n",
+          name);
+  exit(0);
+}
+
 int main(int argc, char *argv[])
 {
-  int sockfd, port, n;
+  int sockfd, port, n, opt;
 
   struct sockaddr_in server_addr;
   struct hostent *server;
+  LoadConfig load = {0, 1, 0, 10, 1, {}};
 
-  if (argc < 3)
+  while ((opt = getopt(argc, argv, "b:g:r:d:f:S:")) != -1)
   {
-    fprintf(stderr, "usage %s hostname port\n", argv[0]);
-    exit(0);
+    switch (opt)
+    {
+    case 'b':
+      load.connections = atoi(optarg);
+      break;
+    case 'g':
+      load.games = atoi(optarg);
+      break;
+    case 'r':
+      load.rate = atof(optarg);
+      break;
+    case 'd':
+      load.seconds = atoi(optarg);
+      break;
+    case 'f':
+      load.script = read_script(optarg);
+      break;
+    case 'S':
+      load.seed = strtoul(optarg, NULL, 10);
+      break;
+    default:
+      usage(argv[0]);
+    }
   }
+  if (argc - optind < 2 || load.connections < 0 || load.games < 1 ||
+      load.games > MAX_RECORDS || load.rate < 0 || load.seconds < 1)
+    usage(argv[0]);
 
-  port = atoi(argv[2]); // Get port number
+  port = atoi(argv[optind + 1]); // Get port number
 
   // Create a TCP socket
   sockfd = socket(AF_INET, SOCK_STREAM, 0);
   assert((sockfd >= 0) && "socket() failed");
-  server = gethostbyname(argv[1]);
+  server = gethostbyname(argv[optind]);
   assert((server != NULL) && "gethostbyname() failed");
 
   // Initialize server address
@@ -133,13 +204,34 @@ int main(int argc, char *argv[])
         server->h_length);
   server_addr.sin_port = htons(port);
 
+  if (load.connections > 0)
+  {
+    close(sockfd);
+    run_load(server_addr, load); // Exits when the run is over
+  }
+
   // Connect to the server
   n = connect(sockfd, (struct sockaddr *)&server_addr, sizeof(server_addr));
   assert((n >= 0) && "connect() failed");
 
+  // Ask for the board shape: rows, columns and k
+  string frame, records;
+  encode_header(frame, OP_HELLO, 0);
+  FrameHeader answer = request(sockfd, frame, records);
+  assert((answer.opcode == OP_HELLO && answer.count == 1) &&
+         "handshake failed");
+  ShapeRecord shape = decode_shape(records.data());
+  assert((shape.rows > 0 && shape.cols > 0 && shape.k > 0 &&
+          shape.k <= MNK_MAX_K) && "bad board shape");
+  game = new MnkGame(shape.rows, shape.cols, shape.k);
+  game_board = new MnkBoard(game);
+  int last_cell = game->size() - 1;
+  if (game->size() > 9)
+    cout << shape.k << " in a row wins, cells are numbered 0 to "
+         << last_cell << " row by row" << endl;
+
+  const uint32_t game_id = 1; // The only game on this connection
   int num = -1;
-  int free_cells = 9;
-  vector<bool> chosen(9, false); // vector to keep track of chosen cells
 
   while (1)
   {
@@ -148,45 +240,36 @@ int main(int argc, char *argv[])
     cout << "Enter number: " << endl;
     cin >> num;
 
-    while (num < 0 || num > 8 || chosen[num] == true)
+    while (num < 0 || num > last_cell || game_board->cells[num] != -1)
     {
       cout << "Invalid number!" << endl;
       cin >> num;
     }
 
-    chosen[num] = true;
-    game_board[num / 3][num % 3] = 0; // Update game board for client's move
-    free_cells--;                     // Decrement free cells
+    game_board->make_move(num, CLIENT); // Update game board for client's move
 
-    // Check who won
-    if (check_win())
+    // Send the number to the server, even a winning one so it can close
+    // the game, and receive its answer
+    frame.clear();
+    encode_header(frame, OP_MOVE, 1);
+    encode_move(frame, MoveRecord{game_id, (uint16_t)num, 0, 0});
+    answer = request(sockfd, frame, records);
+    if (answer.opcode != OP_MOVE || answer.count != 1)
     {
-      board();
+      cout << "Connection to the server lost" << endl;
       break;
     }
-
-    // If free cells are zero and no one has won
-    // it means that the game is draw
-    if (free_cells == 0)
+    MoveRecord reply = decode_move(records.data());
+    if (reply.status >= ILLEGAL_MOVE)
     {
-      cout << "Draw!" << endl;
+      cout << "Server refused the move (status " << (int)reply.status << ")"
+           << endl;
       break;
     }
 
-    // Send the number to the server
-    n = write(sockfd, &num, sizeof(num));
-    assert((n >= 0) && "write() failed");
-
-    // Receive the number from the server
-    n = read(sockfd, &num, sizeof(num));
-    assert((n >= 0) && "read() failed");
-
-    if (num < 0 || num > 8)
-      break;
-
-    chosen[num] = true;
-    game_board[num / 3][num % 3] = 1; // Update game board for server's move
-    free_cells--;                     // Decrement free cells
+    // Update game board for server's move
+    if (reply.cell != NO_CELL && reply.cell <= last_cell)
+      game_board->make_move(reply.cell, SERVER);
 
     // Check who won
     if (check_win())
@@ -194,7 +277,10 @@ int main(int argc, char *argv[])
       board();
       break;
     }
-    if (free_cells == 0)
+
+    // If no cell is free and no one has won
+    // it means that the game is draw
+    if (reply.status == DRAW || !game_board->isMovesLeft())
     {
       cout << "Draw!" << endl;
       break;
@@ -202,4 +288,4 @@ int main(int argc, char *argv[])
   }
 
   return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,524 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <string.h>
+
+/**
+ * Bitboard Tic-Tac-Toe engine shared by the client and the server.
+ *
+ * Cells are numbered 0-8 row by row, as typed by the client. Each player
+ * owns a 9 bit mask with bit i set if it marked cell i. Player 0 is the
+ * client (O) and player 1 the server (X), the same values the old
+ * vector<vector<int>> board stored in its cells.
+ */
+
+#define CLIENT 0         // Client plays O
+#define SERVER 1         // Server plays X
+#define FULL_BOARD 0x1FF // All 9 cells marked
+
+/**
+ * @brief Structure for the game board, one bit mask per player.
+ */
+struct Board
+{
+  uint16_t cells[2]; // cells[player] has bit i set if player marked cell i
+  Board()
+  {
+    cells[CLIENT] = 0;
+    cells[SERVER] = 0;
+  }
+};
+
+/**
+ * @brief Lookup tables telling for each of the 512 masks whether it holds
+ * three in a row, and which cells would give it three in a row.
+ */
+struct WinTable
+{
+  bool wins[512];           // wins[mask] is true if mask holds a line
+  uint16_t win_cells[512];  // Cells that would complete a line for mask
+  WinTable()
+  {
+    // Rows, columns and diagonals
+    const uint16_t lines[8] = {0007, 0070, 0700, 0111,
+                               0222, 0444, 0421, 0124};
+    for (int mask = 0; mask < 512; mask++)
+    {
+      wins[mask] = false;
+      win_cells[mask] = 0;
+      for (int i = 0; i < 8; i++)
+      {
+        if ((mask & lines[i]) == lines[i])
+          wins[mask] = true;
+        // Two of the three cells taken, the third one completes the line
+        if (__builtin_popcount(mask & lines[i]) == 2)
+          win_cells[mask] |= lines[i] & ~mask;
+      }
+    }
+  }
+};
+
+static const WinTable win_table;
+
+/**
+ * @brief Function to check if a player has three in a row
+ * @param board The current state of the game.
+ * @param player CLIENT or SERVER
+ * @return true if the player won
+ */
+inline bool has_won(const Board &board, int player)
+{
+  return win_table.wins[board.cells[player]];
+}
+
+/**
+ * @brief Function to get who marked a cell
+ * @param board The current state of the game.
+ * @param cell Cell number 0-8
+ * @return CLIENT, SERVER or -1 if the cell is empty
+ */
+inline int cell_owner(const Board &board, int cell)
+{
+  if (board.cells[CLIENT] >> cell & 1)
+    return CLIENT;
+  if (board.cells[SERVER] >> cell & 1)
+    return SERVER;
+  return -1;
+}
+
+/**
+ * @brief Function to get the empty cells
+ * @param board The current state of the game.
+ * @return Mask with bit i set if cell i is empty
+ */
+inline uint16_t empty_cells(const Board &board)
+{
+  return ~(board.cells[CLIENT] | board.cells[SERVER]) & FULL_BOARD;
+}
+
+/**
+ * @brief Function to check if any cell is still empty
+ * @param board The current state of the game.
+ * @return true if a move can be made
+ */
+inline bool isMovesLeft(const Board &board)
+{
+  return empty_cells(board) != 0;
+}
+
+/**
+ * @brief Function to mark a cell
+ * @param board The current state of the game.
+ * @param cell Cell number 0-8
+ * @param player CLIENT or SERVER
+ */
+inline void make_move(Board &board, int cell, int player)
+{
+  board.cells[player] |= 1 << cell;
+}
+
+/**
+ * @brief Function to clear a cell marked by make_move()
+ * @param board The current state of the game.
+ * @param cell Cell number 0-8
+ * @param player CLIENT or SERVER
+ */
+inline void unmake_move(Board &board, int cell, int player)
+{
+  board.cells[player] &= ~(1 << cell);
+}
+
+/**
+ * @brief Function to score a board from the server's point of view
+ * @param board The current state of the game.
+ * @return +10 if the server won, -10 if the client won, 0 otherwise
+ */
+inline int evaluate_board(const Board &board)
+{
+  if (has_won(board, SERVER))
+    return +10;
+  if (has_won(board, CLIENT))
+    return -10;
+  return 0;
+}
+
+/**
+ * @brief Minimax search over the two masks of a board that is not won
+ *
+ * Only the player who moves can complete a line, so the winning children
+ * are found with one lookup in win_cells, and boards with one or two empty
+ * cells left are scored without recursing into them. Every board of the
+ * full tree is still counted in nodes.
+ *
+ * @tparam is_max true if the server moves next.
+ * @param mover Mask of the player who moves next.
+ * @param other Mask of the player who moved last.
+ * @param nodes Incremented once per visited board.
+ * @return Score of the board with perfect play from both sides.
+ */
+template <bool is_max>
+inline int minimax_node(uint16_t mover, uint16_t other, uint64_t &nodes)
+{
+  const int win = is_max ? +10 : -10;
+  uint64_t visited = 1; // Counted locally, one add to nodes per call
+
+  uint16_t empty = ~(mover | other) & FULL_BOARD;
+  if (empty == 0)
+  {
+    nodes += visited;
+    return 0;
+  }
+
+  // Children that complete a line are leaves, score them all at once
+  uint16_t wins = win_table.win_cells[mover] & empty;
+  for (uint16_t left = wins; left; left &= left - 1)
+    visited++;
+  int best = wins ? win : (is_max ? -1000 : 1000);
+
+  uint16_t rest = empty & ~wins; // Children that need a deeper look
+  uint16_t others = empty & (empty - 1);
+  if (others == 0)
+  {
+    // Last cell and no line: the child is a full board
+    if (rest)
+    {
+      visited++;
+      best = is_max ? std::max(best, 0) : std::min(best, 0);
+    }
+  }
+  else if ((others & (others - 1)) == 0)
+  {
+    // Two cells left: each child leaves the opponent one cell, which is
+    // either a win for it or a full board
+    for (uint16_t left = rest; left; left &= left - 1)
+    {
+      uint16_t last = empty ^ (left & -left);
+      visited += 2;
+      int score = win_table.wins[other | last] ? -win : 0;
+      best = is_max ? std::max(best, score) : std::min(best, score);
+    }
+  }
+  else
+  {
+    for (uint16_t left = rest; left; left &= left - 1)
+    {
+      uint16_t bit = left & -left;
+      int score = minimax_node<!is_max>(other, mover | bit, nodes);
+      best = is_max ? std::max(best, score) : std::min(best, score);
+    }
+  }
+  nodes += visited;
+  return best;
+}
+
+/**
+ * @brief Function to score a board with a full minimax search
+ *
+ * Visits the whole game tree with raw +10/-10 scores. The server plays with
+ * minimax() below; this one is kept as the reference for bench.cpp.
+ *
+ * @param board The current state of the game.
+ * @param is_max true if the server moves next.
+ * @param nodes Incremented once per visited board.
+ * @return Score of the board with perfect play from both sides.
+ */
+inline int minimax_full(const Board &board, bool is_max, uint64_t &nodes)
+{
+  // The caller's board may already hold a line of either player
+  int board_score = evaluate_board(board);
+  if (board_score != 0)
+  {
+    nodes++;
+    return board_score;
+  }
+  if (is_max)
+    return minimax_node<true>(board.cells[SERVER], board.cells[CLIENT], nodes);
+  return minimax_node<false>(board.cells[CLIENT], board.cells[SERVER], nodes);
+}
+
+/**
+ * @brief Tables used to hash boards independently of their orientation.
+ *
+ * A board has 8 symmetric copies (4 rotations, each optionally mirrored).
+ * symmetry[t][cell] is where cell lands under transform t, and a Zobrist
+ * key is drawn for every (player, cell) pair.
+ */
+struct ZobristTable
+{
+  uint8_t symmetry[8][9]; // Cell mapping of every transform
+  uint64_t keys[2][9];    // Zobrist key of each player on each cell
+  uint64_t server_turn;   // Mixed in when the server moves next
+  ZobristTable()
+  {
+    for (int t = 0; t < 8; t++)
+    {
+      for (int cell = 0; cell < 9; cell++)
+      {
+        int row = cell / 3, col = cell % 3;
+        for (int r = 0; r < t % 4; r++) // Rotate clockwise t % 4 times
+        {
+          int tmp = row;
+          row = col;
+          col = 2 - tmp;
+        }
+        if (t >= 4) // Mirror left to right
+          col = 2 - col;
+        symmetry[t][cell] = row * 3 + col;
+      }
+    }
+
+    // splitmix64, fixed seed so every run builds the same keys
+    uint64_t seed = 0x9E3779B97F4A7C15ULL;
+    for (int i = 0; i < 19; i++)
+    {
+      uint64_t z = (seed += 0x9E3779B97F4A7C15ULL);
+      z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+      z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+      z ^= z >> 31;
+      if (i < 18)
+        keys[i / 9][i % 9] = z;
+      else
+        server_turn = z;
+    }
+  }
+};
+
+static const ZobristTable zobrist;
+
+#define TT_SIZE (1 << 14) // Transposition table entries, a power of two
+#define TT_EXACT 0        // Stored score is exact
+#define TT_LOWER 1        // Stored score is a lower bound
+#define TT_UPPER 2        // Stored score is an upper bound
+
+// Center first, then corners, then edges: the cells that take part in the
+// most lines cause the earliest cut-offs
+static const int move_order[9] = {4, 0, 2, 6, 8, 1, 3, 5, 7};
+
+/**
+ * @brief Transposition table entry.
+ */
+struct TTEntry
+{
+  uint64_t key; // Canonical key of the board, 0 if the entry is empty
+  int8_t score; // Score, see Search::to_tt()
+  uint8_t flag; // TT_EXACT, TT_LOWER or TT_UPPER
+};
+
+/**
+ * @brief State of an alpha-beta search: the board hashes, the transposition
+ * table and the node counter.
+ *
+ * The 8 Zobrist hashes (one per symmetry) are updated on every move; the
+ * smallest of them is the same for all symmetric copies of a board, so
+ * they share one transposition table entry. A Search can be reused for
+ * many searches; it is not thread-safe.
+ */
+struct Search
+{
+  TTEntry table[TT_SIZE]; // Transposition table
+  uint64_t hash[8];       // Zobrist hash of the board under each symmetry
+  uint64_t nodes;         // Boards visited
+  Search() : nodes(0)
+  {
+    memset(table, 0, sizeof(table));
+  }
+
+  /**
+   * @brief Set the hashes to those of a board
+   * @param board Board the search starts from
+   */
+  void set_board(const Board &board)
+  {
+    memset(hash, 0, sizeof(hash));
+    for (int cell = 0; cell < 9; cell++)
+    {
+      int owner = cell_owner(board, cell);
+      if (owner != -1)
+        toggle(cell, owner);
+    }
+  }
+
+  /**
+   * @brief Add or remove a mark in all 8 hashes
+   * @param cell Cell number 0-8
+   * @param player CLIENT or SERVER
+   */
+  void toggle(int cell, int player)
+  {
+    for (int t = 0; t < 8; t++)
+      hash[t] ^= zobrist.keys[player][zobrist.symmetry[t][cell]];
+  }
+
+  /**
+   * @brief Canonical key of the current board
+   * @param is_max true if the server moves next.
+   * @return Key shared by all symmetric copies of the board, never 0
+   */
+  uint64_t key(bool is_max) const
+  {
+    uint64_t canonical = hash[0];
+    for (int t = 1; t < 8; t++)
+      canonical = std::min(canonical, hash[t]);
+    // The low bit tells a used entry from an empty one
+    return (canonical ^ (is_max ? zobrist.server_turn : 0)) | 1;
+  }
+
+  /**
+   * @brief Transposition table entry of a key
+   * @param key Key from key()
+   * @return Entry, indexed by bits above the low bit that is always set
+   */
+  TTEntry &entry(uint64_t key)
+  {
+    return table[(key >> 1) & (TT_SIZE - 1)];
+  }
+
+  /**
+   * @brief Make a win score independent of the depth it was found at
+   *
+   * Scores shrink by one per move so quicker wins are preferred; stored
+   * scores count the moves from the stored board instead of from the root.
+   *
+   * @param score Score relative to the root
+   * @param depth Depth of the board
+   * @return Score to store
+   */
+  static int to_tt(int score, int depth)
+  {
+    return score > 0 ? score + depth : score < 0 ? score - depth : 0;
+  }
+
+  /**
+   * @brief Inverse of to_tt()
+   * @param score Stored score
+   * @param depth Depth of the board
+   * @return Score relative to the root
+   */
+  static int from_tt(int score, int depth)
+  {
+    return score > 0 ? score - depth : score < 0 ? score + depth : 0;
+  }
+};
+
+/**
+ * @brief Function to score a board with alpha-beta search
+ *
+ * Wins are worth 10 minus the number of moves needed to reach them, so the
+ * server takes the quickest win and delays a loss. Children are tried
+ * center first, then corners, then edges, and boards already scored in
+ * any orientation are answered from the transposition table.
+ *
+ * @param search Search state, hashes must match the board.
+ * @param board The current state of the game, restored before returning.
+ * @param depth Number of moves made since the root.
+ * @param is_max true if the server moves next.
+ * @param alpha Score the server is already guaranteed.
+ * @param beta Score the client is already guaranteed.
+ * @return Score of the board with perfect play from both sides.
+ */
+inline int minimax(Search &search, Board &board, int depth, bool is_max,
+                   int alpha, int beta)
+{
+  search.nodes++;
+
+  // Only the player who moved last can have completed a line
+  if (has_won(board, is_max ? CLIENT : SERVER))
+    return is_max ? depth - 10 : 10 - depth;
+
+  uint16_t empty = empty_cells(board);
+  if (empty == 0)
+    return 0;
+
+  // Probe the transposition table
+  uint64_t key = search.key(is_max);
+  TTEntry &entry = search.entry(key);
+  if (entry.key == key)
+  {
+    int score = Search::from_tt(entry.score, depth);
+    if (entry.flag == TT_EXACT)
+      return score;
+    if (entry.flag == TT_LOWER)
+      alpha = std::max(alpha, score);
+    else
+      beta = std::min(beta, score);
+    if (alpha >= beta)
+      return score;
+  }
+
+  int alpha_start = alpha, beta_start = beta;
+  int player = is_max ? SERVER : CLIENT;
+  int best = is_max ? -1000 : 1000;
+
+  for (int i = 0; i < 9 && alpha < beta; i++)
+  {
+    int cell = move_order[i];
+    if (!(empty >> cell & 1))
+      continue;
+
+    make_move(board, cell, player);
+    search.toggle(cell, player);
+    int score = minimax(search, board, depth + 1, !is_max, alpha, beta);
+    search.toggle(cell, player);
+    unmake_move(board, cell, player);
+
+    if (is_max)
+    {
+      best = std::max(best, score);
+      alpha = std::max(alpha, best);
+    }
+    else
+    {
+      best = std::min(best, score);
+      beta = std::min(beta, best);
+    }
+  }
+
+  // Store the result with the kind of bound it is
+  entry.key = key;
+  entry.score = Search::to_tt(best, depth);
+  if (best <= alpha_start)
+    entry.flag = TT_UPPER;
+  else if (best >= beta_start)
+    entry.flag = TT_LOWER;
+  else
+    entry.flag = TT_EXACT;
+  return best;
+}
+
+/**
+ * @brief Function to search the best move for the Server.
+ * @param board The current state of the game.
+ * @param search Search state; its table may be reused between calls.
+ * @return The best cell for the Server, -1 if the board is full.
+ */
+inline int search_best_move(Board &board, Search &search)
+{
+  int best_val = -1000;
+  int best_move = -1;
+
+  search.set_board(board);
+  uint16_t empty = empty_cells(board);
+  for (int i = 0; i < 9; i++)
+  {
+    int cell = move_order[i];
+    if (!(empty >> cell & 1)) // Cell taken
+      continue;
+
+    make_move(board, cell, SERVER); // server makes move
+    search.toggle(cell, SERVER);
+    int move_val = minimax(search, board, 1, false, best_val, 1000);
+    search.toggle(cell, SERVER);
+    unmake_move(board, cell, SERVER); // Undo the move
+    if (move_val > best_val)
+    {
+      best_move = cell;
+      best_val = move_val;
+    }
+  }
+
+  return best_move;
+}
+
+#endif
@@ -0,0 +1,137 @@
+#ifndef LEGACY_H
+#define LEGACY_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+/**
+ * The original vector<vector<int>> Tic-Tac-Toe engine, -1 for an empty
+ * cell, 0 for the client and 1 for the server. The server no longer uses
+ * it; it is kept as the baseline of the benchmarks.
+ */
+
+namespace legacy
+{
+
+inline bool isMovesLeft(std::vector<std::vector<int>> &game_board)
+{
+  for (int i = 0; i < 3; i++)
+    for (int j = 0; j < 3; j++)
+      if (game_board[i][j] == -1)
+        return true;
+  return false;
+}
+
+inline int evaluate_board(std::vector<std::vector<int>> &game_board)
+{
+  // Rows
+  for (int i = 0; i < 3; i++)
+  {
+    if (game_board[i][0] == game_board[i][1] &&
+        game_board[i][1] == game_board[i][2])
+    {
+      if (game_board[i][0] == 1)
+        return +10;
+      else if (game_board[i][0] == 0)
+        return -10;
+    }
+  }
+
+  // Columns
+  for (int j = 0; j < 3; j++)
+  {
+    if (game_board[0][j] == game_board[1][j] &&
+        game_board[1][j] == game_board[2][j])
+    {
+      if (game_board[0][j] == 1)
+        return +10;
+
+      else if (game_board[0][j] == 0)
+        return -10;
+    }
+  }
+
+  // Diagnols
+  if (game_board[0][0] == game_board[1][1] &&
+      game_board[1][1] == game_board[2][2])
+  {
+    if (game_board[0][0] == 1)
+      return +10;
+    else if (game_board[0][0] == 0)
+      return -10;
+  }
+
+  if (game_board[0][2] == game_board[1][1] &&
+      game_board[1][1] == game_board[2][0])
+  {
+    if (game_board[0][2] == 1)
+      return +10;
+    else if (game_board[0][2] == 0)
+      return -10;
+  }
+
+  return 0;
+}
+
+inline int minimax(std::vector<std::vector<int>> &game_board, int depth,
+                   bool is_max, uint64_t &nodes)
+{
+  nodes++;
+  int board_score = evaluate_board(game_board);
+
+  if (board_score == 10)
+    return board_score;
+
+  if (board_score == -10)
+    return board_score;
+
+  if (isMovesLeft(game_board) == false)
+    return 0;
+
+  int best = is_max ? -1000 : 1000;
+  for (int i = 0; i < 3; i++)
+  {
+    for (int j = 0; j < 3; j++)
+    {
+      if (game_board[i][j] == -1)
+      {
+        game_board[i][j] = is_max ? 1 : 0;
+        int score = minimax(game_board, depth + 1, !is_max, nodes);
+        best = is_max ? std::max(best, score) : std::min(best, score);
+        game_board[i][j] = -1;
+      }
+    }
+  }
+  return best;
+}
+
+inline int search_best_move(std::vector<std::vector<int>> &game_board,
+                            uint64_t &nodes)
+{
+  int best_val = -1000;
+  int best_move = -1;
+
+  for (int i = 0; i < 3; i++)
+  {
+    for (int j = 0; j < 3; j++)
+    {
+      if (game_board[i][j] == -1)
+      {
+        game_board[i][j] = 1;
+        int move_val = minimax(game_board, 0, false, nodes);
+        game_board[i][j] = -1;
+        if (move_val > best_val)
+        {
+          best_move = i * 3 + j;
+          best_val = move_val;
+        }
+      }
+    }
+  }
+  return best_move;
+}
+
+} // namespace legacy
+
+#endif
@@ -0,0 +1,572 @@
+#ifndef MNK_H
+#define MNK_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <vector>
+
+#include "engine.h"
+#include "thread_pool.h"
+
+/**
+ * m,n,k-game engine: a board of m rows and n columns where k marks in a
+ * row, column or diagonal win. Tic-Tac-Toe is the 3,3,3 game; the server
+ * keeps using the perfect-play table for it and this engine for the rest.
+ *
+ * Cells are numbered row by row as on the 3x3 board and hold -1, CLIENT or
+ * SERVER. Every run of k cells (a "window") keeps a count of each player's
+ * marks, so a move updates the score and finds wins by touching only the
+ * windows through its cell.
+ */
+
+#define MNK_WIN 1000000 // Score of a won board, minus the moves to reach it
+#define MNK_MAX_K 16    // Longest supported winning line
+
+/**
+ * @brief Shape of an m,n,k game and the windows of its board. Built once
+ * and shared read-only by every board of that shape.
+ */
+struct MnkGame
+{
+  int rows;                             // m
+  int cols;                             // n
+  int k;                                // Marks in a row needed to win
+  int num_windows;                      // Runs of k cells on the board
+  std::vector<std::vector<int>> cell_windows; // Windows through each cell
+  std::vector<int> weight;              // Value of a window with c marks
+
+  MnkGame(int rows, int cols, int k)
+      : rows(rows), cols(cols), k(k), num_windows(0),
+        cell_windows(rows * cols), weight(k + 1)
+  {
+    // Right, down, down-right and down-left
+    const int dr[4] = {0, 1, 1, 1};
+    const int dc[4] = {1, 0, 1, -1};
+    for (int r = 0; r < rows; r++)
+    {
+      for (int c = 0; c < cols; c++)
+      {
+        for (int d = 0; d < 4; d++)
+        {
+          int end_r = r + dr[d] * (k - 1), end_c = c + dc[d] * (k - 1);
+          if (end_r < 0 || end_r >= rows || end_c < 0 || end_c >= cols)
+            continue;
+          for (int i = 0; i < k; i++)
+            cell_windows[(r + dr[d] * i) * cols + c + dc[d] * i].push_back(
+                num_windows);
+          num_windows++;
+        }
+      }
+    }
+
+    // Each extra mark in an open window is worth ten times more
+    weight[0] = 0;
+    for (int c = 1; c <= k; c++)
+      weight[c] = c == 1 ? 1 : std::min(weight[c - 1] * 10, MNK_WIN / 10);
+  }
+
+  int size() const
+  {
+    return rows * cols;
+  }
+};
+
+/**
+ * @brief Board of an m,n,k game with incrementally updated score.
+ */
+struct MnkBoard
+{
+  const MnkGame *game;
+  std::vector<int8_t> cells;     // -1 empty, CLIENT or SERVER
+  std::vector<uint8_t> count[2]; // Marks of each player in each window
+  int score;                     // Heuristic value, server's point of view
+  int moves;                     // Marks on the board
+  int winner;                    // -1 while nobody has k in a row
+
+  MnkBoard(const MnkGame *game)
+      : game(game), cells(game->size(), -1), score(0), moves(0), winner(-1)
+  {
+    count[CLIENT].assign(game->num_windows, 0);
+    count[SERVER].assign(game->num_windows, 0);
+  }
+
+  /**
+   * @brief Empty the board for a new game, keeping its memory
+   */
+  void clear()
+  {
+    std::fill(cells.begin(), cells.end(), -1);
+    std::fill(count[CLIENT].begin(), count[CLIENT].end(), 0);
+    std::fill(count[SERVER].begin(), count[SERVER].end(), 0);
+    score = moves = 0;
+    winner = -1;
+  }
+
+  /**
+   * @brief Value of one window from the server's point of view
+   * @param w Window index
+   * @return Weight of the marks if only one player has marks in it
+   */
+  int window_value(int w) const
+  {
+    int client = count[CLIENT][w], server = count[SERVER][w];
+    if (client > 0 && server > 0)
+      return 0; // Blocked, nobody can win here
+    return game->weight[server] - game->weight[client];
+  }
+
+  /**
+   * @brief Function to mark a cell
+   * @param cell Cell number
+   * @param player CLIENT or SERVER
+   */
+  void make_move(int cell, int player)
+  {
+    cells[cell] = player;
+    moves++;
+    for (int w : game->cell_windows[cell])
+    {
+      score -= window_value(w);
+      if (++count[player][w] == game->k)
+        winner = player;
+      score += window_value(w);
+    }
+  }
+
+  /**
+   * @brief Function to clear a cell marked by make_move(). The board must
+   * not have been won before that move.
+   * @param cell Cell number
+   * @param player CLIENT or SERVER
+   */
+  void unmake_move(int cell, int player)
+  {
+    cells[cell] = -1;
+    moves--;
+    winner = -1;
+    for (int w : game->cell_windows[cell])
+    {
+      score -= window_value(w);
+      count[player][w]--;
+      score += window_value(w);
+    }
+  }
+
+  /**
+   * @brief Function to check if any cell is still empty
+   * @return true if a move can be made
+   */
+  bool isMovesLeft() const
+  {
+    return moves < game->size();
+  }
+
+  /**
+   * @brief How much a move would change the score for the player making it
+   *
+   * Counts both what the move builds and what it blocks, which makes it a
+   * cheap ordering key.
+   *
+   * @param cell Empty cell
+   * @param player CLIENT or SERVER
+   * @return Gain of the move, from the player's point of view
+   */
+  int move_gain(int cell, int player) const
+  {
+    int gain = 0;
+    int other = 1 - player;
+    for (int w : game->cell_windows[cell])
+    {
+      int mine = count[player][w], theirs = count[other][w];
+      if (theirs == 0)
+        gain += game->weight[mine + 1] - game->weight[mine];
+      if (mine == 0)
+        gain += game->weight[theirs]; // Blocks the opponent's window
+    }
+    return gain;
+  }
+};
+
+/**
+ * @brief Statistics of one call to mnk_best_move().
+ */
+struct MnkSearchInfo
+{
+  int depth;      // Deepest iteration that completed
+  int score;      // Score of the chosen move for the side to move
+  uint64_t nodes; // Boards visited
+};
+
+/**
+ * @brief State shared by every thread working on one mnk_best_move().
+ */
+struct MnkShared
+{
+  std::chrono::steady_clock::time_point deadline; // Stop searching here
+  std::atomic<bool> aborted{false};               // Deadline was reached
+  std::atomic<uint64_t> nodes{0};                 // Boards visited
+  WorkStealingPool *pool;                         // NULL searches serially
+};
+
+/**
+ * @brief A node whose younger moves are searched in parallel.
+ */
+struct SplitPoint
+{
+  std::atomic<int> alpha;   // Best score so far, raised by every child
+  int beta;                 // Upper bound of the node
+  std::atomic<bool> cutoff; // A child reached beta, the rest is useless
+  const SplitPoint *parent; // Enclosing split point, NULL at the root
+};
+
+/**
+ * @brief State of one thread's part of a search.
+ */
+struct MnkSearch
+{
+  MnkShared *shared;
+  const SplitPoint *split; // Innermost split point above this search
+  uint64_t nodes;          // Boards visited, added to shared->nodes at the end
+
+  MnkSearch(MnkShared *shared, const SplitPoint *split)
+      : shared(shared), split(split), nodes(0)
+  {
+  }
+
+  /**
+   * @brief Check the clock every 1024 nodes, and the split points above
+   * @return true if the result of this search is no longer needed
+   */
+  bool stopped()
+  {
+    if ((nodes & 1023) == 0 &&
+        std::chrono::steady_clock::now() >= shared->deadline)
+      shared->aborted = true;
+    if (shared->aborted.load(std::memory_order_relaxed))
+      return true;
+    for (const SplitPoint *sp = split; sp != NULL; sp = sp->parent)
+      if (sp->cutoff.load(std::memory_order_relaxed))
+        return true;
+    return false;
+  }
+};
+
+#define MNK_SPLIT_DEPTH 3 // Only nodes this far from the leaves are split
+
+/**
+ * @brief Raise an atomic to at least a value
+ * @param target Atomic to raise
+ * @param value New lower bound
+ */
+inline void atomic_raise(std::atomic<int> &target, int value)
+{
+  int current = target.load();
+  while (current < value && !target.compare_exchange_weak(current, value))
+    ;
+}
+
+/**
+ * @brief Empty cells worth searching, best looking first
+ *
+ * Only cells next to a mark (at most two cells away) are considered, which
+ * keeps the branching factor small on large boards.
+ *
+ * @param board The current state of the game.
+ * @param player Player to move
+ * @return Candidate cells ordered by move_gain()
+ */
+inline std::vector<int> mnk_candidates(const MnkBoard &board, int player)
+{
+  const MnkGame *game = board.game;
+  std::vector<std::pair<int, int>> scored; // (-gain, cell)
+  int reach = game->k >= 4 ? 2 : 1;
+
+  for (int cell = 0; cell < game->size(); cell++)
+  {
+    if (board.cells[cell] != -1)
+      continue;
+    bool near = board.moves == 0;
+    int r = cell / game->cols, c = cell % game->cols;
+    for (int i = std::max(0, r - reach);
+         !near && i <= std::min(game->rows - 1, r + reach); i++)
+      for (int j = std::max(0, c - reach);
+           !near && j <= std::min(game->cols - 1, c + reach); j++)
+        near = board.cells[i * game->cols + j] != -1;
+    if (near)
+      scored.push_back(std::make_pair(-board.move_gain(cell, player), cell));
+  }
+
+  // An empty board: start in the middle
+  if (board.moves == 0)
+  {
+    scored.clear();
+    scored.push_back(
+        std::make_pair(0, (game->rows / 2) * game->cols + game->cols / 2));
+  }
+
+  std::sort(scored.begin(), scored.end());
+  std::vector<int> cells;
+  for (auto &entry : scored)
+    cells.push_back(entry.second);
+  return cells;
+}
+
+inline int mnk_split(MnkSearch &search, const MnkBoard &board, int player,
+                     int depth, int ply, int alpha, int beta, int best,
+                     const std::vector<int> &candidates);
+
+/**
+ * @brief Depth limited alpha-beta (negamax form) with heuristic leaves
+ *
+ * With a pool, nodes at least MNK_SPLIT_DEPTH from the leaves search their
+ * first move alone and then hand the other moves to the pool (Young
+ * Brothers Wait): once the eldest brother has set alpha, the younger ones
+ * are mostly refuted quickly and can be searched at the same time.
+ *
+ * @param search Search state.
+ * @param board The current state of the game, restored before returning.
+ * @param player Player to move.
+ * @param depth Moves left to search.
+ * @param ply Moves made since the root.
+ * @param alpha Lower bound for the player to move.
+ * @param beta Upper bound for the player to move.
+ * @return Score for the player to move; meaningless if search.stopped().
+ */
+inline int mnk_alpha_beta(MnkSearch &search, MnkBoard &board, int player,
+                          int depth, int ply, int alpha, int beta)
+{
+  search.nodes++;
+
+  // The previous move may have ended the game
+  if (board.winner != -1)
+    return board.winner == player ? MNK_WIN - ply : ply - MNK_WIN;
+  if (!board.isMovesLeft())
+    return 0;
+  if (depth == 0 || search.stopped())
+    return player == SERVER ? board.score : -board.score;
+
+  int best = -MNK_WIN - 1;
+  std::vector<int> candidates = mnk_candidates(board, player);
+  for (size_t i = 0; i < candidates.size(); i++)
+  {
+    if (i == 1 && search.shared->pool != NULL && depth >= MNK_SPLIT_DEPTH)
+      return mnk_split(search, board, player, depth, ply, alpha, beta, best,
+                       candidates);
+
+    int cell = candidates[i];
+    board.make_move(cell, player);
+    int score = -mnk_alpha_beta(search, board, 1 - player, depth - 1,
+                                ply + 1, -beta, -alpha);
+    board.unmake_move(cell, player);
+
+    if (search.stopped())
+      return best;
+    best = std::max(best, score);
+    alpha = std::max(alpha, score);
+    if (alpha >= beta)
+      break;
+  }
+  return best;
+}
+
+/**
+ * @brief Search all but the first candidate of a node in the pool
+ * @param search Search state of the calling thread.
+ * @param board The current state of the game, copied by every task.
+ * @param player Player to move.
+ * @param depth Moves left to search.
+ * @param ply Moves made since the root.
+ * @param alpha Lower bound for the player to move, after the first move.
+ * @param beta Upper bound for the player to move.
+ * @param best Score of the first move.
+ * @param candidates Moves of the node, the first one already searched.
+ * @return Score for the player to move; meaningless if search.stopped().
+ */
+inline int mnk_split(MnkSearch &search, const MnkBoard &board, int player,
+                     int depth, int ply, int alpha, int beta, int best,
+                     const std::vector<int> &candidates)
+{
+  SplitPoint split;
+  split.alpha = alpha;
+  split.beta = beta;
+  split.cutoff = false;
+  split.parent = search.split;
+  std::atomic<int> split_best(best);
+
+  TaskGroup group;
+  MnkShared *shared = search.shared;
+  for (size_t i = 1; i < candidates.size(); i++)
+  {
+    int cell = candidates[i];
+    shared->pool->submit(group, [&, cell] {
+      MnkSearch child(shared, &split);
+      if (child.stopped())
+        return;
+      MnkBoard local = board;
+      local.make_move(cell, player);
+      int score = -mnk_alpha_beta(child, local, 1 - player, depth - 1,
+                                  ply + 1, -beta, -split.alpha.load());
+      shared->nodes += child.nodes;
+      if (child.stopped())
+        return;
+      atomic_raise(split_best, score);
+      atomic_raise(split.alpha, score);
+      if (score >= beta)
+        split.cutoff = true;
+    });
+  }
+  shared->pool->wait(group);
+  return split_best.load();
+}
+
+/**
+ * @brief Best root move and its score.
+ */
+struct RootBest
+{
+  std::mutex lock;
+  int score; // Best score so far
+  int index; // Candidate index of the best move, -1 before the first
+};
+
+/**
+ * @brief Search one root move and merge it into the best so far
+ *
+ * The merge takes the highest score and, between equal scores, the lowest
+ * candidate index. Moves before the current best are searched with alpha
+ * one lower, so a move that ties with the best returns its exact score
+ * instead of a bound. The chosen move therefore does not depend on the
+ * order in which the threads finish.
+ *
+ * @param search Search state of the calling thread.
+ * @param board The current state of the game.
+ * @param player Player to move.
+ * @param depth Moves to search.
+ * @param candidates Root moves.
+ * @param index Candidate to search.
+ * @param best Best move so far, updated.
+ */
+inline void mnk_search_root_move(MnkSearch &search, MnkBoard &board,
+                                 int player, int depth,
+                                 const std::vector<int> &candidates,
+                                 int index, RootBest &best)
+{
+  int alpha;
+  {
+    std::lock_guard<std::mutex> guard(best.lock);
+    alpha = best.index < 0       ? -MNK_WIN - 1
+            : index < best.index ? best.score - 1
+                                 : best.score;
+  }
+
+  int cell = candidates[index];
+  board.make_move(cell, player);
+  int score = -mnk_alpha_beta(search, board, 1 - player, depth - 1, 1,
+                              -MNK_WIN - 1, -alpha);
+  board.unmake_move(cell, player);
+  if (search.stopped())
+    return;
+
+  std::lock_guard<std::mutex> guard(best.lock);
+  if (best.index < 0 || score > best.score ||
+      (score == best.score && index < best.index))
+  {
+    best.score = score;
+    best.index = index;
+  }
+}
+
+/**
+ * @brief Function to get the best move within a time budget
+ *
+ * Iterative deepening: searches 1, 2, 3, ... moves ahead until the
+ * deadline, always trying the previous iteration's best move first. The
+ * move of the deepest completed iteration is returned, so a move is
+ * available as soon as depth 1 is done, however short the budget.
+ *
+ * With a pool, the first root move is searched alone and the others are
+ * queued on the pool. The calling thread sleeps until they are done, so
+ * many games can share one pool without oversubscribing the cores.
+ *
+ * @param board The current state of the game.
+ * @param player Player to move
+ * @param budget_ms Time budget in milliseconds
+ * @param info If not NULL, filled with search statistics
+ * @param pool Threads to search on, NULL to search on the calling thread
+ * @param max_depth If above 0, stop after this depth
+ * @return Cell to play, -1 if the board is full
+ */
+inline int mnk_best_move(MnkBoard &board, int player, int budget_ms,
+                         MnkSearchInfo *info = NULL,
+                         WorkStealingPool *pool = NULL, int max_depth = 0)
+{
+  MnkShared shared;
+  shared.deadline =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(budget_ms);
+  shared.pool = pool;
+  MnkSearch search(&shared, NULL);
+
+  std::vector<int> candidates = mnk_candidates(board, player);
+  int best_move = candidates.empty() ? -1 : candidates[0];
+  int best_score = 0, depth_done = 0;
+  if (max_depth <= 0 || max_depth > board.game->size() - board.moves)
+    max_depth = board.game->size() - board.moves;
+
+  for (int depth = 1; depth <= max_depth && !search.stopped(); depth++)
+  {
+    RootBest best;
+    best.index = -1;
+    best.score = 0;
+
+    // The eldest brother sets alpha for the others
+    mnk_search_root_move(search, board, player, depth, candidates, 0, best);
+
+    if (pool == NULL || depth < MNK_SPLIT_DEPTH)
+    {
+      for (size_t i = 1; i < candidates.size() && !search.stopped(); i++)
+        mnk_search_root_move(search, board, player, depth, candidates, i,
+                             best);
+    }
+    else
+    {
+      TaskGroup group;
+      for (size_t i = 1; i < candidates.size(); i++)
+        pool->submit(group, [&, i] {
+          MnkSearch child(&shared, NULL);
+          MnkBoard local = board;
+          mnk_search_root_move(child, local, player, depth, candidates, i,
+                               best);
+          shared.nodes += child.nodes;
+        });
+      pool->wait(group);
+    }
+    if (search.stopped() || best.index < 0)
+      break;
+
+    best_move = candidates[best.index];
+    best_score = best.score;
+    depth_done = depth;
+
+    // A forced result will not change with more depth
+    if (std::abs(best_score) >= MNK_WIN - board.game->size())
+      break;
+
+    // Search the best move first in the next iteration
+    candidates.erase(candidates.begin() + best.index);
+    candidates.insert(candidates.begin(), best_move);
+  }
+
+  if (info != NULL)
+  {
+    info->depth = depth_done;
+    info->score = best_score;
+    info->nodes = shared.nodes + search.nodes;
+  }
+  return best_move;
+}
+
+#endif
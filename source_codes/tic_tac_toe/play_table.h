@@ -0,0 +1,106 @@
+#ifndef PLAY_TABLE_H
+#define PLAY_TABLE_H
+
+#include <string.h>
+#include <vector>
+
+#include "engine.h"
+
+/**
+ * Perfect-play table of the classic 3x3 game: the server's best reply to
+ * every reachable board, solved once at startup so that every move of a
+ * game is a lookup.
+ */
+
+#define NUM_POSITIONS 19683 // 3^9 ways to fill the board
+
+// Perfect-play table: the server's best cell for every board on which the
+// server moves next, -1 for all other boards. See build_play_table().
+static int8_t best_reply[NUM_POSITIONS];
+
+/**
+ * @brief Function to number a board.
+ *
+ * Every cell is a base 3 digit (0 empty, 1 client, 2 server) with cell 0 as
+ * the least significant one, so the 3^9 boards map to 0..NUM_POSITIONS-1.
+ *
+ * @param board The current state of the game.
+ * @return Index of the board in the perfect-play table.
+ */
+inline int encode_board(const Board &board)
+{
+  int code = 0;
+  for (int cell = 8; cell >= 0; cell--)
+    code = code * 3 + cell_owner(board, cell) + 1;
+  return code;
+}
+
+/**
+ * @brief Fill the perfect-play table for a board and every board after it.
+ * @param board Board to start from, restored before returning.
+ * @param client_turn true if the client moves next.
+ * @param visited Boards already handled.
+ * @param search Search state shared by all the searches.
+ */
+inline void fill_play_table(Board &board, bool client_turn,
+                            std::vector<bool> &visited, Search &search)
+{
+  int code = encode_board(board);
+  if (visited[code])
+    return;
+  visited[code] = true;
+
+  // Nothing to play once somebody won or the board is full
+  if (evaluate_board(board) != 0 || !isMovesLeft(board))
+    return;
+
+  if (!client_turn)
+    best_reply[code] = search_best_move(board, search);
+
+  // Follow every legal move, a client may play any empty cell
+  int player = client_turn ? CLIENT : SERVER;
+  for (uint16_t empty = empty_cells(board); empty; empty &= empty - 1)
+  {
+    int cell = __builtin_ctz(empty);
+    make_move(board, cell, player);
+    fill_play_table(board, !client_turn, visited, search);
+    unmake_move(board, cell, player);
+  }
+}
+
+/**
+ * @brief Build the perfect-play table.
+ *
+ * Must run once before the first game; the table is read-only afterwards
+ * and shared by all client threads without locking.
+ *
+ * @return Number of boards the minimax searches visited.
+ */
+inline uint64_t build_play_table()
+{
+  Board board;
+  std::vector<bool> visited(NUM_POSITIONS, false);
+  Search *search = new Search(); // Too big for the stack
+
+  memset(best_reply, -1, sizeof(best_reply));
+  fill_play_table(board, true, visited, *search);
+
+  uint64_t nodes = search->nodes;
+  delete search;
+  return nodes;
+}
+
+/**
+ * @brief Function to get the best move for the Server.
+ *
+ * An O(1) lookup in the perfect-play table built by build_play_table().
+ *
+ * @param board The current state of the game.
+ * @return The best cell for the Server, -1 if the game is over.
+ */
+inline int find_best_move(const Board &board)
+{
+  return best_reply[encode_board(board)];
+}
+
+#endif
@@ -0,0 +1,195 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <cstdint>
+#include <endian.h>
+#include <string.h>
+#include <string>
+
+/**
+ * Wire protocol between the Tic-Tac-Toe client and server.
+ *
+ * Every message is a 4 byte header followed by count records of 8 bytes,
+ * all in network byte order:
+ *
+ *   | version (1) | opcode (1) | count (2) | record (8) * count |
+ *
+ * OP_HELLO   client -> server, no records. The server answers OP_HELLO with
+ *            one ShapeRecord: rows, columns and k of its board.
+ * OP_MOVE    client -> server, one MoveRecord per game: the game and the
+ *            client's cell. Game IDs are chosen by the client; the first
+ *            move with an unknown ID starts a new game. The server answers
+ *            OP_MOVE with one record per request record, in the same
+ *            order: its cell (NO_CELL if it did not move) and the game's
+ *            status. Finished games are forgotten.
+ * OP_RESIGN  client -> server, one MoveRecord per game to abandon. No
+ *            answer.
+ * OP_ERROR   server -> client, one MoveRecord whose status says why the
+ *            connection is being closed.
+ *
+ * One connection can carry any number of games, and one frame up to
+ * MAX_RECORDS moves of different games.
+ */
+
+#define PROTOCOL_VERSION 1
+#define FRAME_HEADER_LEN 4 // Size of the encoded frame header
+#define RECORD_LEN 8       // Size of every encoded record
+#define MAX_RECORDS 1024   // Largest count a peer may announce
+#define MAX_GAMES 65536    // Open games per connection
+#define NO_CELL 0xFFFF     // MoveRecord::cell when there is no move
+
+enum Opcode
+{
+  OP_HELLO = 1,
+  OP_MOVE = 2,
+  OP_RESIGN = 3,
+  OP_ERROR = 4
+};
+
+enum GameStatus
+{
+  ONGOING = 0,        // Client's turn
+  CLIENT_WON = 1,     // The client's move won
+  SERVER_WON = 2,     // The server's move won
+  DRAW = 3,           // The board is full
+  ILLEGAL_MOVE = 16,  // Cell outside the board or taken; game unchanged
+  BAD_FRAME = 17,     // Unknown opcode or count too large
+  BAD_VERSION = 18,   // Version other than PROTOCOL_VERSION
+  TOO_MANY_GAMES = 19 // New game on a connection with MAX_GAMES games
+};
+
+/**
+ * @brief Header of a frame.
+ */
+struct FrameHeader
+{
+  uint8_t version; // PROTOCOL_VERSION
+  uint8_t opcode;  // Opcode
+  uint16_t count;  // Records after the header
+};
+
+/**
+ * @brief One move of one game.
+ */
+struct MoveRecord
+{
+  uint32_t game_id; // Chosen by the client
+  uint16_t cell;    // Cell number, NO_CELL for none
+  uint8_t status;   // GameStatus, 0 in requests
+  uint8_t reserved; // 0
+};
+
+/**
+ * @brief Board the server plays on.
+ */
+struct ShapeRecord
+{
+  uint16_t rows; // m
+  uint16_t cols; // n
+  uint16_t k;    // Marks in a row needed to win
+};
+
+/**
+ * @brief Append a frame header to a buffer
+ * @param buffer Destination
+ * @param opcode Opcode of the frame
+ * @param count Records that will follow
+ */
+inline void encode_header(std::string &buffer, uint8_t opcode, uint16_t count)
+{
+  char raw[FRAME_HEADER_LEN];
+  uint16_t be_count = htobe16(count);
+  raw[0] = PROTOCOL_VERSION;
+  raw[1] = opcode;
+  memcpy(raw + 2, &be_count, 2);
+  buffer.append(raw, FRAME_HEADER_LEN);
+}
+
+/**
+ * @brief Decode a frame header from a buffer
+ * @param buffer Source, at least FRAME_HEADER_LEN bytes
+ * @return Decoded header in host byte order
+ */
+inline FrameHeader decode_header(const char *buffer)
+{
+  FrameHeader header;
+  uint16_t count;
+  header.version = buffer[0];
+  header.opcode = buffer[1];
+  memcpy(&count, buffer + 2, 2);
+  header.count = be16toh(count);
+  return header;
+}
+
+/**
+ * @brief Append a move record to a buffer
+ * @param buffer Destination
+ * @param record Record to encode
+ */
+inline void encode_move(std::string &buffer, const MoveRecord &record)
+{
+  char raw[RECORD_LEN];
+  uint32_t game_id = htobe32(record.game_id);
+  uint16_t cell = htobe16(record.cell);
+  memcpy(raw, &game_id, 4);
+  memcpy(raw + 4, &cell, 2);
+  raw[6] = record.status;
+  raw[7] = 0;
+  buffer.append(raw, RECORD_LEN);
+}
+
+/**
+ * @brief Decode a move record from a buffer
+ * @param buffer Source, at least RECORD_LEN bytes
+ * @return Decoded record in host byte order
+ */
+inline MoveRecord decode_move(const char *buffer)
+{
+  MoveRecord record;
+  uint32_t game_id;
+  uint16_t cell;
+  memcpy(&game_id, buffer, 4);
+  memcpy(&cell, buffer + 4, 2);
+  record.game_id = be32toh(game_id);
+  record.cell = be16toh(cell);
+  record.status = buffer[6];
+  record.reserved = 0;
+  return record;
+}
+
+/**
+ * @brief Append a shape record to a buffer
+ * @param buffer Destination
+ * @param shape Record to encode
+ */
+inline void encode_shape(std::string &buffer, const ShapeRecord &shape)
+{
+  char raw[RECORD_LEN] = {0};
+  uint16_t rows = htobe16(shape.rows);
+  uint16_t cols = htobe16(shape.cols);
+  uint16_t k = htobe16(shape.k);
+  memcpy(raw, &rows, 2);
+  memcpy(raw + 2, &cols, 2);
+  memcpy(raw + 4, &k, 2);
+  buffer.append(raw, RECORD_LEN);
+}
+
+/**
+ * @brief Decode a shape record from a buffer
+ * @param buffer Source, at least RECORD_LEN bytes
+ * @return Decoded record in host byte order
+ */
+inline ShapeRecord decode_shape(const char *buffer)
+{
+  ShapeRecord shape;
+  uint16_t rows, cols, k;
+  memcpy(&rows, buffer, 2);
+  memcpy(&cols, buffer + 2, 2);
+  memcpy(&k, buffer + 4, 2);
+  shape.rows = be16toh(rows);
+  shape.cols = be16toh(cols);
+  shape.k = be16toh(k);
+  return shape;
+}
+
+#endif
@@ -0,0 +1,317 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <cassert>
+#include <cerrno>
+#include <coroutine>
+#include <exception>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <memory>
+#include <vector>
+
+#include "../common/timer_wheel.h"
+#include "slab.h"
+
+/**
+ * Single-threaded coroutine executor on top of epoll.
+ *
+ * A session is written as a plain sequential coroutine that co_awaits
+ * reads and writes on its non-blocking socket. An operation that cannot
+ * finish at once parks the coroutine in the reactor, which resumes it from
+ * run() once epoll reports the socket ready and the operation completed.
+ * A parked session costs its coroutine frame and one table slot, not a
+ * thread stack. Deadlines are kept in an optional timer wheel that run()
+ * advances between epoll waits.
+ *
+ * Needs C++20 (g++ -std=c++20).
+ */
+
+#define MAX_EVENTS 1024
+
+/**
+ * @brief Slab for coroutine frames of a given size
+ *
+ * Frames are grouped by their size in cache lines; a server has only a
+ * few coroutine functions, so only a few slabs are ever created.
+ *
+ * @param size Frame size in bytes
+ * @return Slab with blocks of at least size bytes
+ */
+inline Slab &frame_slab(size_t size)
+{
+  static std::vector<std::unique_ptr<Slab>> slabs; // By size in cache lines
+  size_t lines = (size + CACHE_LINE - 1) / CACHE_LINE;
+  if (slabs.size() <= lines)
+    slabs.resize(lines + 1);
+  if (!slabs[lines])
+    slabs[lines].reset(new Slab(lines * CACHE_LINE));
+  return *slabs[lines];
+}
+
+/**
+ * @brief Return type of a session coroutine.
+ *
+ * The coroutine starts running at once, until the first co_await that has
+ * to wait, and frees its frame when it returns. Nobody holds a handle to
+ * it: only the reactor (or whoever it waits on) resumes it. Frames come
+ * from frame_slab(), so starting a session does not call malloc.
+ */
+struct Detached
+{
+  struct promise_type
+  {
+    static void *operator new(size_t size)
+    {
+      return frame_slab(size).acquire();
+    }
+    static void operator delete(void *frame, size_t size)
+    {
+      frame_slab(size).release(frame);
+    }
+
+    Detached get_return_object()
+    {
+      return {};
+    }
+    std::suspend_never initial_suspend() noexcept
+    {
+      return {};
+    }
+    std::suspend_never final_suspend() noexcept
+    {
+      return {};
+    }
+    void return_void()
+    {
+    }
+    void unhandled_exception()
+    {
+      std::terminate();
+    }
+  };
+};
+
+/**
+ * @brief One read, write or readiness wait of a parked coroutine.
+ */
+struct IoOp
+{
+  enum Kind
+  {
+    READ,    // Fill buf with exactly len bytes
+    WRITE,   // Send exactly len bytes of buf
+    READABLE // Only wait for the next readable event
+  };
+
+  Kind kind;
+  char *buf;                      // Data to read into or write from
+  size_t len;                     // Bytes to transfer
+  size_t done;                    // Bytes transferred so far
+  bool failed;                    // Peer closed or the socket failed
+  std::coroutine_handle<> handle; // Coroutine to resume when finished
+};
+
+class Reactor
+{
+public:
+  /**
+   * @param timers Wheel whose timers run() fires, NULL for none
+   */
+  explicit Reactor(TimerWheel *timers = NULL) : timers(timers)
+  {
+    epfd = epoll_create1(0);
+    assert((epfd >= 0) && "epoll_create1() failed");
+  }
+
+  /**
+   * @brief Start watching a non-blocking descriptor (edge-triggered)
+   * @param fd Descriptor to watch
+   */
+  void add(int fd)
+  {
+    if ((size_t)fd >= waiting.size())
+      waiting.resize(fd * 2 + 1, NULL); // Rarely, as fds are reused
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.fd = fd;
+    int n = epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+    assert((n >= 0) && "epoll_ctl() failed");
+  }
+
+  /**
+   * @brief Stop watching a descriptor; the caller closes it
+   * @param fd Descriptor to forget
+   */
+  void remove(int fd)
+  {
+    epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+    waiting[fd] = NULL;
+  }
+
+  /**
+   * @brief Awaitable for one operation on a descriptor.
+   */
+  struct Awaiter
+  {
+    Reactor *reactor;
+    int fd;
+    IoOp op;
+
+    bool await_ready()
+    {
+      return op.kind != IoOp::READABLE && progress(fd, op);
+    }
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+      op.handle = handle;
+      reactor->waiting[fd] = &op;
+    }
+    bool await_resume()
+    {
+      return !op.failed;
+    }
+  };
+
+  /**
+   * @brief co_await reactor.read(fd, buf, len): true once len bytes are in
+   * buf, false if the peer closed first or the socket failed
+   */
+  Awaiter read(int fd, void *buf, size_t len)
+  {
+    return Awaiter{this, fd,
+                   IoOp{IoOp::READ, (char *)buf, len, 0, false, {}}};
+  }
+
+  /**
+   * @brief co_await reactor.write(fd, buf, len): true once all len bytes
+   * are sent, false if the socket failed. buf must stay valid until then.
+   */
+  Awaiter write(int fd, const void *buf, size_t len)
+  {
+    return Awaiter{this, fd,
+                   IoOp{IoOp::WRITE, (char *)buf, len, 0, false, {}}};
+  }
+
+  /**
+   * @brief co_await reactor.readable(fd): wait for the next readable event,
+   * e.g. on a listening socket drained up to EAGAIN
+   */
+  Awaiter readable(int fd)
+  {
+    return Awaiter{this, fd, IoOp{IoOp::READABLE, NULL, 0, 0, false, {}}};
+  }
+
+  /**
+   * @brief Awaitable that parks a coroutine on the timer wheel.
+   */
+  struct SleepAwaiter
+  {
+    TimerWheel *timers;
+    Timer *timer;
+    TimerWheel::clock::duration delay;
+
+    bool await_ready()
+    {
+      return false;
+    }
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+      timer->data = handle.address();
+      timer->expire = [](Timer *t)
+      { std::coroutine_handle<>::from_address(t->data).resume(); };
+      timers->schedule(*timer, delay);
+    }
+    void await_resume()
+    {
+    }
+  };
+
+  /**
+   * @brief co_await reactor.sleep(timer, delay): resume after delay, from
+   * run(). Needs the reactor's timer wheel.
+   * @param timer Timer owned by the caller, unused until then
+   * @param delay Time to sleep, rounded up to a tick of the wheel
+   */
+  SleepAwaiter sleep(Timer &timer, TimerWheel::clock::duration delay)
+  {
+    assert((timers != NULL) && "sleep() needs a timer wheel");
+    return SleepAwaiter{timers, &timer, delay};
+  }
+
+  /**
+   * @brief Resume parked coroutines as their operations complete. Never
+   * returns.
+   */
+  void run()
+  {
+    struct epoll_event events[MAX_EVENTS];
+    while (1)
+    {
+      int timeout = timers != NULL ? timers->timeout_ms() : -1;
+      int ready = epoll_wait(epfd, events, MAX_EVENTS, timeout);
+      if (ready < 0 && errno == EINTR)
+        continue;
+      assert((ready >= 0) && "epoll_wait() failed");
+
+      for (int i = 0; i < ready; i++)
+      {
+        // Looked up again for every event: resuming a coroutine may
+        // close descriptors and park others
+        int fd = events[i].data.fd;
+        IoOp *op = waiting[fd];
+        if (op == NULL)
+          continue;
+        if (op->kind != IoOp::READABLE && !progress(fd, *op))
+          continue; // Spurious or partial, keep waiting
+        waiting[fd] = NULL;
+        op->handle.resume();
+      }
+
+      // After the events, which may have pushed deadlines back
+      if (timers != NULL)
+        timers->advance(TimerWheel::clock::now());
+    }
+  }
+
+private:
+  int epfd;                    // epoll instance
+  std::vector<IoOp *> waiting; // Parked operation of each fd, or NULL
+  TimerWheel *timers;          // Fired after every wait, or NULL
+
+  /**
+   * @brief Transfer as much of an operation as the socket allows
+   * @param fd Non-blocking socket
+   * @param op Operation to advance
+   * @return true if the operation finished, successfully or not
+   */
+  static bool progress(int fd, IoOp &op)
+  {
+    while (op.done < op.len)
+    {
+      ssize_t n = op.kind == IoOp::READ
+                      ? ::read(fd, op.buf + op.done, op.len - op.done)
+                      : send(fd, op.buf + op.done, op.len - op.done,
+                             MSG_NOSIGNAL);
+      if (n < 0)
+      {
+        if (errno == EINTR)
+          continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+          return false; // Resume on the next edge
+        op.failed = true;
+        return true;
+      }
+      if (n == 0 && op.kind == IoOp::READ)
+      {
+        op.failed = true; // Peer closed the connection
+        return true;
+      }
+      op.done += n;
+    }
+    return true;
+  }
+};
+
+#endif
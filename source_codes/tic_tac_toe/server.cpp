@@ -3,234 +3,782 @@
 #include <arpa/inet.h>
 #include <cassert>
 #include <chrono>
+#include <coroutine>
+#include <condition_variable>
+#include <csignal>
 #include <cstring>
+#include <fcntl.h>
+#include <getopt.h>
 #include <iostream>
+#include <mutex>
 #include <netdb.h>
 #include <netinet/in.h>
-#include <pthread.h>
-#include <queue>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <string>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <thread>
 #include <unistd.h>
+#include <vector>
+
+#include "engine.h"
+#include "mnk.h"
+#include "play_table.h"
+#include "protocol.h"
+#include "reactor.h"
+#include "session.h"
+#include "slab.h"
+#ifdef COUNT_ALLOCATIONS
+#include "alloc_count.h"
+#endif
 
 using namespace std;
 
+#define ACCEPT_RETRY_MS 100 // Backoff when accept4() runs out of fds
+
 /**
- * @brief Structure for move. Stores the row and column number of the move.
+ * @brief Board shape and search budget, set once from the command line.
  */
-struct Move
+struct GameConfig
 {
-  int row;
-  int col;
+  int rows;      // m
+  int cols;      // n
+  int k;         // Marks in a row needed to win
+  int budget_ms; // Time budget of one move on boards other than 3,3,3
+  int threads;   // Search threads shared by all games, 0 for none
 };
 
-using namespace std;
+static GameConfig config = {3, 3, 3, 1000, -1};
+static const MnkGame *mnk_game;       // Windows of the configured board
+static WorkStealingPool *search_pool; // NULL searches on the worker thread
 
-bool isMovesLeft(vector<vector<int>> &game_board)
+/**
+ * @brief Function to check if the classic game is being played
+ * @return true for 3x3 with 3 in a row, which uses the perfect-play table
+ */
+bool is_classic()
 {
-  for (int i = 0; i < 3; i++)
-    for (int j = 0; j < 3; j++)
-      if (game_board[i][j] == -1)
-        return true;
-  return false;
+  return config.rows == 3 && config.cols == 3 && config.k == 3;
 }
 
-int evaluate_board(vector<vector<int>> &game_board)
+/**
+ * @brief A server move to search on a worker thread.
+ *
+ * Owned by the connection coroutine, which stays suspended until the
+ * reactor thread resumes it with the results of all its jobs.
+ */
+struct MoveJob
+{
+  MnkBoard *board;                // Board to search, owned by the game
+  int move;                       // Chosen cell, filled by the worker
+  MnkSearchInfo info;             // Search statistics, filled by the worker
+  int *pending;                   // Jobs of the batch still searching
+  std::coroutine_handle<> handle; // Connection to resume after the batch
+  MoveJob *next;                  // Next job of a MoveWorkers list
+};
+
+/**
+ * @brief FIFO of jobs threaded through MoveJob::next, so that queueing a
+ * job never allocates.
+ */
+struct JobList
+{
+  MoveJob *head = NULL;
+  MoveJob *tail = NULL;
+
+  bool empty() const
+  {
+    return head == NULL;
+  }
+
+  void push_back(MoveJob *job)
+  {
+    job->next = NULL;
+    if (tail != NULL)
+      tail->next = job;
+    else
+      head = job;
+    tail = job;
+  }
+
+  MoveJob *pop_front()
+  {
+    MoveJob *job = head;
+    head = job->next;
+    if (head == NULL)
+      tail = NULL;
+    return job;
+  }
+};
+
+/**
+ * @brief Fixed pool of threads that search server moves.
+ *
+ * Connections queue jobs by co_awaiting search(); a worker searches, parks
+ * the job in the done list and wakes the reactor through an eventfd, where
+ * resume_searched() resumes the connection once its last job is done.
+ */
+struct MoveWorkers
 {
-  // Rows
-  for (int i = 0; i < 3; i++)
+  mutex lock;
+  condition_variable ready; // Signalled when jobs has work
+  JobList jobs;             // Waiting to be searched
+  JobList done;             // Searched, waiting for the reactor
+  int wakeup_fd;            // eventfd watched by the reactor
+
+  void submit(MoveJob *job)
   {
-    if (game_board[i][0] == game_board[i][1] &&
-        game_board[i][1] == game_board[i][2])
     {
-      if (game_board[i][0] == 1)
-        return +10;
-      else if (game_board[i][0] == 0)
-        return -10;
+      lock_guard<mutex> guard(lock);
+      jobs.push_back(job);
     }
+    ready.notify_one();
   }
 
-  // Columns
-  for (int j = 0; j < 3; j++)
+  void work()
   {
-    if (game_board[0][j] == game_board[1][j] &&
-        game_board[1][j] == game_board[2][j])
+    while (1)
     {
-      if (game_board[0][j] == 1)
-        return +10;
+      MoveJob *job;
+      {
+        unique_lock<mutex> guard(lock);
+        ready.wait(guard, [this] { return !jobs.empty(); });
+        job = jobs.pop_front();
+      }
+
+      job->move = mnk_best_move(*job->board, SERVER, config.budget_ms,
+                                &job->info, search_pool);
 
-      else if (game_board[0][j] == 0)
-        return -10;
+      {
+        lock_guard<mutex> guard(lock);
+        done.push_back(job);
+      }
+      uint64_t one = 1;
+      ssize_t n = write(wakeup_fd, &one, sizeof(one));
+      assert((n == sizeof(one)) && "write() failed");
     }
   }
 
-  // Diagnols
-  if (game_board[0][0] == game_board[1][1] &&
-      game_board[1][1] == game_board[2][2])
+  /**
+   * @brief Take all the searched jobs
+   * @return Jobs in the order they finished
+   */
+  JobList take_done()
   {
-    if (game_board[0][0] == 1)
-      return +10;
-    else if (game_board[0][0] == 0)
-      return -10;
+    lock_guard<mutex> guard(lock);
+    JobList finished = done;
+    done = JobList();
+    return finished;
   }
 
-  if (game_board[0][2] == game_board[1][1] &&
-      game_board[1][1] == game_board[2][0])
+  /**
+   * @brief Awaitable that searches a batch of moves off the reactor thread.
+   */
+  struct Search
+  {
+    MoveWorkers *workers;
+    vector<MoveJob> *jobs;
+    int pending;
+
+    bool await_ready()
+    {
+      return jobs->empty();
+    }
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+      pending = jobs->size();
+      for (MoveJob &job : *jobs)
+      {
+        job.pending = &pending;
+        job.handle = handle;
+        workers->submit(&job);
+      }
+    }
+    void await_resume()
+    {
+    }
+  };
+
+  /**
+   * @brief co_await workers.search(jobs): fill in the move of every job,
+   * searching them in parallel
+   */
+  Search search(vector<MoveJob> &jobs)
   {
-    if (game_board[0][2] == 1)
-      return +10;
-    else if (game_board[0][2] == 0)
-      return -10;
+    return Search{this, &jobs, 0};
   }
+};
 
-  return 0;
-}
+static bool quiet = false; // Do not print every move
+static int idle_timeout = 60; // Seconds a client may wait between frames
+static int read_timeout = 10; // Seconds to receive a frame or take a reply
 
-int minimax(vector<vector<int>> &game_board, int depth, bool is_max)
+// Idle and read deadlines of the connections, used by the reactor thread
+static TimerWheel deadlines(chrono::milliseconds(10));
+
+/**
+ * @brief Server counters, printed on SIGINT and SIGTERM.
+ */
+struct ServerStats
 {
-  int board_score = evaluate_board(game_board);
+  uint64_t accepted;  // Connections accepted
+  uint64_t closed;    // Connections closed, for any reason
+  uint64_t timed_out; // Connections closed because a deadline passed
+};
 
-  if (board_score == 10)
-    return board_score;
+static ServerStats stats = {0, 0, 0};
 
-  if (board_score == -10)
-    return board_score;
+#ifdef COUNT_ALLOCATIONS
+// Reactor thread allocations before serving, see alloc_count.h
+static uint64_t startup_allocations = 0;
+#endif
 
-  if (isMovesLeft(game_board) == false)
-    return 0;
+/**
+ * @brief Put a file descriptor into non-blocking mode
+ * @param fd File descriptor
+ */
+void set_nonblocking(int fd)
+{
+  int flags = fcntl(fd, F_GETFL, 0);
+  assert((flags >= 0) && "fcntl() failed");
+  int n = fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+  assert((n >= 0) && "fcntl() failed");
+}
 
-  if (is_max)
+/**
+ * @brief Connection state that outlives one frame.
+ *
+ * Connections are recycled whole, so their buffers are sized for the
+ * largest frame once and never grow while a client plays.
+ */
+struct Connection
+{
+  int fd;                         // Client socket
+  GameTable games;                // Open games by ID
+  string request;                 // Records of the frame being handled
+  vector<MoveRecord> records;     // Decoded request, turned into the reply
+  string reply;                   // Frame being sent
+  vector<MoveJob> jobs;           // Searches of the frame being handled
+  vector<GameSession *> thinking; // Game of every job
+  vector<int> job_records;        // Index in records of every job
+  Timer deadline;                 // Idle or read deadline
+
+  Connection()
   {
-    int best = -1000;
-    for (int i = 0; i < 3; i++)
+    request.reserve(MAX_RECORDS * RECORD_LEN);
+    records.reserve(MAX_RECORDS);
+    reply.reserve(FRAME_HEADER_LEN + MAX_RECORDS * RECORD_LEN);
+    if (mnk_game != NULL) // 3,3,3 games never search
     {
-      for (int j = 0; j < 3; j++)
-      {
-        if (game_board[i][j] == -1)
-        {
-          game_board[i][j] = 1;
-          best = max(best, minimax(game_board, depth + 1, !is_max));
-          game_board[i][j] = -1;
-        }
-      }
+      jobs.reserve(MAX_RECORDS);
+      thinking.reserve(MAX_RECORDS);
+      job_records.reserve(MAX_RECORDS);
     }
-    return best;
   }
+};
+
+// Used by the reactor thread
+static ObjectPool<GameSession> session_pool; // Games being played
+static Recycler<MnkBoard> board_pool;        // Their boards, on m,n,k
+static Recycler<Connection> connection_pool; // Connections and buffers
+
+/**
+ * @brief Close a connection whose deadline passed
+ *
+ * Shutting the socket down fails the read or write the connection is
+ * parked on, and it cleans up as if the client had left.
+ *
+ * @param timer Deadline of the connection
+ */
+void close_expired(Timer *timer)
+{
+  Connection *conn = (Connection *)timer->data;
+  stats.timed_out++;
+  if (!quiet)
+    printf("Closing connection %d: deadline passed\n", conn->fd);
+  shutdown(conn->fd, SHUT_RDWR);
+}
+
+/**
+ * @brief Arm the deadline of a connection, replacing the previous one
+ * @param conn Connection
+ * @param seconds Time allowed, 0 for none
+ */
+void set_deadline(Connection &conn, int seconds)
+{
+  if (seconds > 0)
+    deadlines.schedule(conn.deadline, chrono::seconds(seconds));
   else
+    deadlines.cancel(conn.deadline);
+}
+
+/**
+ * @brief Return a game's session and board to their pools
+ * @param game Game no longer in a GameTable
+ */
+void release_game(GameSession *game)
+{
+  if (game->mnk_board != NULL)
+    board_pool.release(game->mnk_board);
+  session_pool.release(game);
+}
+
+/**
+ * @brief Forget a game and return its session to the pool
+ * @param conn Connection the game belongs to
+ * @param game Game to end
+ */
+void end_game(Connection &conn, GameSession *game)
+{
+  if (!quiet)
+    printf("Game %u over after %d moves in %ld ms\n", game->game_id,
+           game->moves,
+           (long)chrono::duration_cast<chrono::milliseconds>(
+               chrono::steady_clock::now() - game->started)
+               .count());
+  conn.games.erase(game);
+  release_game(game);
+}
+
+/**
+ * @brief Play the client's move of one game
+ *
+ * 3,3,3 games are answered at once from the perfect-play table. On other
+ * boards the search is queued in conn.jobs and the record left without a
+ * server cell.
+ *
+ * @param conn Connection the game belongs to
+ * @param record Client's move, turned into the reply
+ * @return Game that waits for a search, NULL otherwise
+ */
+GameSession *play_move(Connection &conn, MoveRecord &record)
+{
+  int client_num = record.cell; // client's chosen number
+  record.cell = NO_CELL;
+  record.status = ONGOING;
+
+  GameSession *game = conn.games.find(record.game_id);
+  if (game == NULL)
   {
-    int best = 1000;
-    for (int i = 0; i < 3; i++)
+    if (conn.games.size() >= MAX_GAMES)
     {
-      for (int j = 0; j < 3; j++)
-      {
-        if (game_board[i][j] == -1)
-        {
-          game_board[i][j] = 0;
-          best = min(best, minimax(game_board, depth + 1, !is_max));
-          game_board[i][j] = -1;
-        }
-      }
+      record.status = TOO_MANY_GAMES;
+      return NULL;
+    }
+    MnkBoard *board = NULL;
+    if (mnk_game != NULL)
+    {
+      board = board_pool.acquire(mnk_game);
+      board->clear();
     }
-    return best;
+    game = session_pool.acquire(record.game_id, board);
+    conn.games.insert(game);
+  }
+  game->last_move = chrono::steady_clock::now();
+
+  if (game->mnk_board == NULL)
+  {
+    // Reject cells that do not exist or are already marked
+    if (client_num > 8 || cell_owner(game->board, client_num) != -1)
+    {
+      record.status = ILLEGAL_MOVE;
+      return NULL;
+    }
+
+    make_move(game->board, client_num, CLIENT); // Client makes move
+    game->moves++;
+    int score = evaluate_board(game->board);
+    if (score != 0 || !isMovesLeft(game->board))
+    {
+      record.status = score < 0 ? CLIENT_WON : DRAW;
+      end_game(conn, game);
+      return NULL;
+    }
+
+    int server_num = find_best_move(game->board); // Server's move
+    make_move(game->board, server_num, SERVER);   // Server makes move
+    game->moves++;
+    record.cell = server_num;
+    if (evaluate_board(game->board) > 0)
+      record.status = SERVER_WON;
+    else if (!isMovesLeft(game->board))
+      record.status = DRAW;
+    if (record.status != ONGOING)
+      end_game(conn, game);
+    return NULL;
+  }
+
+  // A game can only move once per frame while its reply is searched
+  MnkBoard &board = *game->mnk_board;
+  if (game->thinking || client_num >= mnk_game->size() ||
+      board.cells[client_num] != -1)
+  {
+    record.status = ILLEGAL_MOVE;
+    return NULL;
   }
+
+  board.make_move(client_num, CLIENT); // Client makes move
+  game->moves++;
+  if (board.winner != -1 || !board.isMovesLeft())
+  {
+    record.status = board.winner != -1 ? CLIENT_WON : DRAW;
+    end_game(conn, game);
+    return NULL;
+  }
+
+  game->thinking = true;
+  conn.jobs.push_back(MoveJob{&board, -1, {}, NULL, {}, NULL});
+  return game;
 }
 
 /**
- * @brief Function to get the best move for the Server.
- * @param game_board The current state of the game.
- * @return The best move for the Server.
+ * @brief Serve one client connection
+ *
+ * Reads frames until the client leaves or breaks the protocol (see
+ * protocol.h). All moves of a frame are played before the reply is sent:
+ * 3,3,3 replies come from the perfect-play table, searches on other
+ * boards run on the workers in parallel while the connection is
+ * suspended. A client that stays silent for idle_timeout, or takes
+ * longer than read_timeout to send a frame or take a reply, is closed.
+ *
+ * @param reactor Reactor the socket is registered with
+ * @param workers Pool searching the m,n,k moves
+ * @param sockfd The client socket.
  */
-Move find_best_move(vector<vector<int>> &game_board)
+Detached handle_clients(Reactor &reactor, MoveWorkers &workers, int sockfd)
 {
-  int best_val = -1000;
-  Move best_move;
-  best_move.row = -1;
-  best_move.col = -1;
+  Connection &conn = *connection_pool.acquire();
+  conn.fd = sockfd;
+  conn.deadline.expire = close_expired;
+  conn.deadline.data = &conn;
+  char raw[FRAME_HEADER_LEN];
 
-  for (int i = 0; i < 3; i++)
+  while (1)
   {
-    for (int j = 0; j < 3; j++)
+    set_deadline(conn, idle_timeout);
+    if (!co_await reactor.read(sockfd, raw, FRAME_HEADER_LEN))
+      break;
+    set_deadline(conn, read_timeout);
+
+    FrameHeader header = decode_header(raw);
+    uint8_t error = ONGOING;
+    if (header.version != PROTOCOL_VERSION)
+      error = BAD_VERSION;
+    else if (header.count > MAX_RECORDS)
+      error = BAD_FRAME;
+    if (error != ONGOING)
+    {
+      conn.reply.clear();
+      encode_header(conn.reply, OP_ERROR, 1);
+      encode_move(conn.reply, MoveRecord{0, NO_CELL, error, 0});
+      co_await reactor.write(sockfd, conn.reply.data(), conn.reply.size());
+      break;
+    }
+
+    conn.request.resize(header.count * RECORD_LEN);
+    if (!co_await reactor.read(sockfd, &conn.request[0], conn.request.size()))
+      break;
+
+    conn.reply.clear();
+    if (header.opcode == OP_HELLO)
+    {
+      encode_header(conn.reply, OP_HELLO, 1);
+      encode_shape(conn.reply, ShapeRecord{(uint16_t)config.rows,
+                                           (uint16_t)config.cols,
+                                           (uint16_t)config.k});
+    }
+    else if (header.opcode == OP_MOVE)
     {
-      if (game_board[i][j] == -1) // Empty celll
+      vector<MoveRecord> &records = conn.records;
+      records.resize(header.count);
+      conn.jobs.clear();
+      conn.thinking.clear();
+      conn.job_records.clear();
+      for (int i = 0; i < header.count; i++)
       {
-        game_board[i][j] = 1; // server makes move
-        int move_val = minimax(game_board, 0, false);
-        game_board[i][j] = -1; // Undo the move
-        if (move_val > best_val)
+        records[i] = decode_move(&conn.request[i * RECORD_LEN]);
+        GameSession *game = play_move(conn, records[i]);
+        if (game != NULL)
         {
-          best_move.row = i;
-          best_move.col = j;
-          best_val = move_val;
+          conn.thinking.push_back(game);
+          conn.job_records.push_back(i);
         }
       }
+
+      // Search the m,n,k replies of the whole frame at once, the client
+      // is not to blame for the time that takes
+      deadlines.cancel(conn.deadline);
+      co_await workers.search(conn.jobs);
+      set_deadline(conn, read_timeout);
+      for (size_t j = 0; j < conn.jobs.size(); j++)
+      {
+        GameSession *game = conn.thinking[j];
+        MoveRecord &record = records[conn.job_records[j]];
+        int server_num = conn.jobs[j].move;
+        game->thinking = false;
+        game->mnk_board->make_move(server_num, SERVER); // Server makes move
+        game->moves++;
+        record.cell = server_num;
+        if (game->mnk_board->winner != -1)
+          record.status = SERVER_WON;
+        else if (!game->mnk_board->isMovesLeft())
+          record.status = DRAW;
+        if (!quiet)
+          cout << "Game " << game->game_id << ": server chose " << server_num
+               << " (depth " << conn.jobs[j].info.depth << ", "
+               << conn.jobs[j].info.nodes << " nodes)" << endl;
+        if (record.status != ONGOING)
+          end_game(conn, game);
+      }
+
+      encode_header(conn.reply, OP_MOVE, header.count);
+      for (MoveRecord &record : records)
+        encode_move(conn.reply, record);
+    }
+    else if (header.opcode == OP_RESIGN)
+    {
+      for (int i = 0; i < header.count; i++)
+      {
+        MoveRecord record = decode_move(&conn.request[i * RECORD_LEN]);
+        GameSession *game = conn.games.find(record.game_id);
+        if (game != NULL)
+          end_game(conn, game);
+      }
+      continue; // No answer
+    }
+    else
+    {
+      encode_header(conn.reply, OP_ERROR, 1);
+      encode_move(conn.reply, MoveRecord{0, NO_CELL, BAD_FRAME, 0});
+      co_await reactor.write(sockfd, conn.reply.data(), conn.reply.size());
+      break;
     }
+
+    if (!co_await reactor.write(sockfd, conn.reply.data(), conn.reply.size()))
+      break;
   }
 
-  return best_move;
+  deadlines.cancel(conn.deadline);
+  conn.games.clear(release_game);
+  connection_pool.release(&conn);
+  reactor.remove(sockfd);
+  close(sockfd);
+  stats.closed++;
 }
 
 /**
- * @brief Function to handle client request
- * @param p_client The client socket.
+ * @brief Accept connections forever and start a game on each
+ * @param reactor Reactor the listening socket is registered with
+ * @param workers Pool searching the m,n,k moves
+ * @param sockfd Non-blocking listening socket
  */
-void *handle_clients(void *p_client)
+Detached accept_clients(Reactor &reactor, MoveWorkers &workers, int sockfd)
 {
+  struct sockaddr_in cli_addr;
+  socklen_t clilen;
+  Timer retry; // Backoff while accept4() runs out of resources
 
-  vector<vector<int>> game_board{{-1, -1, -1}, {-1, -1, -1}, {-1, -1, -1}};
-  int sockfd = *((int *)p_client);
-  free(p_client);
-
-  int n;
-  int client_num = 0, server_num = 0; // client's and server's chosen number
   while (1)
   {
-    // Receive message from client
-    n = read(sockfd, &client_num, sizeof(client_num));
-    assert((n >= 0) && "read() failed");
+    co_await reactor.readable(sockfd);
 
-    game_board[client_num / 3][client_num % 3] = 0; // Client makes move
+    // Accept every pending connection
+    while (1)
+    {
+      clilen = sizeof(cli_addr);
+      int newsockfd = accept4(sockfd, (struct sockaddr *)&cli_addr, &clilen,
+                              SOCK_NONBLOCK);
+      if (newsockfd < 0)
+      {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+          break; // Backlog drained, wait for the next edge
+        if (errno == EINTR || errno == ECONNABORTED)
+          continue;
+        // EMFILE, ENFILE, ENOBUFS, ENOMEM: the listener is edge-triggered,
+        // so the connections still queued would never raise another
+        // event. Retry once closing connections may have freed some.
+        perror("accept4()");
+        co_await reactor.sleep(retry, chrono::milliseconds(ACCEPT_RETRY_MS));
+        continue;
+      }
 
-    Move best_move = find_best_move(game_board);    // Server makes move
-    server_num = best_move.row * 3 + best_move.col; // Server's move
+      if (!quiet)
+        printf("\n New Connection from client %s:%d: \n ",
+               inet_ntoa(cli_addr.sin_addr), ntohs(cli_addr.sin_port));
 
-    if (server_num < 0 && server_num > 8)
-      return nullptr;
+      stats.accepted++;
+      reactor.add(newsockfd);
+      handle_clients(reactor, workers, newsockfd);
+    }
+  }
+}
 
-    game_board[server_num / 3][server_num % 3] = 1; // Server makes move
-    cout << "Server chose: " << server_num << endl;
+/**
+ * @brief Resume the games whose moves the workers have searched
+ * @param reactor Reactor the eventfd is registered with
+ * @param workers Pool searching the m,n,k moves
+ */
+Detached resume_searched(Reactor &reactor, MoveWorkers &workers)
+{
+  while (1)
+  {
+    co_await reactor.readable(workers.wakeup_fd);
 
-    // Send message to client
-    n = write(sockfd, &server_num, sizeof(server_num));
-    assert((n >= 0) && "write() failed");
+    uint64_t count;
+    ssize_t n = read(workers.wakeup_fd, &count, sizeof(count));
+    (void)n; // EAGAIN if an earlier wakeup already covered these jobs
+
+    JobList finished = workers.take_done();
+    while (!finished.empty())
+    {
+      // Popped first: resuming may reuse the job for the next frame
+      MoveJob *job = finished.pop_front();
+      if (--*job->pending == 0)
+        job->handle.resume();
+    }
   }
+}
+
+/**
+ * @brief Print the counters and exit on SIGINT or SIGTERM
+ * @param reactor Reactor the signalfd is registered with
+ * @param sigfd signalfd of SIGINT and SIGTERM
+ */
+Detached report_on_exit(Reactor &reactor, int sigfd)
+{
+  co_await reactor.readable(sigfd);
+  printf("\n%lu connections accepted, %lu closed, %lu of them by a "
+         "deadline\n",
+         (unsigned long)stats.accepted, (unsigned long)stats.closed,
+         (unsigned long)stats.timed_out);
+#ifdef COUNT_ALLOCATIONS
+  uint64_t serving = thread_heap_allocations - startup_allocations;
+  printf("%lu heap allocations on the reactor thread while serving, %.3f "
+         "per connection\n",
+         (unsigned long)serving,
+         stats.accepted ? (double)serving / stats.accepted : 0.0);
+#endif
+  exit(0);
+}
 
-  return nullptr;
+/**
+ * @brief Print usage of the server
+ * @param name Program name
+ */
+void usage(const char *name)
+{
+  fprintf(stderr,
+          "usage %s [-m ROWS] [-n COLS] [-k K] [-T MS] [-j THREADS] "
+          "[-w WORKERS] [-s GAMES] [-c CONNECTIONS] [-i SECONDS] "
+          "[-r SECONDS] [-q] port\n"
+          "  -m ROWS  Rows of the board (default 3)\n"
+          "  -n COLS  Columns of the board (default 3)\n"
+          "  -k K     Marks in a row needed to win (default 3)\n"
+          "  -T MS    Time budget of one server move in ms (default 1000)\n"
+          "  -j N     Search threads shared by all games, 0 searches on\n"
+          "           the worker's thread (default: one per core)\n"
+          "  -w N     Moves searched at the same time (default 4)\n"
+          "  -s N     Game sessions allocated up front (default 1024)\n"
+          "  -c N     Connection buffers allocated up front (default 64)\n"
+          "  -i S     Close clients silent between frames for S seconds,\n"
+          "           0 never (default 60)\n"
+          "  -r S     Close clients that take S seconds to send a frame\n"
+          "           or take a reply, 0 never (default 10)\n"
+          "  -q       Do not print every move\n",
+          name);
+  exit(1);
 }
 
 int main(int argc, char *argv[])
 {
-  int sockfd, newsockfd, port;
-  socklen_t clilen;
-
-  struct sockaddr_in server_addr, cli_addr;
-  int n;
-  if (argc < 2)
+  int sockfd, port;
+
+  struct sockaddr_in server_addr;
+  int n, opt;
+  int num_workers = 4;       // Threads searching m,n,k moves
+  int reserved_games = 1024;     // Sessions allocated up front
+  int reserved_connections = 64; // Connections allocated up front
+  while ((opt = getopt(argc, argv, "m:n:k:T:j:w:s:c:i:r:q")) != -1)
+  {
+    switch (opt)
+    {
+    case 'm':
+      config.rows = atoi(optarg);
+      break;
+    case 'n':
+      config.cols = atoi(optarg);
+      break;
+    case 'k':
+      config.k = atoi(optarg);
+      break;
+    case 'T':
+      config.budget_ms = atoi(optarg);
+      break;
+    case 'j':
+      config.threads = atoi(optarg);
+      break;
+    case 'w':
+      num_workers = atoi(optarg);
+      break;
+    case 's':
+      reserved_games = atoi(optarg);
+      break;
+    case 'c':
+      reserved_connections = atoi(optarg);
+      break;
+    case 'i':
+      idle_timeout = atoi(optarg);
+      break;
+    case 'r':
+      read_timeout = atoi(optarg);
+      break;
+    case 'q':
+      quiet = true;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (optind >= argc)
   {
     fprintf(stderr, "ERROR, no port provided\n");
     exit(1);
   }
+  if (config.rows < 1 || config.cols < 1 || config.k < 1 ||
+      config.k > MNK_MAX_K || config.k > max(config.rows, config.cols) ||
+      config.budget_ms < 1 || num_workers < 1 || idle_timeout < 0 ||
+      read_timeout < 0)
+  {
+    fprintf(stderr, "ERROR, k must fit on the board\n");
+    usage(argv[0]);
+  }
+
+  // SIGINT and SIGTERM are read from a signalfd; blocked before any thread
+  // starts so that every thread inherits the mask
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  n = pthread_sigmask(SIG_BLOCK, &signals, NULL);
+  assert((n == 0) && "pthread_sigmask() failed");
+  int sigfd = signalfd(-1, &signals, SFD_NONBLOCK);
+  assert((sigfd >= 0) && "signalfd() failed");
 
   // Create a TCP socket
   sockfd = socket(AF_INET, SOCK_STREAM, 0);
   assert((sockfd >= 0) && "socket() failed");
 
+  int reuse = 1;
+  n = setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  assert((n >= 0) && "setsockopt() failed");
+
   // Initialize server address
   bzero((char *)&server_addr, sizeof(server_addr));
-  port = atoi(argv[1]);
+  port = atoi(argv[optind]);
   server_addr.sin_family = AF_INET;
   server_addr.sin_port = htons(port);
   server_addr.sin_addr.s_addr = INADDR_ANY;
@@ -239,22 +787,56 @@ int main(int argc, char *argv[])
   n = bind(sockfd, (struct sockaddr *)&server_addr, sizeof(server_addr));
   assert((n >= 0) && "bind() failed");
 
-  listen(sockfd, 5); // Listen for connections
+  n = listen(sockfd, SOMAXCONN); // Listen for connections
+  assert((n >= 0) && "listen() failed");
+  set_nonblocking(sockfd);
 
-  while (1)
+  if (is_classic())
   {
-    clilen = sizeof(cli_addr);
-    newsockfd = accept(sockfd, (struct sockaddr *)&cli_addr, &clilen);
-    assert((newsockfd >= 0) && "accept() failed");
-
-    printf("\n New Connection from client %s:%d: \n ",
-           inet_ntoa(cli_addr.sin_addr), ntohs(cli_addr.sin_port));
-
-    // Create threads for multiple clients
-    pthread_t thread;
-    int *p_client = new int;
-    *p_client = newsockfd;
-    pthread_create(&thread, NULL, handle_clients, p_client);
+    // Solve the game once, every move after this is a table lookup
+    auto start = chrono::steady_clock::now();
+    uint64_t nodes = build_play_table();
+    auto elapsed = chrono::duration_cast<chrono::milliseconds>(
+        chrono::steady_clock::now() - start);
+    printf("Perfect-play table built in %ld ms (%lu nodes searched)\n",
+           (long)elapsed.count(), (unsigned long)nodes);
   }
+  else
+  {
+    mnk_game = new MnkGame(config.rows, config.cols, config.k);
+    if (config.threads < 0)
+      config.threads = max(1u, thread::hardware_concurrency());
+    if (config.threads > 0)
+      search_pool = new WorkStealingPool(config.threads);
+    printf("Playing %d,%d,%d with %d ms per move on %d search threads\n",
+           config.rows, config.cols, config.k, config.budget_ms,
+           config.threads);
+  }
+
+  // Searches run on the workers; everything else on this thread
+  MoveWorkers workers;
+  workers.wakeup_fd = eventfd(0, EFD_NONBLOCK);
+  assert((workers.wakeup_fd >= 0) && "eventfd() failed");
+  for (int i = 0; i < num_workers && !is_classic(); i++)
+    thread(&MoveWorkers::work, &workers).detach();
+
+  // Sessions beyond these come from the system a slab at a time, and
+  // connections and boards beyond these one at a time
+  session_pool.reserve(max(reserved_games, 0));
+  connection_pool.reserve(max(reserved_connections, 0));
+  if (mnk_game != NULL)
+    board_pool.reserve(max(reserved_games, 0), mnk_game);
+
+  Reactor reactor(&deadlines);
+  reactor.add(sockfd);
+  reactor.add(workers.wakeup_fd);
+  reactor.add(sigfd);
+  accept_clients(reactor, workers, sockfd);
+  resume_searched(reactor, workers);
+  report_on_exit(reactor, sigfd);
+#ifdef COUNT_ALLOCATIONS
+  startup_allocations = thread_heap_allocations;
+#endif
+  reactor.run();
   return 0;
-}
\ No newline at end of file
+}
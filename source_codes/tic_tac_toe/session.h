@@ -0,0 +1,176 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include "engine.h"
+#include "mnk.h"
+#include "slab.h"
+
+/**
+ * @brief Everything the server keeps about one game.
+ *
+ * A 3,3,3 game fits in one cache line: the client's game ID, the board as
+ * two bitmasks, the move count and the timestamps used for deadlines and
+ * statistics. Sessions come from an ObjectPool, so starting a game does
+ * not call malloc. Other boards add an MnkBoard, which the server
+ * recycles along with the session.
+ */
+struct alignas(CACHE_LINE) GameSession
+{
+  uint32_t game_id;                                // Chosen by the client
+  uint16_t moves;                                  // Moves by both players
+  bool thinking;                                   // Server move searching
+  Board board;                                     // 3,3,3 game
+  MnkBoard *mnk_board;                             // Other games, else NULL
+  GameSession *next;                               // Chain in a GameTable
+  std::chrono::steady_clock::time_point started;   // First move
+  std::chrono::steady_clock::time_point last_move; // Last client move
+
+  /**
+   * @param game_id ID chosen by the client
+   * @param mnk_board Empty board of another game, owned by the caller;
+   * NULL for 3,3,3
+   */
+  GameSession(uint32_t game_id, MnkBoard *mnk_board)
+      : game_id(game_id), moves(0), thinking(false), mnk_board(mnk_board),
+        next(NULL), started(std::chrono::steady_clock::now()),
+        last_move(started)
+  {
+  }
+};
+
+static_assert(sizeof(GameSession) == CACHE_LINE, "one cache line");
+
+#define GAME_TABLE_INLINE 8 // Buckets before a GameTable allocates
+
+/**
+ * @brief The open games of one connection, by game ID.
+ *
+ * A chained hash table threaded through GameSession::next. The first
+ * GAME_TABLE_INLINE buckets are part of the table, so a connection with
+ * few games never allocates; beyond that adding a game only allocates when
+ * the bucket array doubles.
+ */
+class GameTable
+{
+public:
+  GameTable()
+      : buckets(inline_buckets), num_buckets(GAME_TABLE_INLINE),
+        shift(32 - __builtin_ctz(GAME_TABLE_INLINE)), count(0)
+  {
+    std::fill(inline_buckets, inline_buckets + GAME_TABLE_INLINE,
+              (GameSession *)NULL);
+  }
+
+  GameTable(const GameTable &) = delete;
+  GameTable &operator=(const GameTable &) = delete;
+
+  size_t size() const
+  {
+    return count;
+  }
+
+  GameSession *find(uint32_t game_id) const
+  {
+    GameSession *game = buckets[bucket(game_id)];
+    while (game != NULL && game->game_id != game_id)
+      game = game->next;
+    return game;
+  }
+
+  /**
+   * @brief Add a game whose ID is not in the table yet
+   * @param game Game to add
+   */
+  void insert(GameSession *game)
+  {
+    if (count >= num_buckets)
+      rehash(num_buckets * 2);
+    GameSession *&head = buckets[bucket(game->game_id)];
+    game->next = head;
+    head = game;
+    count++;
+  }
+
+  /**
+   * @brief Remove a game from the table
+   * @param game Game in the table
+   */
+  void erase(GameSession *game)
+  {
+    GameSession **link = &buckets[bucket(game->game_id)];
+    while (*link != game)
+      link = &(*link)->next;
+    *link = game->next;
+    count--;
+  }
+
+  /**
+   * @brief Empty the table in one pass over the buckets
+   * @param release Called with every game once it is out of the table
+   */
+  template <class F> void clear(F release)
+  {
+    for (size_t b = 0; b < num_buckets; b++)
+    {
+      GameSession *game = buckets[b];
+      buckets[b] = NULL;
+      while (game != NULL)
+      {
+        GameSession *next = game->next;
+        release(game);
+        game = next;
+      }
+    }
+    count = 0;
+  }
+
+private:
+  GameSession **buckets;                          // inline_buckets or grown
+  size_t num_buckets;                             // A power of two
+  int shift;                                      // 32 - log2(num_buckets)
+  GameSession *inline_buckets[GAME_TABLE_INLINE]; // Of a small table
+  std::vector<GameSession *> grown;               // Of a larger table
+  size_t count;                                   // Games in the table
+
+  size_t bucket(uint32_t game_id) const
+  {
+    return bucket(game_id, shift);
+  }
+
+  static size_t bucket(uint32_t game_id, int shift)
+  {
+    // Fibonacci hashing: the high bits of the product depend on every bit
+    // of the ID, so IDs a multiple of the bucket count apart, which a
+    // client may choose, still spread out
+    return (uint32_t)(game_id * 2654435769u) >> shift;
+  }
+
+  void rehash(size_t size)
+  {
+    std::vector<GameSession *> larger(size, NULL);
+    int larger_shift = 32 - __builtin_ctzll(size);
+    for (size_t b = 0; b < num_buckets; b++)
+    {
+      GameSession *head = buckets[b];
+      while (head != NULL)
+      {
+        GameSession *next = head->next;
+        GameSession *&slot = larger[bucket(head->game_id, larger_shift)];
+        head->next = slot;
+        slot = head;
+        head = next;
+      }
+    }
+    grown.swap(larger);
+    buckets = grown.data();
+    num_buckets = size;
+    shift = larger_shift;
+  }
+};
+
+#endif
@@ -0,0 +1,210 @@
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <netdb.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+#include "alloc_count.h"
+#include "protocol.h"
+#include "reactor.h"
+#include "session.h"
+
+using namespace std;
+using namespace std::chrono;
+
+/**
+ * Benchmark of starting and ending game sessions.
+ *
+ * Without arguments it compares, in one process, what the session pool
+ * replaced (a new int, a thread and a vector<vector<int>> board per
+ * client) with a pooled GameSession and coroutine frame, in sessions/s
+ * and heap allocations per session. That covers the session alone, not
+ * the socket, the buffers or the games of a real connection.
+ *
+ * With HOST PORT it instead plays one move per connection against a
+ * running server, as fast as it can, and prints connections/s. A server
+ * built with -DCOUNT_ALLOCATIONS prints its own heap allocations per
+ * connection when it exits, for the whole accept and move path.
+ */
+
+/**
+ * @brief Result of one benchmark run.
+ */
+struct Result
+{
+  double seconds;       // Wall clock time
+  uint64_t allocations; // operator new calls during the run
+};
+
+/**
+ * @brief Body of an old-style client thread: the board it used to build
+ * @param p_client The client socket, allocated by the accept loop.
+ */
+void *old_session(void *p_client)
+{
+  vector<vector<int>> game_board{{-1, -1, -1}, {-1, -1, -1}, {-1, -1, -1}};
+  game_board[1][1] = *((int *)p_client);
+  delete (int *)p_client;
+  return nullptr;
+}
+
+/**
+ * @brief Start and end sessions the way the thread-per-client server did
+ * @param sessions Number of sessions
+ * @return Time and allocations of the run
+ */
+Result bench_thread_sessions(int sessions)
+{
+  uint64_t before = heap_allocations;
+  auto start = steady_clock::now();
+  for (int i = 0; i < sessions; i++)
+  {
+    int *p_client = new int(i);
+    pthread_t thread;
+    int n = pthread_create(&thread, NULL, old_session, p_client);
+    assert((n == 0) && "pthread_create() failed");
+    pthread_join(thread, NULL);
+  }
+  return {duration<double>(steady_clock::now() - start).count(),
+          heap_allocations - before};
+}
+
+static ObjectPool<GameSession> session_pool;
+static coroutine_handle<> parked; // Session waiting for its "move"
+
+/**
+ * @brief Awaitable that parks a session as if it waited for the client.
+ */
+struct Park
+{
+  bool await_ready()
+  {
+    return false;
+  }
+  void await_suspend(coroutine_handle<> handle)
+  {
+    parked = handle;
+  }
+  void await_resume()
+  {
+  }
+};
+
+/**
+ * @brief A session coroutine that waits once and releases its session,
+ * standing in for the server's handle_clients()
+ * @param session Session from session_pool
+ */
+Detached pooled_session(GameSession *session)
+{
+  co_await Park();
+  make_move(session->board, 4, CLIENT);
+  session->moves++;
+  session_pool.release(session);
+}
+
+/**
+ * @brief Start and end sessions the way the coroutine server does
+ * @param sessions Number of sessions
+ * @return Time and allocations of the run
+ */
+Result bench_pooled_sessions(int sessions)
+{
+  uint64_t before = heap_allocations;
+  auto start = steady_clock::now();
+  for (int i = 0; i < sessions; i++)
+  {
+    pooled_session(session_pool.acquire(i, (MnkBoard *)NULL));
+    parked.resume();
+  }
+  return {duration<double>(steady_clock::now() - start).count(),
+          heap_allocations - before};
+}
+
+/**
+ * @brief Print one line of the results table
+ * @param name Name of the implementation
+ * @param result Result of the run
+ * @param sessions Sessions in the run
+ */
+void print_result(string name, Result &result, int sessions)
+{
+  cout << setw(10) << name << setw(16) << fixed << setprecision(0)
+       << sessions / result.seconds << setw(16) << setprecision(2)
+       << (double)result.allocations / sessions << endl;
+}
+
+/**
+ * @brief Open connections one after another and play one move on each
+ * @param host Server host
+ * @param port Server port
+ * @param connections Number of connections
+ */
+void bench_connections(const char *host, const char *port, int connections)
+{
+  struct addrinfo hints, *result;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  int n = getaddrinfo(host, port, &hints, &result);
+  assert((n == 0) && "getaddrinfo() failed");
+
+  string hello, move; // Handshake, then cell 4 of game 1
+  encode_header(hello, OP_HELLO, 0);
+  encode_header(move, OP_MOVE, 1);
+  encode_move(move, MoveRecord{1, 4, 0, 0});
+
+  int failed = 0;
+  auto start = steady_clock::now();
+  for (int i = 0; i < connections; i++)
+  {
+    int sockfd = socket(result->ai_family, SOCK_STREAM, 0);
+    assert((sockfd >= 0) && "socket() failed");
+    char reply[FRAME_HEADER_LEN + RECORD_LEN];
+    if (connect(sockfd, result->ai_addr, result->ai_addrlen) < 0 ||
+        write(sockfd, hello.data(), hello.size()) != (ssize_t)hello.size() ||
+        recv(sockfd, reply, sizeof(reply), MSG_WAITALL) != sizeof(reply) ||
+        write(sockfd, move.data(), move.size()) != (ssize_t)move.size() ||
+        recv(sockfd, reply, sizeof(reply), MSG_WAITALL) != sizeof(reply))
+      failed++;
+    close(sockfd);
+  }
+  double seconds = duration<double>(steady_clock::now() - start).count();
+  freeaddrinfo(result);
+
+  cout << connections << " connections in " << fixed << setprecision(2)
+       << seconds << " s: " << setprecision(0) << connections / seconds
+       << " connections/s, " << failed << " failed" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc >= 3)
+  {
+    bench_connections(argv[1], argv[2], argc > 3 ? atoi(argv[3]) : 10000);
+    return 0;
+  }
+
+  int sessions = argc > 1 ? atoi(argv[1]) : 20000;
+  bench_pooled_sessions(SLAB_BLOCKS); // Warm up the slabs
+
+  Result threads = bench_thread_sessions(sessions);
+  Result pooled = bench_pooled_sessions(sessions);
+
+  cout << setw(10) << "Sessions" << setw(16) << "Sessions/s" << setw(16)
+       << "Allocs/session" << endl;
+  print_result("thread", threads, sessions);
+  print_result("pooled", pooled, sessions);
+  cout << endl
+       << "Pooled sessions: " << setprecision(1)
+       << threads.seconds / pooled.seconds << "x faster to start and end"
+       << endl;
+  return 0;
+}
@@ -0,0 +1,242 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <cassert>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <utility>
+#include <vector>
+
+/**
+ * Slab allocator for fixed-size objects.
+ *
+ * Blocks are carved out of large cache-line aligned slabs and recycled
+ * through an intrusive free list, so acquire() and release() are a couple
+ * of pointer moves. Memory is only requested from the system when every
+ * block is in use, one slab at a time, and is never given back; after
+ * reserve() or a warm-up the accept and move paths do not call malloc.
+ * Objects that own growing buffers are kept whole by a Recycler instead,
+ * so that their buffers outlive them too.
+ *
+ * Not thread-safe: each slab belongs to one thread (the reactor's).
+ */
+
+#define CACHE_LINE 64
+#define SLAB_BLOCKS 256 // Blocks allocated at a time when the slab is empty
+
+class Slab
+{
+public:
+  /**
+   * @param size Bytes per block, rounded up to whole cache lines
+   */
+  explicit Slab(size_t size)
+      : block_size((size + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE),
+        free_list(NULL), in_use(0)
+  {
+  }
+
+  ~Slab()
+  {
+    for (void *chunk : chunks)
+      ::operator delete(chunk, std::align_val_t(CACHE_LINE));
+  }
+
+  Slab(const Slab &) = delete;
+  Slab &operator=(const Slab &) = delete;
+
+  /**
+   * @brief Take a block
+   * @return Cache-line aligned memory of block_size bytes
+   */
+  void *acquire()
+  {
+    if (free_list == NULL)
+      grow(SLAB_BLOCKS);
+    FreeBlock *block = free_list;
+    free_list = block->next;
+    in_use++;
+    return block;
+  }
+
+  /**
+   * @brief Give back a block from acquire()
+   * @param p Block to recycle
+   */
+  void release(void *p)
+  {
+    FreeBlock *block = (FreeBlock *)p;
+    block->next = free_list;
+    free_list = block;
+    in_use--;
+  }
+
+  /**
+   * @brief Make sure n blocks can be acquired without allocating
+   * @param n Blocks to have ready
+   */
+  void reserve(size_t n)
+  {
+    size_t available = capacity() - in_use;
+    if (n > available)
+      grow(n - available);
+  }
+
+  size_t size() const
+  {
+    return block_size;
+  }
+
+  size_t capacity() const
+  {
+    return total;
+  }
+
+  size_t used() const
+  {
+    return in_use;
+  }
+
+private:
+  struct FreeBlock
+  {
+    FreeBlock *next;
+  };
+
+  size_t block_size;          // Bytes per block, a multiple of CACHE_LINE
+  FreeBlock *free_list;       // Blocks ready to be acquired
+  size_t in_use;              // Blocks acquired and not released
+  size_t total = 0;           // Blocks in all the chunks
+  std::vector<void *> chunks; // Memory from the system
+
+  /**
+   * @brief Allocate one more chunk and put its blocks on the free list
+   * @param n Blocks in the chunk
+   */
+  void grow(size_t n)
+  {
+    // Through operator new, so that allocation counters see it
+    char *chunk =
+        (char *)::operator new(n * block_size, std::align_val_t(CACHE_LINE));
+    chunks.push_back(chunk);
+    // Push in reverse so blocks are handed out in address order
+    for (size_t i = n; i-- > 0;)
+    {
+      FreeBlock *block = (FreeBlock *)(chunk + i * block_size);
+      block->next = free_list;
+      free_list = block;
+    }
+    total += n;
+  }
+};
+
+/**
+ * @brief Slab of objects of type T, constructed and destroyed in place.
+ */
+template <class T> class ObjectPool
+{
+public:
+  ObjectPool() : slab(sizeof(T))
+  {
+    static_assert(alignof(T) <= CACHE_LINE, "over-aligned type");
+  }
+
+  template <class... Args> T *acquire(Args &&...args)
+  {
+    return new (slab.acquire()) T(std::forward<Args>(args)...);
+  }
+
+  void release(T *object)
+  {
+    object->~T();
+    slab.release(object);
+  }
+
+  void reserve(size_t n)
+  {
+    slab.reserve(n);
+  }
+
+  size_t used() const
+  {
+    return slab.used();
+  }
+
+private:
+  Slab slab;
+};
+
+/**
+ * @brief Objects of type T that keep their buffers between uses.
+ *
+ * Unlike an ObjectPool, a released object is not destroyed: it waits,
+ * with whatever its strings and vectors grew to, until acquire() hands it
+ * out again, and the caller resets the rest. Only creating an object
+ * beyond those reserved or released before calls malloc.
+ */
+template <class T> class Recycler
+{
+public:
+  Recycler() : created(0)
+  {
+  }
+
+  ~Recycler()
+  {
+    for (T *object : spare)
+      delete object;
+  }
+
+  Recycler(const Recycler &) = delete;
+  Recycler &operator=(const Recycler &) = delete;
+
+  /**
+   * @brief Take a released object, or create one
+   * @param args Constructor arguments, only used to create one
+   * @return Object, as it was released if it was recycled
+   */
+  template <class... Args> T *acquire(Args &&...args)
+  {
+    if (spare.empty())
+      return create(std::forward<Args>(args)...);
+    T *object = spare.back();
+    spare.pop_back();
+    return object;
+  }
+
+  /**
+   * @brief Keep an object for a later acquire()
+   * @param object Object from acquire()
+   */
+  void release(T *object)
+  {
+    spare.push_back(object); // Never grows, see create()
+  }
+
+  /**
+   * @brief Make sure n objects can be acquired without allocating
+   * @param n Objects to have ready
+   * @param args Constructor arguments of the objects created
+   */
+  template <class... Args> void reserve(size_t n, const Args &...args)
+  {
+    while (spare.size() < n)
+      spare.push_back(create(args...));
+  }
+
+private:
+  std::vector<T *> spare; // Released objects
+  size_t created;         // Objects created, in use or spare
+
+  template <class... Args> T *create(Args &&...args)
+  {
+    created++;
+    // Room for every object, so that release() does not allocate
+    if (spare.capacity() < created)
+      spare.reserve(created * 2);
+    return new T(std::forward<Args>(args)...);
+  }
+};
+
+#endif
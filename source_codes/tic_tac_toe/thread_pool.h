@@ -0,0 +1,214 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Work-stealing thread pool for the game searches.
+ *
+ * Every worker owns a deque. Tasks submitted by a worker go to the back of
+ * its own deque and it takes work from the back (newest, deepest in the
+ * search tree first); idle workers steal from the front of the others
+ * (oldest, biggest subtrees). Tasks from any other thread are dealt to the
+ * workers round robin, so concurrent games share the workers.
+ */
+
+/**
+ * @brief Tasks that are waited for together.
+ */
+struct TaskGroup
+{
+  std::atomic<int> pending{0};  // Submitted tasks that have not finished
+  std::mutex lock;              // Taken to finish a task
+  std::condition_variable done; // Signalled when pending drops to 0
+};
+
+class WorkStealingPool
+{
+public:
+  /**
+   * @brief Start the workers
+   * @param num_threads Number of worker threads, at least 1
+   */
+  explicit WorkStealingPool(int num_threads)
+  {
+    if (num_threads < 1)
+      num_threads = 1;
+    for (int i = 0; i < num_threads; i++)
+      queues.emplace_back(new Queue());
+    for (int i = 0; i < num_threads; i++)
+      threads.emplace_back(&WorkStealingPool::worker_loop, this, i);
+  }
+
+  ~WorkStealingPool()
+  {
+    {
+      std::lock_guard<std::mutex> guard(idle_lock);
+      stopping = true;
+    }
+    idle.notify_all();
+    for (auto &thread : threads)
+      thread.join();
+  }
+
+  int size() const
+  {
+    return (int)threads.size();
+  }
+
+  /**
+   * @brief Queue a task
+   * @param group Group the task belongs to
+   * @param run Work to do; must not throw
+   */
+  void submit(TaskGroup &group, std::function<void()> run)
+  {
+    group.pending++;
+    int target = self() >= 0 ? self() : (int)(next_queue++ % queues.size());
+    {
+      std::lock_guard<std::mutex> guard(queues[target]->lock);
+      queues[target]->tasks.push_back(Task{&group, std::move(run)});
+    }
+    {
+      std::lock_guard<std::mutex> guard(idle_lock);
+      queued++;
+    }
+    idle.notify_one();
+  }
+
+  /**
+   * @brief Wait until every task of a group has finished
+   *
+   * A worker keeps running queued tasks while it waits, so a search can
+   * wait for its own subtasks without starving the pool. Other threads
+   * sleep.
+   *
+   * @param group Group to wait for
+   */
+  void wait(TaskGroup &group)
+  {
+    if (self() >= 0)
+    {
+      while (group.pending.load() > 0)
+        if (!run_one(self()))
+          std::this_thread::yield();
+    }
+
+    // Also waits for the last task to let go of the lock
+    std::unique_lock<std::mutex> guard(group.lock);
+    group.done.wait(guard, [&group] { return group.pending.load() == 0; });
+  }
+
+private:
+  struct Task
+  {
+    TaskGroup *group;
+    std::function<void()> run;
+  };
+
+  struct Queue
+  {
+    std::mutex lock;
+    std::deque<Task> tasks;
+  };
+
+  std::vector<std::unique_ptr<Queue>> queues; // One per worker
+  std::vector<std::thread> threads;
+  std::atomic<unsigned> next_queue{0}; // Round robin for outside threads
+  std::mutex idle_lock;                // Guards queued and stopping
+  std::condition_variable idle;        // Sleeping workers wait here
+  int queued = 0;                      // Tasks in all the deques
+  bool stopping = false;
+
+  // Pool and deque of the calling thread, NULL and -1 outside any pool
+  inline static thread_local WorkStealingPool *current_pool = NULL;
+  inline static thread_local int worker_index = -1;
+
+  /**
+   * @brief Deque of the calling thread
+   * @return Worker index, -1 if the caller is not a worker of this pool
+   */
+  int self() const
+  {
+    return current_pool == this ? worker_index : -1;
+  }
+
+  /**
+   * @brief Take a task, from the own deque first, else steal one
+   * @param index Index of the calling worker
+   * @param task Filled with the task
+   * @return true if a task was taken
+   */
+  bool take(int index, Task &task)
+  {
+    int n = (int)queues.size();
+    for (int i = 0; i < n; i++)
+    {
+      Queue &queue = *queues[(index + i) % n];
+      std::lock_guard<std::mutex> guard(queue.lock);
+      if (queue.tasks.empty())
+        continue;
+      if (i == 0)
+      {
+        task = std::move(queue.tasks.back());
+        queue.tasks.pop_back();
+      }
+      else
+      {
+        task = std::move(queue.tasks.front());
+        queue.tasks.pop_front();
+      }
+      return true;
+    }
+    return false;
+  }
+
+  /**
+   * @brief Run one queued task
+   * @param index Index of the calling worker
+   * @return false if there was nothing to run
+   */
+  bool run_one(int index)
+  {
+    Task task;
+    if (!take(index, task))
+      return false;
+    {
+      std::lock_guard<std::mutex> guard(idle_lock);
+      queued--;
+    }
+
+    task.run();
+
+    // Under the lock, so the group cannot be destroyed in between
+    TaskGroup *group = task.group;
+    std::lock_guard<std::mutex> guard(group->lock);
+    if (--group->pending == 0)
+      group->done.notify_all();
+    return true;
+  }
+
+  void worker_loop(int index)
+  {
+    current_pool = this;
+    worker_index = index;
+    while (1)
+    {
+      if (run_one(index))
+        continue;
+      std::unique_lock<std::mutex> guard(idle_lock);
+      idle.wait(guard, [this] { return stopping || queued > 0; });
+      if (stopping)
+        return;
+    }
+  }
+};
+
+#endif